@@ -46,10 +46,8 @@
 #include "virt-viewer-session.h"
 #include "view/autoDrawer.h"
 
-static VirtViewerApp *app;
-
-static gboolean reconnect = FALSE;
-static gboolean dialog = TRUE;
+/* seconds between two network failure messages of the same session */
+#define NETWORK_WARNING_INTERVAL 60
 
 
 static void
@@ -88,23 +86,39 @@ static void connected(VirtViewerSession *session,
     g_free(uri);
 }
 
-static void input_reconnect( VirtViewerApp *self G_GNUC_UNUSED)
+static void input_reconnect(VirtViewerSession *session G_GNUC_UNUSED,
+                            VirtViewerApp *self)
 {
-    reconnect = TRUE;
+    virt_viewer_app_set_restart(self, TRUE);
 }
 
-static gint dialog_set()
+static void input_timeout(VirtViewerSession *session G_GNUC_UNUSED,
+                          VirtViewerApp *self)
 {
-	dialog = TRUE;	
-	return TRUE;
+    gint64 now = g_get_monotonic_time();
+    gint64 last = virt_viewer_app_get_network_warned(self);
+
+    if (last != 0 && now - last < NETWORK_WARNING_INTERVAL * G_USEC_PER_SEC)
+        return;
+
+    virt_viewer_app_set_network_warned(self, now);
+    virt_viewer_app_simple_message_dialog(self,_("Network failure, please check the network"));
 }
-static void input_timeout()
+
+static gboolean
+start_viewer(VirtViewerApp *app)
 {
-	if(dialog)
-		{
-			virt_viewer_app_simple_message_dialog(app,_("Network failure, please check the network"));
-			dialog = FALSE;
-		}
+    if (!virt_viewer_app_start(app))
+        return FALSE;
+
+    g_signal_connect(virt_viewer_app_get_session(app), "session-connected",
+                     G_CALLBACK(connected), app);
+    g_signal_connect(virt_viewer_app_get_session(app), "session-reconnect",
+                     G_CALLBACK(input_reconnect), app);
+	g_signal_connect(virt_viewer_app_get_session(app), "session-inputstimeout",
+                     G_CALLBACK(input_timeout), app);
+
+    return TRUE;
 }
 
 /*static void timeout_toolbar( VirtViewerApp *self )
@@ -121,9 +135,11 @@ main(int argc, char **argv)
     GError *error = NULL;
     int ret = 1;
     gchar **args = NULL;
-    gchar *uri = NULL;
     char *title = NULL;
     RemoteViewer *viewer = NULL;
+    GPtrArray *viewers = g_ptr_array_new_with_free_func(g_object_unref);
+    gboolean running;
+    guint i;
     char *host = NULL;
     char *port= NULL;
     char *tls_port= NULL;
@@ -200,58 +216,68 @@ main(int argc, char **argv)
         }
     } else
 #endif
-    if (args) {
-        if (g_strv_length(args) > 1) {
-            g_printerr(_("Error: can't handle multiple URIs\n"));
-            goto cleanup;
-        } else if (g_strv_length(args) == 1) {
-            uri = g_strdup(args[0]);
-        }
+    /* each URI gets its own app and session, all sharing this process */
+    if (args && g_strv_length(args) > 1 && (host || port || tls_port || password)) {
+        g_printerr(_("Error: connection options can't be used with multiple URIs\n"));
+        goto cleanup;
     }
 
 #ifdef HAVE_SPICE_GTK
     if (controller) {
         viewer = remote_viewer_new_with_controller();
         g_object_set(viewer, "guest-name", "defined by Spice controller", NULL);
-    } else {
+        g_ptr_array_add(viewers, viewer);
+    } else
 #endif
-        viewer = remote_viewer_new(uri, host, port, tls_port, password);
-        if (title)
-            g_object_set(viewer, "title", title, NULL);
-
-#ifdef HAVE_SPICE_GTK
+    if (args == NULL) {
+        viewer = remote_viewer_new(NULL, host, port, tls_port, password);
+        if (viewer == NULL)
+            goto cleanup;
+        g_ptr_array_add(viewers, viewer);
+    } else {
+        for (i = 0; args[i] != NULL; i++) {
+            viewer = remote_viewer_new(args[i], host, port, tls_port, password);
+            if (viewer == NULL)
+                goto cleanup;
+            g_ptr_array_add(viewers, viewer);
+        }
     }
-#endif
-    if (viewer == NULL)
-        goto cleanup;
 
-    app = VIRT_VIEWER_APP(viewer);
+    running = FALSE;
+    for (i = 0; i < viewers->len; i++) {
+        VirtViewerApp *app = g_ptr_array_index(viewers, i);
 
-rec:
-    if (!virt_viewer_app_start(app))
+        if (title)
+            g_object_set(app, "title", title, NULL);
+        running |= start_viewer(app);
+    }
+    if (!running)
         goto cleanup;
 
-    g_signal_connect(virt_viewer_app_get_session(app), "session-connected",
-                     G_CALLBACK(connected), app);
-    g_signal_connect(virt_viewer_app_get_session(app), "session-reconnect",
-                     G_CALLBACK(input_reconnect), app);
-	g_signal_connect(virt_viewer_app_get_session(app), "session-inputstimeout",
-                     G_CALLBACK(input_timeout), app);
-	
-	g_timeout_add_seconds(60,dialog_set,NULL);
+    /* The main loop returns each time one of the apps is done. A session
+     * resumes in place after a network drop and only asks for a full
+     * restart once it gave up retrying; the other sessions are not
+     * affected and keep running. */
+    do {
+        gtk_main();
 
-    gtk_main();
+        running = FALSE;
+        for (i = 0; i < viewers->len; i++) {
+            VirtViewerApp *app = g_ptr_array_index(viewers, i);
+
+            if (!virt_viewer_app_is_running(app) &&
+                virt_viewer_app_get_restart(app)) {
+                virt_viewer_app_set_restart(app, FALSE);
+                start_viewer(app);
+            }
+            running |= virt_viewer_app_is_running(app);
+        }
+    } while (running);
 
-    if(reconnect){
-		reconnect = FALSE;
-		goto rec;
-    	}
     ret = 0;
 
  cleanup:
-    g_free(uri);
-    if (viewer)
-        g_object_unref(viewer);
+    g_ptr_array_unref(viewers);
     g_strfreev(args);
 	
     return ret;
@@ -714,7 +714,6 @@ authenticate_cb(RestProxy *proxy, G_GNUC_UNUSED RestProxyAuth *auth,
 {
     gchar *username = NULL;
     gchar *password = NULL;
-    VirtViewerWindow *window;
     gboolean success = FALSE;
 
     g_object_get(proxy,
@@ -724,11 +723,10 @@ authenticate_cb(RestProxy *proxy, G_GNUC_UNUSED RestProxyAuth *auth,
     if (username == NULL || *username == '\0')
         username = g_strdup(g_get_user_name());
 
-    window = virt_viewer_app_get_main_window(VIRT_VIEWER_APP(user_data));
-    success = virt_viewer_auth_collect_credentials(virt_viewer_window_get_window(window),
-                                                   "oVirt",
-                                                   NULL,
-                                                   &username, &password);
+    success = virt_viewer_app_collect_credentials(VIRT_VIEWER_APP(user_data),
+                                                  "oVirt",
+                                                  NULL,
+                                                  &username, &password);
     if (success) {
         g_object_set(G_OBJECT(proxy),
                      "username", username,
@@ -1251,6 +1249,7 @@ retry_dialog:
                 goto cleanup;
             }
             g_object_get(G_OBJECT(vvfile), "type", &type, NULL);
+            virt_viewer_app_timeline_mark(app, "vv-file-loaded");
         } else if (virt_viewer_util_extract_host(guri, &type, NULL, NULL, NULL, NULL) < 0 || type == NULL) {
             virt_viewer_app_simple_message_dialog(app, _("Cannot determine the connection type from URI"));
             goto cleanup;
@@ -1290,6 +1289,7 @@ retry_dialog:
         }
 #endif
 
+        virt_viewer_app_timeline_mark(app, "initial-connect");
         if (!virt_viewer_app_initial_connect(app, &error)) {
             const gchar *msg = error ? error->message :
                 _("Failed to initiate connection");
@@ -41,6 +41,7 @@ G_BEGIN_DECLS
 #define GDK_Delete GDK_KEY_Delete
 #define GDK_End GDK_KEY_End
 #define GDK_BackSpace GDK_KEY_BackSpace
+#define GDK_a GDK_KEY_a
 #define GDK_Print GDK_KEY_Print
 #define GDK_F1 GDK_KEY_F1
 #define GDK_F2 GDK_KEY_F2
@@ -30,10 +30,15 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <locale.h>
 #include <glib/gprintf.h>
 #include <glib/gi18n.h>
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+#include <glib-unix.h>
+#include <signal.h>
+#endif
 
 #include <libxml/xpath.h>
 #include <libxml/uri.h>
@@ -46,6 +51,10 @@
 #include <sys/un.h>
 #endif
 
+#ifndef G_OS_WIN32
+#include <sys/resource.h>
+#endif
+
 #ifdef HAVE_WINDOWS_H
 #include <windows.h>
 #endif
@@ -77,6 +86,12 @@ static void virt_viewer_app_initialized(VirtViewerSession *session,
 static void virt_viewer_app_disconnected(VirtViewerSession *session,
                                          const gchar *msg,
                                          VirtViewerApp *self);
+static void virt_viewer_app_resuming(VirtViewerSession *session,
+                                     guint attempt,
+                                     VirtViewerApp *self);
+static void virt_viewer_app_resumed(VirtViewerSession *session,
+                                    guint blackout_ms,
+                                    VirtViewerApp *self);
 static void virt_viewer_app_auth_refused(VirtViewerSession *session,
                                          const char *msg,
                                          VirtViewerApp *self);
@@ -99,10 +114,22 @@ static void virt_viewer_app_cancelled(VirtViewerSession *session,
 static void virt_viewer_app_channel_open(VirtViewerSession *session,
                                          VirtViewerSessionChannel *channel,
                                          VirtViewerApp *self);
+static void virt_viewer_app_default_channel_open(VirtViewerApp *self,
+                                                 VirtViewerSession *session,
+                                                 VirtViewerSessionChannel *channel);
 static void virt_viewer_app_update_pretty_address(VirtViewerApp *self);
 static void virt_viewer_app_set_fullscreen(VirtViewerApp *self, gboolean fullscreen);
 static void virt_viewer_app_update_menu_displays(VirtViewerApp *self);
 static void virt_viewer_update_smartcard_accels(VirtViewerApp *self);
+static void virt_viewer_app_remove_nth_window(VirtViewerApp *self, gint nth);
+static void virt_viewer_app_main_quit(VirtViewerApp *self);
+static void virt_viewer_app_hide_all_windows(VirtViewerApp *app);
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+static gboolean virt_viewer_app_capture_signal(gpointer opaque);
+#endif
+static void virt_viewer_app_measure_start(VirtViewerApp *self, VirtViewerDisplay *display);
+static void virt_viewer_app_measure_stop(VirtViewerApp *self);
+static void virt_viewer_app_measure_detach(VirtViewerApp *self, VirtViewerDisplay *display);
 
 
 
@@ -112,6 +139,7 @@ struct _VirtViewerAppPrivate {
     GList *windows;
     GHashTable *displays;
     GHashTable *initial_display_map;
+    GHashTable *window_releases; /* nth -> timeout id */
     gchar *clipboard;
 
     gboolean direct;
@@ -119,10 +147,20 @@ struct _VirtViewerAppPrivate {
     gboolean enable_accel;
     gboolean authretry;
     gboolean started;
+    gboolean running; /* started and not finished, see virt_viewer_app_main_quit */
+    gboolean restart; /* start again once finished, see virt_viewer_app_set_restart */
+    gint64 network_warned; /* monotonic time of the last network failure warning */
+    guint index; /* 1-based creation order, see virt_viewer_app_session_path */
+    gchar *frame_export_dir;
+    guint captures; /* see virt_viewer_app_capture_displays */
     gboolean fullscreen;
     gboolean attach;
     gboolean quitting;
     gboolean kiosk;
+    gboolean fast_start;
+    gboolean adaptive_quality;
+    gint mouse_latency_threshold; /* ms, 0 to leave the mouse mode alone */
+    gboolean headless;
 
     VirtViewerSession *session;
     gboolean active;
@@ -153,8 +191,84 @@ struct _VirtViewerAppPrivate {
     guint remove_smartcard_accel_key;
     GdkModifierType remove_smartcard_accel_mods;
     gboolean quit_on_disconnect;
+
+    /* guest monitor layout for full screen, from initial_display_map */
+    GdkRectangle *initial_layout;
+    gsize n_initial_layout;
+
+    /* --timeline: stages from launch to the first frame, under the
+     * timeline lock as the libvirt thread records stages too */
+    GArray *timeline;
+    gboolean timeline_written;
+
+    guint capture_signal_id; /* SIGUSR2 source for --screenshot-dir */
+
+    /* --headless: nth -> offscreen toplevel hosting the display */
+    GHashTable *offscreen;
+
+    gint max_fps; /* 0: no limit */
+    gboolean power_save; /* running on battery, see update_power_save */
+    guint power_id;
+
+    /* --measure-latency, see virt_viewer_app_measure_next */
+    VirtViewerDisplay *measure_display;
+    GArray *measure_samples; /* gint64, microseconds */
+    guint measure_iteration;
+    guint measure_lost;
+    guint measure_id; /* next key, or giving up on the current one */
+    guint measure_retries; /* without a frame to look at */
+    gint64 measure_sent; /* 0 when not waiting for a change */
+    guint32 measure_hash; /* of the region before the key */
+
+    gboolean watchdog; /* --stall-threshold, see virt_viewer_watchdog_start */
 };
 
+/* seconds between two resource reports in headless mode */
+#define VIRT_VIEWER_APP_REPORT_INTERVAL 10
+
+/* frame rate cap while running on battery, and how often to check for it */
+#define VIRT_VIEWER_APP_POWER_SAVE_FPS 20
+#define VIRT_VIEWER_APP_POWER_INTERVAL 30
+
+/* --measure-latency: seconds to wait before the first key, then
+ * milliseconds between two keys and before a key counts as lost */
+#define VIRT_VIEWER_APP_MEASURE_SETTLE 2
+#define VIRT_VIEWER_APP_MEASURE_GAP 200
+#define VIRT_VIEWER_APP_MEASURE_TIMEOUT 2000
+/* seconds without a frame to look at before giving up */
+#define VIRT_VIEWER_APP_MEASURE_NO_FRAME 10
+#define VIRT_VIEWER_APP_MEASURE_MAX_KEYS 16
+
+typedef enum {
+    POWER_SAVE_AUTO,
+    POWER_SAVE_ON,
+    POWER_SAVE_OFF,
+} PowerSaveMode;
+
+typedef struct {
+    gchar *stage;
+    gint64 when; /* microseconds since timeline_origin */
+} VirtViewerAppMark;
+
+G_LOCK_DEFINE_STATIC(timeline);
+static gint64 timeline_origin;
+
+/* resource usage is per process, so a single report covers all the
+ * headless apps it hosts */
+static GList *headless_apps;
+static guint headless_report_id;
+
+/* number of apps created by the process */
+static guint n_apps;
+
+/* seconds a window stays around after the guest disabled its monitor */
+#define VIRT_VIEWER_APP_WINDOW_RELEASE_DELAY 30
+
+typedef struct {
+    VirtViewerApp *app;
+    gint nth;
+} VirtViewerAppWindowRelease;
+
 
 G_DEFINE_ABSTRACT_TYPE(VirtViewerApp, virt_viewer_app, G_TYPE_OBJECT)
 #define GET_PRIVATE(o)                                                        \
@@ -177,6 +291,8 @@ enum {
     PROP_KIOSK,
     PROP_QUIT_ON_DISCONNECT,
     PROP_UUID,
+    PROP_MAX_FPS,
+    PROP_POWER_SAVE,
 };
 
 enum {
@@ -246,6 +362,12 @@ virt_viewer_app_simple_message_dialog(VirtViewerApp *self,
     msg = g_strdup_vprintf(fmt, vargs);
     va_end(vargs);
 
+    if (self->priv->headless) {
+        g_warning("%s", msg);
+        g_free(msg);
+        return;
+    }
+
     dialog = virt_viewer_app_make_message_dialog(self, msg);
 	//gdk_color_parse("blue", &color);
     //gtk_widget_modify_bg(GTK_WIDGET(dialog), GTK_STATE_NORMAL, &color);
@@ -306,9 +428,65 @@ virt_viewer_app_quit(VirtViewerApp *self)
         }
     }
 
+    virt_viewer_app_main_quit(self);
+}
+
+/*
+ * Several apps can share the process, one per session (see
+ * remote-viewer-main.c). An app that is done only hides its windows and
+ * leaves the main loop, the caller starts it again or keeps running the
+ * loop for the other apps.
+ */
+static void
+virt_viewer_app_main_quit(VirtViewerApp *self)
+{
+    self->priv->running = FALSE;
+    virt_viewer_app_hide_all_windows(self);
     gtk_main_quit();
 }
 
+gboolean
+virt_viewer_app_is_running(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->running;
+}
+
+/* Asks the caller of the main loop to start the app again once it
+ * finished, as the session gave up resuming in place. */
+void
+virt_viewer_app_set_restart(VirtViewerApp *self, gboolean restart)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    self->priv->restart = restart;
+}
+
+gboolean
+virt_viewer_app_get_restart(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->restart;
+}
+
+void
+virt_viewer_app_set_network_warned(VirtViewerApp *self, gint64 when)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    self->priv->network_warned = when;
+}
+
+gint64
+virt_viewer_app_get_network_warned(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), 0);
+
+    return self->priv->network_warned;
+}
+
 gint virt_viewer_app_get_n_initial_displays(VirtViewerApp* self)
 {
     if (self->priv->initial_display_map)
@@ -317,6 +495,41 @@ gint virt_viewer_app_get_n_initial_displays(VirtViewerApp* self)
     return gdk_screen_get_n_monitors(gdk_screen_get_default());
 }
 
+/*
+ * The guest monitor layout matching the host monitors the guest displays
+ * are mapped to in full screen. It is computed once and kept until the
+ * mapping changes, so --fast-start can prepare it while connecting.
+ */
+const GdkRectangle*
+virt_viewer_app_get_initial_layout(VirtViewerApp *self, gsize *nlayout)
+{
+    VirtViewerAppPrivate *priv;
+    GdkScreen *screen = gdk_screen_get_default();
+    gsize i;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), NULL);
+    g_return_val_if_fail(nlayout != NULL, NULL);
+
+    priv = self->priv;
+    if (priv->initial_layout == NULL) {
+        priv->n_initial_layout = virt_viewer_app_get_n_initial_displays(self);
+        priv->initial_layout = g_new0(GdkRectangle, priv->n_initial_layout);
+
+        for (i = 0; i < priv->n_initial_layout; i++) {
+            gint j = virt_viewer_app_get_initial_monitor_for_display(self, i);
+            if (j == -1)
+                continue;
+
+            gdk_screen_get_monitor_geometry(screen, j, &priv->initial_layout[i]);
+        }
+
+        virt_viewer_shift_monitors_to_origin(priv->initial_layout, priv->n_initial_layout);
+    }
+
+    *nlayout = priv->n_initial_layout;
+    return priv->initial_layout;
+}
+
 gint virt_viewer_app_get_initial_monitor_for_display(VirtViewerApp* self, gint display)
 {
     gint monitor = display;
@@ -453,6 +666,7 @@ void virt_viewer_app_set_uuid_string(VirtViewerApp *self, const gchar *uuid_stri
         g_hash_table_unref(self->priv->initial_display_map);
 
     self->priv->initial_display_map = mapping;
+    g_clear_pointer(&self->priv->initial_layout, g_free);
 
     // if we're changing our initial display map, move any existing windows to
     // the appropriate monitors according to the per-vm configuration
@@ -625,6 +839,39 @@ virt_viewer_app_open_tunnel(const char **cmd)
 }
 
 
+static gboolean opt_ssh_multiplex = FALSE;
+
+/*
+ * With --ssh-multiplex, all tunnels to the same ssh host share one
+ * authenticated connection: the first ssh started becomes the control
+ * master and every later display channel is opened as a new channel over
+ * it, instead of paying for a TCP connect, key exchange and
+ * authentication each time. Off by default, as it overrides any
+ * ControlMaster setup from ssh_config and needs ControlPersist, from
+ * OpenSSH 5.6.
+ */
+static gchar *
+virt_viewer_app_ssh_control_path(const char *sshhost,
+                                 int sshport,
+                                 const char *sshuser)
+{
+    gchar *key, *path;
+    const gchar *dir;
+
+#if GLIB_CHECK_VERSION(2, 28, 0)
+    dir = g_get_user_runtime_dir();
+#else
+    dir = g_get_tmp_dir();
+#endif
+
+    /* keep it short, unix socket paths are limited to ~100 bytes */
+    key = g_strdup_printf("%s@%s:%d", sshuser ? sshuser : "", sshhost, sshport);
+    path = g_strdup_printf("%s/virt-viewer-ssh-%d-%08x", dir, (int)getpid(), g_str_hash(key));
+    g_free(key);
+
+    return path;
+}
+
 static int
 virt_viewer_app_open_tunnel_ssh(const char *sshhost,
                                 int sshport,
@@ -633,10 +880,11 @@ virt_viewer_app_open_tunnel_ssh(const char *sshhost,
                                 const char *port,
                                 const char *unixsock)
 {
-    const char *cmd[10];
+    const char *cmd[16];
     char portstr[50];
     int n = 0;
     GString *cat;
+    gchar *control_opt = NULL;
 
     cmd[n++] = "ssh";
     if (sshport) {
@@ -648,6 +896,19 @@ virt_viewer_app_open_tunnel_ssh(const char *sshhost,
         cmd[n++] = "-l";
         cmd[n++] = sshuser;
     }
+    if (opt_ssh_multiplex) {
+        gchar *control_path = virt_viewer_app_ssh_control_path(sshhost, sshport, sshuser);
+
+        control_opt = g_strdup_printf("ControlPath=%s", control_path);
+        g_free(control_path);
+        cmd[n++] = "-o";
+        cmd[n++] = "ControlMaster=auto";
+        cmd[n++] = "-o";
+        cmd[n++] = control_opt;
+        /* let the master outlive the channel that created it */
+        cmd[n++] = "-o";
+        cmd[n++] = "ControlPersist=60";
+    }
     cmd[n++] = sshhost;
 
     cat = g_string_new("if (command -v socat) >/dev/null 2>&1");
@@ -671,6 +932,7 @@ virt_viewer_app_open_tunnel_ssh(const char *sshhost,
 
     n = virt_viewer_app_open_tunnel(cmd);
     g_string_free(cat, TRUE);
+    g_free(control_opt);
 
     return n;
 }
@@ -688,7 +950,12 @@ virt_viewer_app_open_unix_sock(const char *unixsock)
     if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
         return -1;
 
-    if (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    /* the --stall-threshold watchdog may interrupt us */
+    while (connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+        if (errno == EINTR)
+            continue;
+        if (errno == EISCONN)
+            break;
         close(fd);
         return -1;
     }
@@ -698,6 +965,171 @@ virt_viewer_app_open_unix_sock(const char *unixsock)
 
 #endif /* defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK) */
 
+static gboolean opt_timeline_chrome = FALSE;
+static gchar *opt_timeline = NULL;
+
+/*
+ * The output options name a single file or directory for the whole
+ * process. When it hosts several sessions, each one gets its own:
+ * directories get a session-<n> subdirectory, files a -<n> suffix before
+ * their extension, <n> being the position of the session on the command
+ * line.
+ */
+static gchar *
+virt_viewer_app_session_path(VirtViewerApp *self, const gchar *path, gboolean dir)
+{
+    gchar *base, *dot, *name, *ret;
+
+    if (n_apps < 2)
+        return g_strdup(path);
+
+    if (dir) {
+        name = g_strdup_printf("session-%u", self->priv->index);
+        ret = g_build_filename(path, name, NULL);
+        g_free(name);
+        return ret;
+    }
+
+    base = g_path_get_basename(path);
+    dot = strrchr(base, '.');
+    if (dot != NULL && dot != base) {
+        *dot = '\0';
+        name = g_strdup_printf("%s-%u.%s", base, self->priv->index, dot + 1);
+    } else {
+        name = g_strdup_printf("%s-%u", base, self->priv->index);
+    }
+    g_free(base);
+
+    base = g_path_get_dirname(path);
+    ret = g_build_filename(base, name, NULL);
+    g_free(base);
+    g_free(name);
+    return ret;
+}
+
+void
+virt_viewer_app_timeline_mark(VirtViewerApp *self,
+                              const char *fmt, ...)
+{
+    va_list ap;
+    VirtViewerAppMark mark;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    if (self->priv->timeline == NULL)
+        return;
+
+    mark.when = g_get_monotonic_time() - timeline_origin;
+    va_start(ap, fmt);
+    mark.stage = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    G_LOCK(timeline);
+    g_array_append_val(self->priv->timeline, mark);
+    G_UNLOCK(timeline);
+
+    g_debug("timeline: %s at %.1f ms", mark.stage, mark.when / 1000.0);
+}
+
+/* appends @str as a quoted JSON string */
+static void
+virt_viewer_app_json_append_string(GString *out, const gchar *str)
+{
+    g_string_append_c(out, '"');
+    for (; *str; str++) {
+        switch (*str) {
+        case '"':
+            g_string_append(out, "\\\"");
+            break;
+        case '\\':
+            g_string_append(out, "\\\\");
+            break;
+        case '\n':
+            g_string_append(out, "\\n");
+            break;
+        case '\t':
+            g_string_append(out, "\\t");
+            break;
+        default:
+            if ((guchar)*str < 0x20)
+                g_string_append_printf(out, "\\u%04x", (guchar)*str);
+            else
+                g_string_append_c(out, *str);
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+static void
+virt_viewer_app_timeline_write(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    GString *out;
+    GError *error = NULL;
+    gchar *file;
+    guint i;
+
+    if (priv->timeline == NULL || priv->timeline_written)
+        return;
+    priv->timeline_written = TRUE;
+
+    out = g_string_new(NULL);
+    G_LOCK(timeline);
+    if (opt_timeline_chrome) {
+        /* each stage becomes a span from the previous one, which is what
+         * chrome://tracing and Perfetto draw best */
+        g_string_append(out, "{\"traceEvents\":[");
+        for (i = 0; i < priv->timeline->len; i++) {
+            VirtViewerAppMark *mark = &g_array_index(priv->timeline, VirtViewerAppMark, i);
+            gint64 start = i > 0 ? g_array_index(priv->timeline, VirtViewerAppMark, i - 1).when : 0;
+
+            g_string_append(out, i > 0 ? ",\n{\"name\":" : "\n{\"name\":");
+            virt_viewer_app_json_append_string(out, mark->stage);
+            g_string_append_printf(out, ",\"cat\":\"connect\",\"ph\":\"X\","
+                                   "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT ","
+                                   "\"pid\":1,\"tid\":1}",
+                                   start, mark->when - start);
+        }
+        g_string_append(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    } else {
+        g_string_append(out, "{\"stages\":[");
+        for (i = 0; i < priv->timeline->len; i++) {
+            VirtViewerAppMark *mark = &g_array_index(priv->timeline, VirtViewerAppMark, i);
+
+            g_string_append(out, i > 0 ? ",\n{\"stage\":" : "\n{\"stage\":");
+            virt_viewer_app_json_append_string(out, mark->stage);
+            g_string_append_printf(out, ",\"us\":%" G_GINT64_FORMAT "}", mark->when);
+        }
+        g_string_append(out, "\n]}\n");
+    }
+    G_UNLOCK(timeline);
+
+    file = virt_viewer_app_session_path(self, opt_timeline, FALSE);
+    if (!g_file_set_contents(file, out->str, out->len, &error)) {
+        g_warning("Couldn't write timeline: %s", error->message);
+        g_clear_error(&error);
+    }
+    g_free(file);
+    g_string_free(out, TRUE);
+}
+
+static void
+virt_viewer_app_timeline_free(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    guint i;
+
+    if (priv->timeline == NULL)
+        return;
+
+    virt_viewer_app_timeline_write(self);
+
+    for (i = 0; i < priv->timeline->len; i++)
+        g_free(g_array_index(priv->timeline, VirtViewerAppMark, i).stage);
+    g_array_free(priv->timeline, TRUE);
+    priv->timeline = NULL;
+}
+
 void
 virt_viewer_app_trace(VirtViewerApp *self,
                       const char *fmt, ...)
@@ -920,6 +1352,155 @@ ensure_window_for_display(VirtViewerApp *self, VirtViewerDisplay *display)
     return win;
 }
 
+static gboolean
+virt_viewer_app_window_release_timeout(gpointer opaque)
+{
+    VirtViewerAppWindowRelease *release = opaque;
+
+    g_hash_table_remove(release->app->priv->window_releases,
+                        GINT_TO_POINTER(release->nth));
+    virt_viewer_app_remove_nth_window(release->app, release->nth);
+
+    return FALSE;
+}
+
+/*
+ * A window whose monitor was disabled by the guest is only hidden at
+ * first, as guests often toggle monitors in quick succession; if the
+ * monitor stays off, the window is destroyed and will be recreated when
+ * the display becomes ready again.
+ */
+static void
+virt_viewer_app_schedule_window_release(VirtViewerApp *self,
+                                        VirtViewerWindow *win,
+                                        gint nth)
+{
+    VirtViewerAppWindowRelease *release;
+    guint id;
+
+    if (win == self->priv->main_window ||
+        g_hash_table_lookup(self->priv->window_releases, GINT_TO_POINTER(nth)))
+        return;
+
+    release = g_new0(VirtViewerAppWindowRelease, 1);
+    release->app = self;
+    release->nth = nth;
+    id = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT,
+                                    VIRT_VIEWER_APP_WINDOW_RELEASE_DELAY,
+                                    virt_viewer_app_window_release_timeout,
+                                    release, g_free);
+    g_hash_table_insert(self->priv->window_releases,
+                        GINT_TO_POINTER(nth), GUINT_TO_POINTER(id));
+}
+
+static void
+virt_viewer_app_cancel_window_release(VirtViewerApp *self,
+                                      gint nth)
+{
+    guint id = GPOINTER_TO_UINT(g_hash_table_lookup(self->priv->window_releases,
+                                                    GINT_TO_POINTER(nth)));
+
+    if (id == 0)
+        return;
+
+    g_source_remove(id);
+    g_hash_table_remove(self->priv->window_releases, GINT_TO_POINTER(nth));
+}
+
+/*
+ * In headless mode displays never get a VirtViewerWindow. They are put
+ * in an offscreen toplevel instead, so they are realized and keep a size
+ * without a window on screen, and their frames stay available for
+ * capture (--screenshot-dir, --frame-export).
+ */
+static void
+virt_viewer_app_headless_host(VirtViewerApp *self,
+                              VirtViewerDisplay *display,
+                              gint nth)
+{
+    GtkWidget *host;
+
+    if (g_hash_table_lookup(self->priv->offscreen, GINT_TO_POINTER(nth)))
+        return;
+
+#if GTK_CHECK_VERSION(2, 20, 0)
+    host = gtk_offscreen_window_new();
+#else
+    host = gtk_window_new(GTK_WINDOW_POPUP);
+#endif
+    gtk_container_add(GTK_CONTAINER(host), GTK_WIDGET(display));
+    gtk_widget_show_all(host);
+    g_hash_table_insert(self->priv->offscreen, GINT_TO_POINTER(nth), host);
+    g_debug("Display %d hosted offscreen", nth);
+}
+
+/* the display outlives its host, which must not destroy it */
+static void
+virt_viewer_app_headless_unhost(gpointer opaque)
+{
+    GtkWidget *host = opaque;
+    GtkWidget *display = gtk_bin_get_child(GTK_BIN(host));
+
+    if (display != NULL)
+        gtk_container_remove(GTK_CONTAINER(host), display);
+    gtk_widget_destroy(host);
+}
+
+static gboolean
+virt_viewer_app_headless_report(gpointer opaque G_GNUC_UNUSED)
+{
+#ifndef G_OS_WIN32
+    struct rusage usage;
+    guint displays = 0;
+    GList *l;
+
+    if (getrusage(RUSAGE_SELF, &usage) < 0)
+        return TRUE;
+
+    for (l = headless_apps; l != NULL; l = l->next)
+        displays += g_hash_table_size(VIRT_VIEWER_APP(l->data)->priv->offscreen);
+
+    /* ru_maxrss is in kilobytes on Linux */
+    g_print("headless: process pid=%ld sessions=%u displays=%u "
+            "cpu-user=%ld.%03lds cpu-sys=%ld.%03lds max-rss=%ldkB\n",
+            (long)getpid(), g_list_length(headless_apps), displays,
+            (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec / 1000,
+            (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec / 1000,
+            (long)usage.ru_maxrss);
+#endif
+    return TRUE;
+}
+
+gboolean
+virt_viewer_app_get_headless(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->headless;
+}
+
+/* Prompts for credentials over the main window. Nobody is there to
+ * answer in headless mode, so the prompt counts as cancelled. */
+gboolean
+virt_viewer_app_collect_credentials(VirtViewerApp *self,
+                                    const char *type,
+                                    const char *address,
+                                    char **username,
+                                    char **password)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    if (self->priv->headless) {
+        g_warning("Authentication is required for the %s connection%s%s, "
+                  "which cannot be prompted for with --headless",
+                  type, address ? " to " : "", address ? address : "");
+        return FALSE;
+    }
+
+    return virt_viewer_auth_collect_credentials(virt_viewer_window_get_window(self->priv->main_window),
+                                                type, address, username, password);
+}
+
 static void
 display_show_hint(VirtViewerDisplay *display,
                   GParamSpec *pspec G_GNUC_UNUSED,
@@ -936,6 +1517,20 @@ display_show_hint(VirtViewerDisplay *display,
                  "show-hint", &hint,
                  NULL);
 
+    if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY)
+        virt_viewer_app_measure_start(self, display);
+
+    if (self->priv->headless) {
+        if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) {
+            if (self->priv->timeline && !self->priv->timeline_written) {
+                virt_viewer_app_timeline_mark(self, "first-frame");
+                virt_viewer_app_timeline_write(self);
+            }
+            virt_viewer_app_headless_host(self, display, nth);
+        }
+        return;
+    }
+
     win = virt_viewer_app_get_nth_window(self, nth);
 
     if (self->priv->fullscreen &&
@@ -943,10 +1538,17 @@ display_show_hint(VirtViewerDisplay *display,
         if (win)
             virt_viewer_window_hide(win);
     } else if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_DISABLED) {
-        if (win)
+        if (win) {
             virt_viewer_window_hide(win);
+            virt_viewer_app_schedule_window_release(self, win, nth);
+        }
     } else {
         if (hint & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY) {
+            virt_viewer_app_cancel_window_release(self, nth);
+            if (self->priv->timeline && !self->priv->timeline_written) {
+                virt_viewer_app_timeline_mark(self, "first-frame");
+                virt_viewer_app_timeline_write(self);
+            }
             win = ensure_window_for_display(self, display);
             nb = virt_viewer_window_get_notebook(win);
             virt_viewer_notebook_show_display(nb);
@@ -1008,6 +1610,9 @@ virt_viewer_app_display_removed(VirtViewerSession *session G_GNUC_UNUSED,
     gint nth;
 
     g_object_get(display, "nth-display", &nth, NULL);
+    virt_viewer_app_measure_detach(self, display);
+    g_hash_table_remove(self->priv->offscreen, GINT_TO_POINTER(nth));
+    virt_viewer_app_cancel_window_release(self, nth);
     virt_viewer_app_remove_nth_window(self, nth);
     g_hash_table_remove(self->priv->displays, GINT_TO_POINTER(nth));
     virt_viewer_app_update_menu_displays(self);
@@ -1068,12 +1673,18 @@ virt_viewer_app_create_session(VirtViewerApp *self, const gchar *type)
         return -1;
     }
 
+    virt_viewer_app_timeline_mark(self, "session-created");
+
     g_signal_connect(priv->session, "session-initialized",
                      G_CALLBACK(virt_viewer_app_initialized), self);
     g_signal_connect(priv->session, "session-connected",
                      G_CALLBACK(virt_viewer_app_connected), self);
     g_signal_connect(priv->session, "session-disconnected",
                      G_CALLBACK(virt_viewer_app_disconnected), self);
+    g_signal_connect(priv->session, "session-resuming",
+                     G_CALLBACK(virt_viewer_app_resuming), self);
+    g_signal_connect(priv->session, "session-resumed",
+                     G_CALLBACK(virt_viewer_app_resumed), self);
     g_signal_connect(priv->session, "session-channel-open",
                      G_CALLBACK(virt_viewer_app_channel_open), self);
     g_signal_connect(priv->session, "session-auth-refused",
@@ -1123,22 +1734,43 @@ virt_viewer_app_open_connection(VirtViewerApp *self, int *fd)
 }
 
 
-#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
 static void
 virt_viewer_app_channel_open(VirtViewerSession *session,
                              VirtViewerSessionChannel *channel,
                              VirtViewerApp *self)
 {
-    VirtViewerAppPrivate *priv;
-    int fd = -1;
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    VIRT_VIEWER_APP_GET_CLASS(self)->channel_open(self, session, channel);
+}
 
-    g_return_if_fail(self != NULL);
+static void
+virt_viewer_app_default_channel_open(VirtViewerApp *self,
+                                     VirtViewerSession *session,
+                                     VirtViewerSessionChannel *channel)
+{
+    int fd = -1;
 
     if (!virt_viewer_app_open_connection(self, &fd))
         return;
 
     g_debug("After open connection callback fd=%d", fd);
 
+    virt_viewer_app_channel_open_fd(self, session, channel, fd);
+}
+
+/* Hands @fd over to @channel, falling back to an SSH tunnel if it is -1 */
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+void
+virt_viewer_app_channel_open_fd(VirtViewerApp *self,
+                                VirtViewerSession *session,
+                                VirtViewerSessionChannel *channel,
+                                int fd)
+{
+    VirtViewerAppPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
     priv = self->priv;
     if (priv->transport && g_ascii_strcasecmp(priv->transport, "ssh") == 0 &&
         !priv->direct && fd == -1) {
@@ -1153,12 +1785,18 @@ virt_viewer_app_channel_open(VirtViewerSession *session,
         virt_viewer_session_channel_open_fd(session, channel, fd);
 }
 #else
-static void
-virt_viewer_app_channel_open(VirtViewerSession *session G_GNUC_UNUSED,
-                             VirtViewerSessionChannel *channel G_GNUC_UNUSED,
-                             VirtViewerApp *self)
+void
+virt_viewer_app_channel_open_fd(VirtViewerApp *self,
+                                VirtViewerSession *session,
+                                VirtViewerSessionChannel *channel,
+                                int fd)
 {
-    virt_viewer_app_simple_message_dialog(self, _("Connect to channel unsupported."));
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+
+    if (fd >= 0)
+        virt_viewer_session_channel_open_fd(session, channel, fd);
+    else
+        virt_viewer_app_simple_message_dialog(self, _("Connect to channel unsupported."));
 }
 #endif
 
@@ -1168,10 +1806,12 @@ virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
     VirtViewerAppPrivate *priv = self->priv;
     int fd = -1;
 
+    virt_viewer_app_timeline_mark(self, "activate");
     if (!virt_viewer_app_open_connection(self, &fd))
         return FALSE;
 
     g_debug("After open connection callback fd=%d", fd);
+    virt_viewer_app_timeline_mark(self, "open-connection");
 
 #if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
     if (priv->transport &&
@@ -1200,6 +1840,7 @@ virt_viewer_app_default_activate(VirtViewerApp *self, GError **error)
                                                   priv->user, priv->ghost,
                                                   priv->gport, priv->unixsock)) < 0)
             return FALSE;
+        virt_viewer_app_timeline_mark(self, "ssh-tunnel");
     } else if (priv->unixsock && fd == -1) {
         virt_viewer_app_trace(self, "Opening direct UNIX connection to display at %s",
                               priv->unixsock);
@@ -1348,7 +1989,7 @@ virt_viewer_app_default_deactivated(VirtViewerApp *self, gboolean connect_error)
     }
 
     if (self->priv->quit_on_disconnect)
-        gtk_main_quit();
+        virt_viewer_app_main_quit(self);
 }
 
 static void
@@ -1399,6 +2040,7 @@ virt_viewer_app_connected(VirtViewerSession *session G_GNUC_UNUSED,
     VirtViewerAppPrivate *priv = self->priv;
 
     priv->connected = TRUE;
+    virt_viewer_app_timeline_mark(self, "session-connected");
 
     if (self->priv->kiosk)
         virt_viewer_app_show_status(self, "");
@@ -1406,13 +2048,31 @@ virt_viewer_app_connected(VirtViewerSession *session G_GNUC_UNUSED,
         virt_viewer_app_show_status(self, _("Connected to graphic server"));
 }
 
-
-
 static void
-virt_viewer_app_initialized(VirtViewerSession *session G_GNUC_UNUSED,
-                            VirtViewerApp *self)
+virt_viewer_app_resuming(VirtViewerSession *session G_GNUC_UNUSED,
+                         guint attempt,
+                         VirtViewerApp *self)
 {
-    virt_viewer_app_update_title(self);
+    virt_viewer_app_trace(self, "Guest %s display connection lost, resume attempt %u",
+                          self->priv->guest_name, attempt);
+}
+
+static void
+virt_viewer_app_resumed(VirtViewerSession *session G_GNUC_UNUSED,
+                        guint blackout_ms,
+                        VirtViewerApp *self)
+{
+    virt_viewer_app_trace(self, "Guest %s display resumed after %u ms blackout",
+                          self->priv->guest_name, blackout_ms);
+}
+
+
+
+static void
+virt_viewer_app_initialized(VirtViewerSession *session G_GNUC_UNUSED,
+                            VirtViewerApp *self)
+{
+    virt_viewer_app_update_title(self);
 }
 
 static void
@@ -1426,9 +2086,12 @@ virt_viewer_app_disconnected(VirtViewerSession *session G_GNUC_UNUSED, const gch
         virt_viewer_app_hide_all_windows(self);
 
     if (priv->quitting)
-        gtk_main_quit();
+        virt_viewer_app_main_quit(self);
 
-    if (connect_error) {
+    if (connect_error && priv->headless) {
+        g_warning("Unable to connect to the graphic server %s: %s",
+                  priv->pretty_address, msg);
+    } else if (connect_error) {
         GtkWidget *dialog = virt_viewer_app_make_message_dialog(self,
             _("Unable to connect to the graphic server %s"), priv->pretty_address);
 
@@ -1457,6 +2120,13 @@ static void virt_viewer_app_auth_refused(VirtViewerSession *session G_GNUC_UNUSE
     int ret;
     VirtViewerAppPrivate *priv = self->priv;
 
+    if (priv->headless) {
+        g_warning("Unable to authenticate with remote desktop server at %s: %s",
+                  priv->pretty_address, msg);
+        priv->authretry = FALSE;
+        return;
+    }
+
     dialog = gtk_message_dialog_new(virt_viewer_window_get_window(priv->main_window),
                                     GTK_DIALOG_MODAL |
                                     GTK_DIALOG_DESTROY_WITH_PARENT,
@@ -1499,6 +2169,11 @@ virt_viewer_app_set_kiosk(VirtViewerApp *self, gboolean enabled)
     int i;
     GList *l;
 
+    if (enabled && self->priv->headless) {
+        g_warning("Kiosk mode is not available with --headless");
+        enabled = FALSE;
+    }
+
     self->priv->kiosk = enabled;
     if (!enabled)
         return;
@@ -1589,6 +2264,14 @@ virt_viewer_app_get_property (GObject *object, guint property_id,
         g_value_set_string(value, priv->uuid);
         break;
 
+    case PROP_MAX_FPS:
+        g_value_set_int(value, priv->max_fps);
+        break;
+
+    case PROP_POWER_SAVE:
+        g_value_set_boolean(value, priv->power_save);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -1667,6 +2350,10 @@ virt_viewer_app_set_property (GObject *object, guint property_id,
         virt_viewer_app_set_uuid_string(self, g_value_get_string(value));
         break;
 
+    case PROP_MAX_FPS:
+        priv->max_fps = g_value_get_int(value);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -1678,6 +2365,16 @@ virt_viewer_app_dispose (GObject *object)
     VirtViewerApp *self = VIRT_VIEWER_APP(object);
     VirtViewerAppPrivate *priv = self->priv;
 
+    if (priv->window_releases) {
+        GHashTableIter iter;
+        gpointer id;
+
+        g_hash_table_iter_init(&iter, priv->window_releases);
+        while (g_hash_table_iter_next(&iter, NULL, &id))
+            g_source_remove(GPOINTER_TO_UINT(id));
+        g_clear_pointer(&priv->window_releases, g_hash_table_unref);
+    }
+
     if (priv->windows) {
         GList *tmp = priv->windows;
         /* null-ify before unrefing, because we need
@@ -1712,10 +2409,36 @@ virt_viewer_app_dispose (GObject *object)
     priv->uuid = NULL;
     g_free(priv->config_file);
     priv->config_file = NULL;
+    g_free(priv->frame_export_dir);
+    priv->frame_export_dir = NULL;
     g_clear_pointer(&priv->config, g_key_file_free);
     g_clear_pointer(&priv->initial_display_map, g_hash_table_unref);
+    g_clear_pointer(&priv->initial_layout, g_free);
 
     virt_viewer_app_free_connect_info(self);
+    virt_viewer_app_timeline_free(self);
+
+    if (priv->capture_signal_id) {
+        g_source_remove(priv->capture_signal_id);
+        priv->capture_signal_id = 0;
+    }
+    if (g_list_find(headless_apps, self)) {
+        headless_apps = g_list_remove(headless_apps, self);
+        if (headless_apps == NULL) {
+            g_source_remove(headless_report_id);
+            headless_report_id = 0;
+        }
+    }
+    if (priv->power_id) {
+        g_source_remove(priv->power_id);
+        priv->power_id = 0;
+    }
+    g_clear_pointer(&priv->offscreen, g_hash_table_unref);
+    virt_viewer_app_measure_stop(self);
+    if (priv->watchdog) {
+        virt_viewer_watchdog_stop();
+        priv->watchdog = FALSE;
+    }
 
     G_OBJECT_CLASS (virt_viewer_app_parent_class)->dispose (object);
 }
@@ -1723,6 +2446,14 @@ virt_viewer_app_dispose (GObject *object)
 static gboolean
 virt_viewer_app_default_start(VirtViewerApp *self)
 {
+    if (self->priv->headless) {
+        if (headless_report_id == 0)
+            headless_report_id = g_timeout_add_seconds(VIRT_VIEWER_APP_REPORT_INTERVAL,
+                                                       virt_viewer_app_headless_report, NULL);
+        headless_apps = g_list_prepend(headless_apps, self);
+        return TRUE;
+    }
+
     virt_viewer_window_show(self->priv->main_window);
     return TRUE;
 }
@@ -1736,7 +2467,19 @@ gboolean virt_viewer_app_start(VirtViewerApp *self)
 
     g_return_val_if_fail(!self->priv->started, TRUE);
 
+    virt_viewer_app_timeline_mark(self, "start");
+    if (self->priv->fast_start && !self->priv->headless) {
+        gsize nlayout;
+
+        /* do the work that doesn't depend on the guest before connecting,
+         * instead of after the first frame arrived */
+        gtk_widget_realize(GTK_WIDGET(virt_viewer_window_get_window(self->priv->main_window)));
+        if (self->priv->fullscreen)
+            virt_viewer_app_get_initial_layout(self, &nlayout);
+        virt_viewer_app_timeline_mark(self, "fast-start");
+    }
     self->priv->started = klass->start(self);
+    self->priv->running = self->priv->started;
     return self->priv->started;
     g_debug("virt_viewer_app_start");
 }
@@ -1748,6 +2491,76 @@ static gboolean opt_debug = FALSE;
 static gboolean opt_fullscreen = FALSE;
 static gboolean opt_kiosk = FALSE;
 static gboolean opt_kiosk_quit = FALSE;
+static gboolean opt_fast_start = FALSE;
+static gboolean opt_adaptive_quality = FALSE;
+static gint opt_mouse_latency_threshold = 0;
+static gboolean opt_headless = FALSE;
+static gchar *opt_screenshot_dir = NULL;
+static gchar *opt_screenshot_format = NULL;
+static gchar *opt_frame_export = NULL;
+static gint opt_max_fps = 0;
+static PowerSaveMode opt_power_save = POWER_SAVE_AUTO;
+static gint opt_measure_latency = 0;
+static GdkRectangle opt_measure_region; /* empty: the whole display */
+static guint opt_measure_keys[VIRT_VIEWER_APP_MEASURE_MAX_KEYS] = { GDK_a, GDK_BackSpace };
+static guint opt_measure_nkeys = 2;
+static gint opt_stall_threshold = 0;
+
+/*
+ * TRUE when the machine has a mains adapter and none is plugged in.
+ * Machines without any (desktops, or systems without sysfs) never
+ * count as running on battery.
+ */
+static gboolean
+virt_viewer_app_on_battery(void)
+{
+#ifdef __linux__
+    const gchar *name;
+    gboolean mains = FALSE, online = FALSE;
+    GDir *dir = g_dir_open("/sys/class/power_supply", 0, NULL);
+
+    if (dir == NULL)
+        return FALSE;
+
+    while ((name = g_dir_read_name(dir)) != NULL && !online) {
+        gchar *path, *contents = NULL;
+
+        path = g_build_filename("/sys/class/power_supply", name, "type", NULL);
+        if (g_file_get_contents(path, &contents, NULL, NULL) &&
+            g_str_has_prefix(contents, "Mains")) {
+            mains = TRUE;
+            g_free(path);
+            g_free(contents);
+            contents = NULL;
+            path = g_build_filename("/sys/class/power_supply", name, "online", NULL);
+            if (g_file_get_contents(path, &contents, NULL, NULL))
+                online = g_str_has_prefix(contents, "1");
+        }
+        g_free(path);
+        g_free(contents);
+    }
+    g_dir_close(dir);
+
+    return mains && !online;
+#else
+    return FALSE;
+#endif
+}
+
+static gboolean
+virt_viewer_app_update_power_save(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+    gboolean power_save = virt_viewer_app_on_battery();
+
+    if (power_save != self->priv->power_save) {
+        g_debug("%s power save mode", power_save ? "Entering" : "Leaving");
+        self->priv->power_save = power_save;
+        g_object_notify(G_OBJECT(self), "power-save");
+    }
+
+    return TRUE;
+}
 
 
 static void
@@ -1765,7 +2578,11 @@ virt_viewer_app_init (VirtViewerApp *self)
     virt_viewer_app_set_debug(opt_debug);
 
     self->priv = GET_PRIVATE(self);
+    self->priv->index = ++n_apps;
     self->priv->displays = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+    self->priv->window_releases = g_hash_table_new(g_direct_hash, g_direct_equal);
+    self->priv->offscreen = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                  virt_viewer_app_headless_unhost);
     self->priv->config = g_key_file_new();
     self->priv->config_file = g_build_filename(g_get_user_config_dir(),
                                                "virt-viewer", "settings", NULL);
@@ -1787,8 +2604,35 @@ virt_viewer_app_init (VirtViewerApp *self)
         opt_zoom = 100;
     }
 
+    if (opt_timeline) {
+        if (timeline_origin == 0)
+            timeline_origin = g_get_monotonic_time();
+        self->priv->timeline = g_array_new(FALSE, FALSE, sizeof(VirtViewerAppMark));
+        virt_viewer_app_timeline_mark(self, "app-init");
+    }
+
     self->priv->initial_display_map = virt_viewer_app_get_monitor_mapping_for_section(self, "fallback");
     self->priv->verbose = opt_verbose;
+    self->priv->fast_start = opt_fast_start;
+    self->priv->adaptive_quality = opt_adaptive_quality;
+    self->priv->mouse_latency_threshold = opt_mouse_latency_threshold;
+    self->priv->headless = opt_headless;
+    self->priv->max_fps = opt_max_fps;
+    if (opt_power_save == POWER_SAVE_ON) {
+        self->priv->power_save = TRUE;
+    } else if (opt_power_save == POWER_SAVE_AUTO) {
+        virt_viewer_app_update_power_save(self);
+        self->priv->power_id = g_timeout_add_seconds(VIRT_VIEWER_APP_POWER_INTERVAL,
+                                                     virt_viewer_app_update_power_save, self);
+    }
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+    if (opt_screenshot_dir)
+        self->priv->capture_signal_id = g_unix_signal_add(SIGUSR2, virt_viewer_app_capture_signal, self);
+#endif
+    if (opt_stall_threshold > 0) {
+        virt_viewer_watchdog_start(opt_stall_threshold);
+        self->priv->watchdog = TRUE;
+    }
     self->priv->quit_on_disconnect = opt_kiosk ? opt_kiosk_quit : TRUE;
     g_signal_connect(self, "notify::guest-name", G_CALLBACK(title_maybe_changed), NULL);
     g_signal_connect(self, "notify::title", G_CALLBACK(title_maybe_changed), NULL);
@@ -1864,6 +2708,7 @@ virt_viewer_app_constructor (GType gtype,
     virt_viewer_set_remove_smartcard_accel(self, GDK_F9, GDK_SHIFT_MASK);
     gtk_accel_map_add_entry("<virt-viewer>/view/toggle-fullscreen", GDK_F12, GDK_SHIFT_MASK);
     gtk_accel_map_add_entry("<virt-viewer>/view/release-cursor", GDK_F11, GDK_SHIFT_MASK);
+    gtk_accel_map_add_entry("<virt-viewer>/view/toggle-hud", GDK_F10, GDK_SHIFT_MASK);
     gtk_accel_map_add_entry("<virt-viewer>/view/zoom-reset", GDK_0, GDK_CONTROL_MASK);
     gtk_accel_map_add_entry("<virt-viewer>/view/zoom-out", GDK_minus, GDK_CONTROL_MASK);
     gtk_accel_map_add_entry("<virt-viewer>/view/zoom-in", GDK_plus, GDK_CONTROL_MASK);
@@ -1893,6 +2738,7 @@ virt_viewer_app_class_init (VirtViewerAppClass *klass)
     klass->activate = virt_viewer_app_default_activate;
     klass->deactivated = virt_viewer_app_default_deactivated;
     klass->open_connection = virt_viewer_app_default_open_connection;
+    klass->channel_open = virt_viewer_app_default_channel_open;
 
     g_object_class_install_property(object_class,
                                     PROP_VERBOSE,
@@ -2035,6 +2881,24 @@ virt_viewer_app_class_init (VirtViewerAppClass *klass)
                                                         G_PARAM_WRITABLE |
                                                         G_PARAM_STATIC_STRINGS));
 
+    g_object_class_install_property(object_class,
+                                    PROP_MAX_FPS,
+                                    g_param_spec_int("max-fps",
+                                                     "Max FPS",
+                                                     "Frames per second drawn at most per display, 0 for no limit",
+                                                     0, G_MAXINT, 0,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(object_class,
+                                    PROP_POWER_SAVE,
+                                    g_param_spec_boolean("power-save",
+                                                         "Power save",
+                                                         "Whether displays are slowed down to save power",
+                                                         FALSE,
+                                                         G_PARAM_READABLE |
+                                                         G_PARAM_STATIC_STRINGS));
+
     signals[SIGNAL_WINDOW_ADDED] =
         g_signal_new("window-added",
                      G_OBJECT_CLASS_TYPE(object_class),
@@ -2079,6 +2943,7 @@ virt_viewer_app_clear_hotkeys(VirtViewerApp *self)
     /* Disable default bindings and replace them with our own */
     gtk_accel_map_change_entry("<virt-viewer>/view/toggle-fullscreen", 0, 0, TRUE);
     gtk_accel_map_change_entry("<virt-viewer>/view/release-cursor", 0, 0, TRUE);
+    gtk_accel_map_change_entry("<virt-viewer>/view/toggle-hud", 0, 0, TRUE);
     gtk_accel_map_change_entry("<virt-viewer>/view/zoom-reset", 0, 0, TRUE);
     gtk_accel_map_change_entry("<virt-viewer>/view/zoom-in", 0, 0, TRUE);
     gtk_accel_map_change_entry("<virt-viewer>/view/zoom-out", 0, 0, TRUE);
@@ -2131,6 +2996,8 @@ virt_viewer_app_set_hotkeys(VirtViewerApp *self, const gchar *hotkeys_str)
             gtk_accel_map_change_entry("<virt-viewer>/view/toggle-fullscreen", accel_key, accel_mods, TRUE);
         } else if (g_str_equal(*hotkey, "release-cursor")) {
             gtk_accel_map_change_entry("<virt-viewer>/view/release-cursor", accel_key, accel_mods, TRUE);
+        } else if (g_str_equal(*hotkey, "toggle-hud")) {
+            gtk_accel_map_change_entry("<virt-viewer>/view/toggle-hud", accel_key, accel_mods, TRUE);
         } else if (g_str_equal(*hotkey, "secure-attention")) {
             gtk_accel_map_change_entry("<virt-viewer>/send/secure-attention", accel_key, accel_mods, TRUE);
         } else if (g_str_equal(*hotkey, "smartcard-insert")) {
@@ -2481,6 +3348,363 @@ virt_viewer_app_get_session(VirtViewerApp *self)
     return self->priv->session;
 }
 
+gboolean
+virt_viewer_app_get_fast_start(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->fast_start;
+}
+
+gboolean
+virt_viewer_app_get_adaptive_quality(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), FALSE);
+
+    return self->priv->adaptive_quality;
+}
+
+gint
+virt_viewer_app_get_mouse_latency_threshold(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), 0);
+
+    return self->priv->mouse_latency_threshold;
+}
+
+/*
+ * Frames per second each display should draw at most, 0 for no limit:
+ * the "max-fps" setting, lowered to VIRT_VIEWER_APP_POWER_SAVE_FPS in
+ * power save mode.
+ */
+gint
+virt_viewer_app_get_max_fps(VirtViewerApp *self)
+{
+    gint max_fps;
+
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), 0);
+
+    max_fps = self->priv->max_fps;
+    if (self->priv->power_save &&
+        (max_fps == 0 || max_fps > VIRT_VIEWER_APP_POWER_SAVE_FPS))
+        max_fps = VIRT_VIEWER_APP_POWER_SAVE_FPS;
+
+    return max_fps;
+}
+
+/* directory of the --frame-export sockets of this session, or NULL */
+const gchar*
+virt_viewer_app_get_frame_export_dir(VirtViewerApp *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_APP(self), NULL);
+
+    if (opt_frame_export == NULL)
+        return NULL;
+
+    if (self->priv->frame_export_dir == NULL)
+        self->priv->frame_export_dir = virt_viewer_app_session_path(self, opt_frame_export, TRUE);
+
+    return self->priv->frame_export_dir;
+}
+
+static void
+virt_viewer_app_capture_saved(GObject *source,
+                              GAsyncResult *result,
+                              gpointer user_data)
+{
+    gchar *file = user_data;
+    GError *error = NULL;
+
+    if (!virt_viewer_display_save_screenshot_finish(VIRT_VIEWER_DISPLAY(source), result, &error)) {
+        g_warning("Failed to capture %s: %s", file, error->message);
+        g_clear_error(&error);
+    } else {
+        g_debug("captured %s", file);
+    }
+    g_free(file);
+}
+
+/*
+ * Saves every ready display into @dir, as <display>-<seconds>-<n>.<ext>,
+ * n counting the captures of the app so that two in the same second
+ * don't write to the same files.
+ * @format is one of the formats of virt_viewer_display_save_screenshot_async,
+ * NULL meaning "png-fast".
+ */
+void
+virt_viewer_app_capture_displays(VirtViewerApp *self,
+                                 const gchar *dir,
+                                 const gchar *format)
+{
+    GHashTableIter iter;
+    gpointer value;
+    GTimeVal now;
+
+    g_return_if_fail(VIRT_VIEWER_IS_APP(self));
+    g_return_if_fail(dir != NULL);
+
+    if (format == NULL)
+        format = "png-fast";
+
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        g_warning("Cannot create screenshot directory %s", dir);
+        return;
+    }
+
+    g_get_current_time(&now);
+    self->priv->captures++;
+    g_hash_table_iter_init(&iter, self->priv->displays);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        VirtViewerDisplay *display = value;
+        gchar *name, *file;
+
+        if (!(virt_viewer_display_get_show_hint(display) & VIRT_VIEWER_DISPLAY_SHOW_HINT_READY))
+            continue;
+
+        name = g_strdup_printf("%d-%ld-%u.%s", virt_viewer_display_get_nth(display) + 1,
+                               now.tv_sec, self->priv->captures,
+                               g_str_equal(format, "png-fast") ? "png" : format);
+        file = g_build_filename(dir, name, NULL);
+        g_free(name);
+
+        virt_viewer_display_save_screenshot_async(display, file, format,
+                                                  virt_viewer_app_capture_saved, file);
+    }
+}
+
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+static gboolean
+virt_viewer_app_capture_signal(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+    gchar *dir = virt_viewer_app_session_path(self, opt_screenshot_dir, TRUE);
+
+    virt_viewer_app_trace(self, "Capturing displays to %s", dir);
+    virt_viewer_app_capture_displays(self, dir, opt_screenshot_format);
+    g_free(dir);
+
+    return TRUE;
+}
+#endif
+
+/*
+ * Hash of the --measure-region part of the display, FALSE if there is no
+ * framebuffer to look at yet, or if the region is outside of it, in which
+ * case @outside is set.
+ */
+static gboolean
+virt_viewer_app_measure_hash(VirtViewerApp *self, guint32 *hash, gboolean *outside)
+{
+    GdkPixbuf *pixbuf = virt_viewer_display_get_pixbuf(self->priv->measure_display);
+    GdkRectangle area = { 0, 0, 0, 0 };
+    const guchar *pixels;
+    gint rowstride, bpp, x, y;
+
+    if (pixbuf == NULL)
+        return FALSE;
+
+    area.width = gdk_pixbuf_get_width(pixbuf);
+    area.height = gdk_pixbuf_get_height(pixbuf);
+    if (opt_measure_region.width > 0 &&
+        !gdk_rectangle_intersect(&opt_measure_region, &area, &area)) {
+        if (outside != NULL)
+            *outside = TRUE;
+        g_object_unref(pixbuf);
+        return FALSE;
+    }
+
+    pixels = gdk_pixbuf_get_pixels(pixbuf);
+    rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+    bpp = gdk_pixbuf_get_n_channels(pixbuf);
+
+    /* FNV-1a */
+    *hash = 2166136261u;
+    for (y = area.y; y < area.y + area.height; y++) {
+        const guchar *row = pixels + y * rowstride + area.x * bpp;
+
+        for (x = 0; x < area.width * bpp; x++)
+            *hash = (*hash ^ row[x]) * 16777619u;
+    }
+    g_object_unref(pixbuf);
+
+    return TRUE;
+}
+
+static gint
+virt_viewer_app_measure_compare(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static gdouble
+virt_viewer_app_measure_percentile(GArray *samples, guint percent)
+{
+    guint rank = (samples->len * percent + 99) / 100;
+
+    return g_array_index(samples, gint64, rank > 0 ? rank - 1 : 0) / 1000.0;
+}
+
+static void
+virt_viewer_app_measure_report(VirtViewerApp *self)
+{
+    GArray *samples = self->priv->measure_samples;
+
+    if (samples->len == 0) {
+        g_print("latency: %u keys, no display change seen\n", self->priv->measure_iteration);
+        return;
+    }
+
+    g_array_sort(samples, virt_viewer_app_measure_compare);
+    g_print("latency: %u keys, %u lost, min=%.1fms p50=%.1fms p90=%.1fms p99=%.1fms max=%.1fms\n",
+            self->priv->measure_iteration, self->priv->measure_lost,
+            g_array_index(samples, gint64, 0) / 1000.0,
+            virt_viewer_app_measure_percentile(samples, 50),
+            virt_viewer_app_measure_percentile(samples, 90),
+            virt_viewer_app_measure_percentile(samples, 99),
+            g_array_index(samples, gint64, samples->len - 1) / 1000.0);
+}
+
+/*
+ * One --measure-latency iteration: remember what the region looks like,
+ * send the next key and wait for "display-damage" to change the region,
+ * or for VIRT_VIEWER_APP_MEASURE_TIMEOUT. The keys are sent in turn so
+ * that they can undo each other, like typing and erasing a character.
+ */
+static gboolean
+virt_viewer_app_measure_next(gpointer opaque)
+{
+    VirtViewerApp *self = opaque;
+    VirtViewerAppPrivate *priv = self->priv;
+    gboolean outside = FALSE;
+    guint keyval;
+
+    priv->measure_id = 0;
+    if (priv->measure_sent != 0) {
+        g_debug("latency: key %u lost", priv->measure_iteration);
+        priv->measure_lost++;
+        priv->measure_sent = 0;
+    }
+
+    if (priv->measure_iteration == (guint)opt_measure_latency) {
+        virt_viewer_app_measure_report(self);
+        virt_viewer_app_measure_stop(self);
+        virt_viewer_app_main_quit(self);
+        return FALSE;
+    }
+
+    if (!virt_viewer_app_measure_hash(self, &priv->measure_hash, &outside)) {
+        if (outside) {
+            g_printerr(_("latency: region %dx%d+%d+%d is outside of display %d\n"),
+                       opt_measure_region.width, opt_measure_region.height,
+                       opt_measure_region.x, opt_measure_region.y,
+                       virt_viewer_display_get_nth(priv->measure_display) + 1);
+        } else if (++priv->measure_retries >
+                   VIRT_VIEWER_APP_MEASURE_NO_FRAME * 1000 / VIRT_VIEWER_APP_MEASURE_GAP) {
+            g_printerr(_("latency: no frame from display %d after %d seconds\n"),
+                       virt_viewer_display_get_nth(priv->measure_display) + 1,
+                       VIRT_VIEWER_APP_MEASURE_NO_FRAME);
+        } else {
+            priv->measure_id = g_timeout_add(VIRT_VIEWER_APP_MEASURE_GAP,
+                                             virt_viewer_app_measure_next, self);
+            return FALSE;
+        }
+        virt_viewer_app_measure_stop(self);
+        virt_viewer_app_main_quit(self);
+        return FALSE;
+    }
+    priv->measure_retries = 0;
+
+    keyval = opt_measure_keys[priv->measure_iteration % opt_measure_nkeys];
+    priv->measure_iteration++;
+    priv->measure_sent = g_get_monotonic_time();
+    virt_viewer_display_send_keys(priv->measure_display, &keyval, 1);
+    priv->measure_id = g_timeout_add(VIRT_VIEWER_APP_MEASURE_TIMEOUT,
+                                     virt_viewer_app_measure_next, self);
+
+    return FALSE;
+}
+
+static void
+virt_viewer_app_measure_damage(VirtViewerDisplay *display G_GNUC_UNUSED,
+                               VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+    gint64 latency;
+    guint32 hash;
+
+    if (priv->measure_sent == 0 ||
+        !virt_viewer_app_measure_hash(self, &hash, NULL) ||
+        hash == priv->measure_hash)
+        return;
+
+    latency = g_get_monotonic_time() - priv->measure_sent;
+    priv->measure_sent = 0;
+    g_array_append_val(priv->measure_samples, latency);
+    g_debug("latency: key %u after %.1f ms", priv->measure_iteration, latency / 1000.0);
+
+    /* let the rest of the change land before the next key */
+    g_source_remove(priv->measure_id);
+    priv->measure_id = g_timeout_add(VIRT_VIEWER_APP_MEASURE_GAP,
+                                     virt_viewer_app_measure_next, self);
+}
+
+static void
+virt_viewer_app_measure_start(VirtViewerApp *self, VirtViewerDisplay *display)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    /* once per app: after a reconnection, the measurement carries on
+     * where it was on the new display */
+    if (opt_measure_latency <= 0 || priv->measure_display != NULL ||
+        priv->measure_iteration >= (guint)opt_measure_latency)
+        return;
+
+    g_debug("%s latency on display %d", priv->measure_samples ? "Resuming" : "Measuring",
+            virt_viewer_display_get_nth(display));
+    priv->measure_display = g_object_ref(display);
+    if (priv->measure_samples == NULL)
+        priv->measure_samples = g_array_new(FALSE, FALSE, sizeof(gint64));
+    priv->measure_retries = 0;
+    g_signal_connect(display, "display-damage",
+                     G_CALLBACK(virt_viewer_app_measure_damage), self);
+    priv->measure_id = g_timeout_add_seconds(VIRT_VIEWER_APP_MEASURE_SETTLE,
+                                             virt_viewer_app_measure_next, self);
+}
+
+/* @display goes away: pause until another one is ready, a key sent to it
+ * and still unanswered then counts as lost. NULL for any display. */
+static void
+virt_viewer_app_measure_detach(VirtViewerApp *self, VirtViewerDisplay *display)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    if (priv->measure_display == NULL ||
+        (display != NULL && display != priv->measure_display))
+        return;
+
+    if (priv->measure_id) {
+        g_source_remove(priv->measure_id);
+        priv->measure_id = 0;
+    }
+    g_signal_handlers_disconnect_by_func(priv->measure_display,
+                                         virt_viewer_app_measure_damage, self);
+    g_clear_pointer(&priv->measure_display, g_object_unref);
+}
+
+static void
+virt_viewer_app_measure_stop(VirtViewerApp *self)
+{
+    VirtViewerAppPrivate *priv = self->priv;
+
+    virt_viewer_app_measure_detach(self, NULL);
+    if (priv->measure_samples != NULL) {
+        g_array_free(priv->measure_samples, TRUE);
+        priv->measure_samples = NULL;
+    }
+}
+
 GList*
 virt_viewer_app_get_windows(VirtViewerApp *self)
 {
@@ -2488,6 +3712,40 @@ virt_viewer_app_get_windows(VirtViewerApp *self)
     return self->priv->windows;
 }
 
+static gboolean
+option_timeline_format(G_GNUC_UNUSED const gchar *option_name,
+                       const gchar *value,
+                       G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (g_str_equal(value, "json")) {
+        opt_timeline_chrome = FALSE;
+        return TRUE;
+    }
+    if (g_str_equal(value, "chrome")) {
+        opt_timeline_chrome = TRUE;
+        return TRUE;
+    }
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, _("Invalid timeline format: %s"), value);
+    return FALSE;
+}
+
+static gboolean
+option_screenshot_format(G_GNUC_UNUSED const gchar *option_name,
+                         const gchar *value,
+                         G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (g_str_equal(value, "png") || g_str_equal(value, "png-fast") ||
+        g_str_equal(value, "ppm") || g_str_equal(value, "qoi")) {
+        g_free(opt_screenshot_format);
+        opt_screenshot_format = g_strdup(value);
+        return TRUE;
+    }
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, _("Invalid screenshot format: %s"), value);
+    return FALSE;
+}
+
 static gboolean
 option_kiosk_quit(G_GNUC_UNUSED const gchar *option_name,
                   const gchar *value,
@@ -2506,6 +3764,118 @@ option_kiosk_quit(G_GNUC_UNUSED const gchar *option_name,
     return FALSE;
 }
 
+static gboolean
+option_parse_count(const gchar *value, gint *count)
+{
+    gchar *end = NULL;
+    gint64 n = g_ascii_strtoll(value, &end, 10);
+
+    if (end == value || *end != '\0' || n < 0 || n > G_MAXINT)
+        return FALSE;
+
+    *count = n;
+    return TRUE;
+}
+
+static gboolean
+option_max_fps(G_GNUC_UNUSED const gchar *option_name,
+               const gchar *value,
+               G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (option_parse_count(value, &opt_max_fps))
+        return TRUE;
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                _("Invalid frame rate: %s"), value);
+    return FALSE;
+}
+
+static gboolean
+option_mouse_latency_threshold(G_GNUC_UNUSED const gchar *option_name,
+                               const gchar *value,
+                               G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (option_parse_count(value, &opt_mouse_latency_threshold))
+        return TRUE;
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                _("Invalid mouse latency threshold: %s"), value);
+    return FALSE;
+}
+
+static gboolean
+option_power_save(G_GNUC_UNUSED const gchar *option_name,
+                  const gchar *value,
+                  G_GNUC_UNUSED gpointer data, GError **error)
+{
+    if (g_str_equal(value, "auto")) {
+        opt_power_save = POWER_SAVE_AUTO;
+        return TRUE;
+    }
+    if (g_str_equal(value, "on")) {
+        opt_power_save = POWER_SAVE_ON;
+        return TRUE;
+    }
+    if (g_str_equal(value, "off")) {
+        opt_power_save = POWER_SAVE_OFF;
+        return TRUE;
+    }
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, _("Invalid power-save argument: %s"), value);
+    return FALSE;
+}
+
+static gboolean
+option_measure_region(G_GNUC_UNUSED const gchar *option_name,
+                      const gchar *value,
+                      G_GNUC_UNUSED gpointer data, GError **error)
+{
+    GdkRectangle region;
+    gint end = 0;
+
+    if (sscanf(value, "%dx%d+%d+%d%n", &region.width, &region.height,
+               &region.x, &region.y, &end) == 4 && value[end] == '\0' &&
+        region.width > 0 && region.height > 0 && region.x >= 0 && region.y >= 0) {
+        opt_measure_region = region;
+        return TRUE;
+    }
+
+    g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED, _("Invalid measure region: %s"), value);
+    return FALSE;
+}
+
+static gboolean
+option_measure_keys(G_GNUC_UNUSED const gchar *option_name,
+                    const gchar *value,
+                    G_GNUC_UNUSED gpointer data, GError **error)
+{
+    gchar **names = g_strsplit(value, ",", -1);
+    guint i, n = g_strv_length(names);
+
+    if (n == 0 || n > VIRT_VIEWER_APP_MEASURE_MAX_KEYS) {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                    _("Invalid measure keys: %s"), value);
+        g_strfreev(names);
+        return FALSE;
+    }
+
+    for (i = 0; i < n; i++) {
+        guint keyval = gdk_keyval_from_name(g_strstrip(names[i]));
+
+        if (keyval == GDK_VoidSymbol || keyval == 0) {
+            g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_FAILED,
+                        _("Invalid key name: %s"), names[i]);
+            g_strfreev(names);
+            return FALSE;
+        }
+        opt_measure_keys[i] = keyval;
+    }
+    opt_measure_nkeys = n;
+    g_strfreev(names);
+
+    return TRUE;
+}
+
 
 GOptionGroup*
 virt_viewer_app_get_option_group(void)
@@ -2525,10 +3895,50 @@ virt_viewer_app_get_option_group(void)
           N_("Display verbose information"), NULL },
         { "debug", '\0', 0, G_OPTION_ARG_NONE, &opt_debug,
           N_("Display debugging information"), NULL },
+        { "fast-start", '\0', 0, G_OPTION_ARG_NONE, &opt_fast_start,
+          N_("Prepare windows and the monitor layout while connecting"), NULL },
+        { "headless", '\0', 0, G_OPTION_ARG_NONE, &opt_headless,
+          N_("Run without showing any window, keeping displays offscreen"), NULL },
+        { "timeline", '\0', 0, G_OPTION_ARG_FILENAME, &opt_timeline,
+          N_("Write the connection timeline to FILE once the display is up"), N_("FILE") },
+        { "timeline-format", '\0', 0, G_OPTION_ARG_CALLBACK, option_timeline_format,
+          N_("Format of the connection timeline"), N_("<json|chrome>") },
+        { "screenshot-dir", '\0', 0, G_OPTION_ARG_FILENAME, &opt_screenshot_dir,
+          N_("Save all displays to DIR when receiving SIGUSR2"), N_("DIR") },
+        { "screenshot-format", '\0', 0, G_OPTION_ARG_CALLBACK, option_screenshot_format,
+          N_("Image format used with --screenshot-dir"), N_("<png|png-fast|ppm|qoi>") },
+        { "max-fps", '\0', 0, G_OPTION_ARG_CALLBACK, option_max_fps,
+          N_("Draw each display at most FPS times per second"), N_("FPS") },
+        { "power-save", '\0', 0, G_OPTION_ARG_CALLBACK, option_power_save,
+          N_("Lower the frame rate to save power, by default when running on battery"), N_("<auto|on|off>") },
+        { "adaptive-quality", '\0', 0, G_OPTION_ARG_NONE, &opt_adaptive_quality,
+          N_("Lower the SPICE quality while the link is degraded"), NULL },
+        { "mouse-latency-threshold", '\0', 0, G_OPTION_ARG_CALLBACK, option_mouse_latency_threshold,
+          N_("Switch to client mouse mode above MS of input latency"), N_("MS") },
+        { "measure-latency", '\0', 0, G_OPTION_ARG_INT, &opt_measure_latency,
+          N_("Send N keys to the first display, print how long each took to show, then quit"), N_("N") },
+        { "measure-region", '\0', 0, G_OPTION_ARG_CALLBACK, option_measure_region,
+          N_("Part of the display watched with --measure-latency"), N_("WxH+X+Y") },
+        { "measure-keys", '\0', 0, G_OPTION_ARG_CALLBACK, option_measure_keys,
+          N_("Keys sent in turn with --measure-latency"), N_("KEY[,KEY...]") },
+        { "stall-threshold", '\0', 0, G_OPTION_ARG_INT, &opt_stall_threshold,
+          N_("Report main loop iterations longer than MS milliseconds"), N_("MS") },
+#if defined(HAVE_SOCKETPAIR) && defined(HAVE_FORK)
+        { "ssh-multiplex", '\0', 0, G_OPTION_ARG_NONE, &opt_ssh_multiplex,
+          N_("Share one ssh connection between all the tunnelled channels"), NULL },
+#endif
+#ifndef G_OS_WIN32
+        { "frame-export", '\0', 0, G_OPTION_ARG_FILENAME, &opt_frame_export,
+          N_("Share display frames with other processes through sockets in DIR"), N_("DIR") },
+#endif
         
         { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
     };
     GOptionGroup *group;
+
+    /* the timeline counts from here, before any option is even parsed */
+    timeline_origin = g_get_monotonic_time();
+
     group = g_option_group_new("virt-viewer", _("Remote-viewer Options:"), _("Show Remote-viewer Options"), NULL, NULL);
     g_option_group_add_entries(group, options);
 
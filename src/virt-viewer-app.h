@@ -56,6 +56,7 @@ typedef struct {
     gboolean (*activate) (VirtViewerApp *self, GError **error);
     void (*deactivated) (VirtViewerApp *self, gboolean connect_error);
     gboolean (*open_connection)(VirtViewerApp *self, int *fd);
+    void (*channel_open)(VirtViewerApp *self, VirtViewerSession *session, VirtViewerSessionChannel *channel);
 } VirtViewerAppClass;
 
 GType virt_viewer_app_get_type (void);
@@ -65,6 +66,7 @@ gboolean virt_viewer_app_start(VirtViewerApp *app);
 void virt_viewer_app_maybe_quit(VirtViewerApp *self, VirtViewerWindow *window);
 VirtViewerWindow* virt_viewer_app_get_main_window(VirtViewerApp *self);
 void virt_viewer_app_trace(VirtViewerApp *self, const char *fmt, ...);
+void virt_viewer_app_timeline_mark(VirtViewerApp *self, const char *fmt, ...);
 void virt_viewer_app_simple_message_dialog(VirtViewerApp *self, const char *fmt, ...);
 gboolean virt_viewer_app_is_active(VirtViewerApp *app);
 void virt_viewer_app_free_connect_info(VirtViewerApp *self);
@@ -94,11 +96,33 @@ void virt_viewer_app_show_display(VirtViewerApp *self);
 GList* virt_viewer_app_get_windows(VirtViewerApp *self);
 gboolean virt_viewer_app_get_enable_accel(VirtViewerApp *self);
 VirtViewerSession* virt_viewer_app_get_session(VirtViewerApp *self);
+void virt_viewer_app_channel_open_fd(VirtViewerApp *self,
+                                     VirtViewerSession *session,
+                                     VirtViewerSessionChannel *channel,
+                                     int fd);
 gboolean virt_viewer_app_get_fullscreen(VirtViewerApp *app);
 GOptionGroup* virt_viewer_app_get_option_group(void);
 void virt_viewer_app_clear_hotkeys(VirtViewerApp *app);
 gint virt_viewer_app_get_n_initial_displays(VirtViewerApp* self);
 gint virt_viewer_app_get_initial_monitor_for_display(VirtViewerApp* self, gint display);
+const GdkRectangle* virt_viewer_app_get_initial_layout(VirtViewerApp *self, gsize *nlayout);
+gboolean virt_viewer_app_get_fast_start(VirtViewerApp *self);
+gboolean virt_viewer_app_get_adaptive_quality(VirtViewerApp *self);
+gint virt_viewer_app_get_mouse_latency_threshold(VirtViewerApp *self);
+gboolean virt_viewer_app_get_headless(VirtViewerApp *self);
+gboolean virt_viewer_app_collect_credentials(VirtViewerApp *self,
+                                             const char *type,
+                                             const char *address,
+                                             char **username,
+                                             char **password);
+gboolean virt_viewer_app_is_running(VirtViewerApp *self);
+void virt_viewer_app_set_restart(VirtViewerApp *self, gboolean restart);
+gboolean virt_viewer_app_get_restart(VirtViewerApp *self);
+void virt_viewer_app_set_network_warned(VirtViewerApp *self, gint64 when);
+gint64 virt_viewer_app_get_network_warned(VirtViewerApp *self);
+const gchar* virt_viewer_app_get_frame_export_dir(VirtViewerApp *self);
+gint virt_viewer_app_get_max_fps(VirtViewerApp *self);
+void virt_viewer_app_capture_displays(VirtViewerApp *self, const gchar *dir, const gchar *format);
 void virt_viewer_app_set_enable_accel(VirtViewerApp *app, gboolean enable);
 
 G_END_DECLS
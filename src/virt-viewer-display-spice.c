@@ -25,8 +25,19 @@
 #include <config.h>
 
 #include <math.h>
+#include <string.h>
 #include <spice-audio.h>
 
+#ifndef G_OS_WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#endif
+
 #include <glib/gi18n.h>
 
 #include "virt-viewer-util.h"
@@ -43,10 +54,91 @@ typedef enum {
 
 struct _VirtViewerDisplaySpicePrivate {
     SpiceChannel *channel; /* weak reference */
-    SpiceDisplay *display;
+    SpiceDisplay *display; /* only while the monitor is enabled, see update_widget */
     AutoResizeState auto_resize;
+    gint channelid;
+    gint monitorid;
+    guint release_id;
+
+    /* --max-fps, see pace_invalidate */
+    gint64 pace_interval; /* microseconds, 0 when not paced */
+    gint64 pace_last;
+    guint pace_id;
+    gboolean pace_pending;
+    GdkRectangle pace_damage;
+    SpiceChannel *paced_channel; /* whose SpiceDisplay handler is blocked */
+    SpiceDisplay *paced_display;
+    guint report_id;
+    guint64 report_received;
+    guint64 report_presented;
+    gboolean pointer_grabbed; /* SpiceDisplay sends motion to the guest */
+
+#ifndef G_OS_WIN32
+    /* --frame-export, see frame_export_start */
+    gchar *export_path;
+    gint export_listen_fd;
+    guint export_listen_id;
+    gint export_fd;
+    gsize export_size;
+    struct _VirtViewerFrameExportHeader *export_header;
+    guint8 *export_src;
+    gint export_bpp;
+#endif
 };
 
+/* seconds a disabled monitor keeps its SpiceDisplay widget */
+#define DISPLAY_RELEASE_DELAY 30
+
+/* seconds between two frame rate reports in the debug log */
+#define DISPLAY_REPORT_INTERVAL 10
+
+#ifndef G_OS_WIN32
+/*
+ * Layout of the shared frame buffer handed out by --frame-export. The
+ * file starts with this header, padded to FRAME_EXPORT_HEADER_SIZE, and
+ * is followed by height * stride bytes of pixels, in the SPICE surface
+ * format given by "format" (usually 32-bit xRGB, little endian).
+ *
+ * "sequence" is odd while an update is being written: readers sample it,
+ * read, and retry if it changed or was odd. Each update is recorded as a
+ * dirty rectangle in ring[(sequence / 2) % FRAME_EXPORT_RING] along with
+ * the sequence it completed at. "live" drops to 0 when the guest surface
+ * goes away (resolution change, disconnect): readers then reconnect to
+ * the socket to get the new buffer.
+ */
+#define FRAME_EXPORT_MAGIC 0x58465656 /* "VVFX" */
+#define FRAME_EXPORT_VERSION 1
+#define FRAME_EXPORT_RING 64
+#define FRAME_EXPORT_HEADER_SIZE 4096
+
+typedef struct _VirtViewerFrameExportHeader {
+    guint32 magic;
+    guint32 version;
+    guint32 live;
+    guint32 format;
+    guint32 width;
+    guint32 height;
+    guint32 stride;
+    guint32 ring_size;
+    volatile gint sequence;
+    guint32 padding;
+    struct {
+        guint32 sequence;
+        gint32 x;
+        gint32 y;
+        gint32 width;
+        gint32 height;
+    } ring[FRAME_EXPORT_RING];
+} VirtViewerFrameExportHeader;
+
+static void frame_export_start(VirtViewerDisplaySpice *self, const gchar *dir);
+static void frame_export_stop(VirtViewerDisplaySpice *self);
+static void frame_export_connect_channel(VirtViewerDisplaySpice *self);
+static void frame_export_invalidate(SpiceChannel *channel,
+                                    gint x, gint y, gint w, gint h,
+                                    VirtViewerDisplaySpice *self);
+#endif
+
 #define VIRT_VIEWER_DISPLAY_SPICE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_DISPLAY_SPICE, VirtViewerDisplaySpicePrivate))
 
 static void virt_viewer_display_spice_send_keys(VirtViewerDisplay *display,
@@ -56,11 +148,41 @@ static GdkPixbuf *virt_viewer_display_spice_get_pixbuf(VirtViewerDisplay *displa
 static void virt_viewer_display_spice_release_cursor(VirtViewerDisplay *display);
 static void virt_viewer_display_spice_close(VirtViewerDisplay *display G_GNUC_UNUSED);
 static gboolean virt_viewer_display_spice_selectable(VirtViewerDisplay *display);
+static void virt_viewer_display_spice_update_widget(VirtViewerDisplaySpice *self);
+static void pace_cancel(VirtViewerDisplaySpice *self);
+static void pace_invalidate(SpiceChannel *channel,
+                            gint x, gint y, gint w, gint h,
+                            VirtViewerDisplaySpice *self);
+
+static void
+virt_viewer_display_spice_dispose(GObject *obj)
+{
+    VirtViewerDisplaySpice *self = VIRT_VIEWER_DISPLAY_SPICE(obj);
+
+    if (self->priv->release_id != 0) {
+        g_source_remove(self->priv->release_id);
+        self->priv->release_id = 0;
+    }
+    if (self->priv->report_id != 0) {
+        g_source_remove(self->priv->report_id);
+        self->priv->report_id = 0;
+    }
+    pace_cancel(self);
+
+#ifndef G_OS_WIN32
+    frame_export_stop(self);
+#endif
+
+    G_OBJECT_CLASS(virt_viewer_display_spice_parent_class)->dispose(obj);
+}
 
 static void
 virt_viewer_display_spice_class_init(VirtViewerDisplaySpiceClass *klass)
 {
     VirtViewerDisplayClass *dclass = VIRT_VIEWER_DISPLAY_CLASS(klass);
+    GObjectClass *oclass = G_OBJECT_CLASS(klass);
+
+    oclass->dispose = virt_viewer_display_spice_dispose;
 
     dclass->send_keys = virt_viewer_display_spice_send_keys;
     dclass->get_pixbuf = virt_viewer_display_spice_get_pixbuf;
@@ -100,6 +222,8 @@ show_hint_changed(VirtViewerDisplay *self)
 
     g_object_get(self, "nth-display", &nth, NULL);
     spice_main_set_display_enabled(main_channel, nth, enabled);
+
+    virt_viewer_display_spice_update_widget(VIRT_VIEWER_DISPLAY_SPICE(self));
 }
 
 static void
@@ -107,6 +231,10 @@ virt_viewer_display_spice_init(VirtViewerDisplaySpice *self G_GNUC_UNUSED)
 {
     self->priv = VIRT_VIEWER_DISPLAY_SPICE_GET_PRIVATE(self);
     self->priv->auto_resize = AUTO_RESIZE_ALWAYS;
+#ifndef G_OS_WIN32
+    self->priv->export_listen_fd = -1;
+    self->priv->export_fd = -1;
+#endif
 
     g_signal_connect(self, "notify::show-hint", G_CALLBACK(show_hint_changed), NULL);
 }
@@ -119,7 +247,9 @@ virt_viewer_display_spice_send_keys(VirtViewerDisplay *display,
     VirtViewerDisplaySpice *self = VIRT_VIEWER_DISPLAY_SPICE(display);
 
     g_return_if_fail(self != NULL);
-    g_return_if_fail(self->priv->display != NULL);
+
+    if (self->priv->display == NULL)
+        return;
 
     spice_display_send_keys(self->priv->display, keyvals, nkeyvals, SPICE_DISPLAY_KEY_EVENT_CLICK);
 }
@@ -130,7 +260,9 @@ virt_viewer_display_spice_get_pixbuf(VirtViewerDisplay *display)
     VirtViewerDisplaySpice *self = VIRT_VIEWER_DISPLAY_SPICE(display);
 
     g_return_val_if_fail(self != NULL, NULL);
-    g_return_val_if_fail(self->priv->display != NULL, NULL);
+
+    if (self->priv->display == NULL)
+        return NULL;
 
     return spice_display_get_pixbuf(self->priv->display);
 }
@@ -138,9 +270,10 @@ virt_viewer_display_spice_get_pixbuf(VirtViewerDisplay *display)
 static void
 update_display_ready(VirtViewerDisplaySpice *self)
 {
-    gboolean ready;
+    gboolean ready = FALSE;
 
-    g_object_get(self->priv->display, "ready", &ready, NULL);
+    if (self->priv->display != NULL)
+        g_object_get(self->priv->display, "ready", &ready, NULL);
 
     virt_viewer_display_set_show_hint(VIRT_VIEWER_DISPLAY(self),
                                       VIRT_VIEWER_DISPLAY_SHOW_HINT_READY, ready);
@@ -163,6 +296,7 @@ virt_viewer_display_spice_mouse_grab(SpiceDisplay *display G_GNUC_UNUSED,
                                      int grabbed,
                                      VirtViewerDisplaySpice *self)
 {
+    self->priv->pointer_grabbed = grabbed;
     if (grabbed)
         g_signal_emit_by_name(self, "display-pointer-grab");
     else
@@ -222,6 +356,10 @@ enable_accel_changed(VirtViewerApp *app,
                      VirtViewerDisplaySpice *self)
 {
     GtkAccelKey key = { 0 };
+
+    if (self->priv->display == NULL)
+        return;
+
     if (virt_viewer_app_get_enable_accel(app))
         gtk_accel_map_lookup_entry("<virt-viewer>/view/release-cursor", &key);
 
@@ -253,39 +391,257 @@ fullscreen_changed(VirtViewerDisplaySpice *self,
         self->priv->auto_resize = AUTO_RESIZE_ALWAYS;
 }
 
-GtkWidget *
-virt_viewer_display_spice_new(VirtViewerSessionSpice *session,
-                              SpiceChannel *channel,
-                              gint monitorid)
+/*
+ * With a frame rate cap (--max-fps, or power save mode) the handler
+ * SpiceDisplay has on the channel "display-invalidate" is blocked, and
+ * the damage of the updates is gathered here instead. The frame clock
+ * of the widget hands it over, in a single update, once per frame
+ * interval at most: the guest may send hundreds of small updates a
+ * second, they are then painted in a few frames.
+ */
+static guint
+pace_signal(void)
 {
-    VirtViewerDisplaySpice *self;
-    VirtViewerApp *app;
-    gint channelid;
-    SpiceSession *s;
+    return g_signal_lookup("display-invalidate", SPICE_TYPE_DISPLAY_CHANNEL);
+}
 
-    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), NULL);
+static void
+pace_flush(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    GdkRectangle *damage = &priv->pace_damage;
+    guint signal_id = pace_signal();
 
-    g_object_get(channel, "channel-id", &channelid, NULL);
-    // We don't allow monitorid != 0 && channelid != 0
-    g_return_val_if_fail(channelid == 0 || monitorid == 0, NULL);
+    priv->pace_last = g_get_monotonic_time();
+    if (!priv->pace_pending)
+        return;
+    priv->pace_pending = FALSE;
 
-    self = g_object_new(VIRT_VIEWER_TYPE_DISPLAY_SPICE,
-                        "session", session,
-                        // either monitorid is always 0 or channelid
-                        // is, we can't have display (0, 2) and (2, 0)
-                        // for example
-                        "nth-display", channelid + monitorid,
-                        NULL);
-    self->priv->channel = channel;
+    if (priv->display == NULL || priv->paced_display != priv->display)
+        return;
+
+    /* only SpiceDisplay should see it: pace_invalidate and the frame
+     * export of every display sharing the channel already had it, and
+     * would otherwise queue it again */
+    g_signal_handlers_block_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_FUNC,
+                                    signal_id, 0, NULL, (gpointer)pace_invalidate, NULL);
+#ifndef G_OS_WIN32
+    g_signal_handlers_block_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_FUNC,
+                                    signal_id, 0, NULL, (gpointer)frame_export_invalidate, NULL);
+#endif
+    g_signal_handlers_unblock_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_DATA,
+                                      signal_id, 0, NULL, NULL, priv->display);
+    g_signal_emit(priv->channel, signal_id, 0,
+                  damage->x, damage->y, damage->width, damage->height);
+    g_signal_handlers_block_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_DATA,
+                                    signal_id, 0, NULL, NULL, priv->display);
+#ifndef G_OS_WIN32
+    g_signal_handlers_unblock_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_FUNC,
+                                      signal_id, 0, NULL, (gpointer)frame_export_invalidate, NULL);
+#endif
+    g_signal_handlers_unblock_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_FUNC,
+                                      signal_id, 0, NULL, (gpointer)pace_invalidate, NULL);
+}
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+static gboolean
+pace_tick(GtkWidget *widget G_GNUC_UNUSED,
+          GdkFrameClock *clock,
+          gpointer opaque)
+{
+    VirtViewerDisplaySpice *self = opaque;
+
+    if (gdk_frame_clock_get_frame_time(clock) - self->priv->pace_last < self->priv->pace_interval)
+        return TRUE;
+
+    self->priv->pace_id = 0;
+    pace_flush(self);
+    return FALSE;
+}
+#else
+static gboolean
+pace_timeout(gpointer opaque)
+{
+    VirtViewerDisplaySpice *self = opaque;
+
+    self->priv->pace_id = 0;
+    pace_flush(self);
+    return FALSE;
+}
+#endif
+
+static void
+pace_schedule(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+    /* only ticks while there is something to draw, and not at all
+     * while the widget is unmapped */
+    priv->pace_id = gtk_widget_add_tick_callback(GTK_WIDGET(priv->display),
+                                                 pace_tick, self, NULL);
+#else
+    gint64 delay = priv->pace_last + priv->pace_interval - g_get_monotonic_time();
+
+    priv->pace_id = g_timeout_add(MAX(delay, 0) / 1000, pace_timeout, self);
+#endif
+}
+
+static void
+pace_cancel(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+
+    if (priv->pace_id == 0)
+        return;
+
+#if GTK_CHECK_VERSION(3, 8, 0)
+    if (priv->display != NULL)
+        gtk_widget_remove_tick_callback(GTK_WIDGET(priv->display), priv->pace_id);
+#else
+    g_source_remove(priv->pace_id);
+#endif
+    priv->pace_id = 0;
+}
+
+static void
+pace_invalidate(SpiceChannel *channel,
+                gint x, gint y, gint w, gint h,
+                VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    GdkRectangle rect = { x, y, w, h };
+
+    virt_viewer_display_count_frames(VIRT_VIEWER_DISPLAY(self), 1, 0);
+    virt_viewer_display_damage(VIRT_VIEWER_DISPLAY(self));
+
+    if (priv->pace_interval == 0 || priv->display == NULL)
+        return;
+
+    /* SpiceDisplay connects to the channel on its own, maybe after us,
+     * so keep trying until its handler is there to block */
+    if (priv->paced_display != priv->display || priv->paced_channel != channel) {
+        if (g_signal_handlers_block_matched(channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_DATA,
+                                            pace_signal(), 0, NULL, NULL, priv->display) == 0)
+            return;
+        priv->paced_display = priv->display;
+        priv->paced_channel = channel;
+    }
+
+    if (priv->pace_pending) {
+        gdk_rectangle_union(&priv->pace_damage, &rect, &priv->pace_damage);
+    } else {
+        priv->pace_damage = rect;
+        priv->pace_pending = TRUE;
+    }
+    if (priv->pace_id == 0)
+        pace_schedule(self);
+}
+
+static void
+pace_reset(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+
+    pace_cancel(self);
+    pace_flush(self);
+    if (priv->paced_display != NULL && priv->paced_display == priv->display &&
+        priv->paced_channel == priv->channel)
+        g_signal_handlers_unblock_matched(priv->channel, G_SIGNAL_MATCH_ID | G_SIGNAL_MATCH_DATA,
+                                          pace_signal(), 0, NULL, NULL, priv->display);
+    priv->paced_display = NULL;
+    priv->paced_channel = NULL;
+}
+
+static void
+max_fps_changed(VirtViewerApp *app,
+                GParamSpec *pspec G_GNUC_UNUSED,
+                VirtViewerDisplaySpice *self)
+{
+    gint max_fps = virt_viewer_app_get_max_fps(app);
+    gint64 interval = max_fps > 0 ? G_USEC_PER_SEC / max_fps : 0;
+
+    if (interval == self->priv->pace_interval)
+        return;
+
+    if (max_fps > 0)
+        g_debug("display %d: drawing at most %d frames per second",
+                self->priv->channelid + self->priv->monitorid, max_fps);
+    else
+        g_debug("display %d: no frame rate limit",
+                self->priv->channelid + self->priv->monitorid);
+
+    pace_reset(self);
+    self->priv->pace_interval = interval;
+}
+
+#if GTK_CHECK_VERSION(3, 0, 0)
+static gboolean
+pace_presented(GtkWidget *widget G_GNUC_UNUSED,
+               cairo_t *cr G_GNUC_UNUSED,
+               VirtViewerDisplaySpice *self)
+#else
+static gboolean
+pace_presented(GtkWidget *widget G_GNUC_UNUSED,
+               GdkEventExpose *event G_GNUC_UNUSED,
+               VirtViewerDisplaySpice *self)
+#endif
+{
+    virt_viewer_display_count_frames(VIRT_VIEWER_DISPLAY(self), 0, 1);
+    return FALSE;
+}
+
+static gboolean
+pointer_moved(GtkWidget *widget G_GNUC_UNUSED,
+              GdkEventMotion *event G_GNUC_UNUSED,
+              VirtViewerDisplaySpice *self)
+{
+    VirtViewerSession *session = virt_viewer_display_get_session(VIRT_VIEWER_DISPLAY(self));
+
+    /* in server mode the motion only reaches the guest under a grab */
+    if (!self->priv->pointer_grabbed)
+        return FALSE;
+
+    virt_viewer_session_spice_pointer_moved(VIRT_VIEWER_SESSION_SPICE(session));
+    return FALSE;
+}
+
+static gboolean
+pace_report(gpointer opaque)
+{
+    VirtViewerDisplaySpice *self = opaque;
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    guint64 received, presented;
+
+    virt_viewer_display_get_frame_counts(VIRT_VIEWER_DISPLAY(self), &received, &presented);
+    if (received != priv->report_received || presented != priv->report_presented)
+        g_debug("display %d: %" G_GUINT64_FORMAT " updates received, %" G_GUINT64_FORMAT
+                " frames presented in %ds",
+                priv->channelid + priv->monitorid,
+                received - priv->report_received, presented - priv->report_presented,
+                DISPLAY_REPORT_INTERVAL);
+    priv->report_received = received;
+    priv->report_presented = presented;
+
+    return TRUE;
+}
+
+static void
+virt_viewer_display_spice_create_widget(VirtViewerDisplaySpice *self)
+{
+    VirtViewerSession *session = virt_viewer_display_get_session(VIRT_VIEWER_DISPLAY(self));
+    SpiceSession *s;
+
+    g_debug("creating SpiceDisplay for display %d", self->priv->channelid + self->priv->monitorid);
 
     g_object_get(session, "spice-session", &s, NULL);
-    self->priv->display = spice_display_new_with_monitor(s, channelid, monitorid);
+    self->priv->display = spice_display_new_with_monitor(s, self->priv->channelid,
+                                                         self->priv->monitorid);
     g_object_unref(s);
 
     virt_viewer_signal_connect_object(self->priv->display, "notify::ready",
                                       G_CALLBACK(update_display_ready), self,
                                       G_CONNECT_SWAPPED);
-    update_display_ready(self);
 
     gtk_container_add(GTK_CONTAINER(self), GTK_WIDGET(self->priv->display));
     gtk_widget_show(GTK_WIDGET(self->priv->display));
@@ -300,6 +656,396 @@ virt_viewer_display_spice_new(VirtViewerSessionSpice *session,
                                       G_CALLBACK(virt_viewer_display_spice_keyboard_grab), self, 0);
     virt_viewer_signal_connect_object(self->priv->display, "mouse-grab",
                                       G_CALLBACK(virt_viewer_display_spice_mouse_grab), self, 0);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    virt_viewer_signal_connect_object(self->priv->display, "draw",
+                                      G_CALLBACK(pace_presented), self, G_CONNECT_AFTER);
+#else
+    virt_viewer_signal_connect_object(self->priv->display, "expose-event",
+                                      G_CALLBACK(pace_presented), self, G_CONNECT_AFTER);
+#endif
+    /* before SpiceDisplay sends it, for the input latency */
+    virt_viewer_signal_connect_object(self->priv->display, "motion-notify-event",
+                                      G_CALLBACK(pointer_moved), self, 0);
+
+    enable_accel_changed(virt_viewer_session_get_app(session), NULL, self);
+    update_display_ready(self);
+}
+
+static gboolean
+virt_viewer_display_spice_release_widget(gpointer opaque)
+{
+    VirtViewerDisplaySpice *self = opaque;
+
+    g_debug("releasing SpiceDisplay of disabled display %d",
+            self->priv->channelid + self->priv->monitorid);
+
+    self->priv->release_id = 0;
+    pace_cancel(self);
+    self->priv->pace_pending = FALSE;
+    self->priv->paced_display = NULL;
+    self->priv->pointer_grabbed = FALSE;
+    gtk_widget_destroy(GTK_WIDGET(self->priv->display));
+    self->priv->display = NULL;
+    update_display_ready(self);
+
+    return FALSE;
+}
+
+/*
+ * SpiceDisplay widgets of secondary monitors are created when the guest
+ * first enables the monitor and dropped once it has stayed disabled for
+ * DISPLAY_RELEASE_DELAY, so guests with many heads mostly off don't keep
+ * a widget and its surface for each of them.
+ */
+static void
+virt_viewer_display_spice_update_widget(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+
+    if (priv->channelid + priv->monitorid == 0)
+        return;
+
+    if (virt_viewer_display_get_enabled(VIRT_VIEWER_DISPLAY(self))) {
+        if (priv->release_id != 0) {
+            g_source_remove(priv->release_id);
+            priv->release_id = 0;
+        }
+        if (priv->display == NULL)
+            virt_viewer_display_spice_create_widget(self);
+    } else if (priv->display != NULL && priv->release_id == 0) {
+        priv->release_id = g_timeout_add_seconds(DISPLAY_RELEASE_DELAY,
+                                                 virt_viewer_display_spice_release_widget,
+                                                 self);
+    }
+}
+
+#ifndef G_OS_WIN32
+static gint
+frame_export_create_fd(gsize size, gint *ro_fd)
+{
+    gint fd = -1;
+
+    *ro_fd = -1;
+
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, "virt-viewer-frame", 1 /* MFD_CLOEXEC */);
+    if (fd >= 0) {
+        /* a second, read-only open of the same file for the clients */
+        gchar *path = g_strdup_printf("/proc/self/fd/%d", fd);
+
+        *ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+        g_free(path);
+    }
+#endif
+    if (fd < 0) {
+        gchar *path = g_build_filename(g_get_tmp_dir(), "virt-viewer-frame-XXXXXX", NULL);
+
+        fd = g_mkstemp(path);
+        if (fd >= 0) {
+            *ro_fd = open(path, O_RDONLY | O_CLOEXEC);
+            unlink(path);
+        }
+        g_free(path);
+    }
+    if (fd < 0)
+        return -1;
+
+    if (*ro_fd < 0 || ftruncate(fd, size) < 0) {
+        gint saved = errno;
+
+        if (*ro_fd >= 0)
+            close(*ro_fd);
+        *ro_fd = -1;
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    return fd;
+}
+
+static void
+frame_export_release_surface(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+
+    if (priv->export_header == NULL)
+        return;
+
+    priv->export_header->live = 0;
+    munmap(priv->export_header, priv->export_size);
+    close(priv->export_fd);
+    priv->export_header = NULL;
+    priv->export_fd = -1;
+    priv->export_src = NULL;
+}
+
+static void
+frame_export_invalidate(SpiceChannel *channel G_GNUC_UNUSED,
+                        gint x, gint y, gint w, gint h,
+                        VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    VirtViewerFrameExportHeader *header = priv->export_header;
+    guint8 *dst;
+    guint32 done;
+    gint row, slot;
+
+    if (header == NULL)
+        return;
+
+    x = CLAMP(x, 0, (gint)header->width);
+    y = CLAMP(y, 0, (gint)header->height);
+    w = MIN(w, (gint)header->width - x);
+    h = MIN(h, (gint)header->height - y);
+    if (w <= 0 || h <= 0)
+        return;
+
+    g_atomic_int_inc(&header->sequence);
+    dst = (guint8 *)header + FRAME_EXPORT_HEADER_SIZE;
+    for (row = y; row < y + h; row++)
+        memcpy(dst + row * header->stride + x * priv->export_bpp,
+               priv->export_src + row * header->stride + x * priv->export_bpp,
+               w * priv->export_bpp);
+
+    done = (guint32)header->sequence + 1;
+    slot = done / 2 % FRAME_EXPORT_RING;
+    header->ring[slot].x = x;
+    header->ring[slot].y = y;
+    header->ring[slot].width = w;
+    header->ring[slot].height = h;
+    header->ring[slot].sequence = done;
+    g_atomic_int_inc(&header->sequence);
+}
+
+static void
+frame_export_primary_create(SpiceChannel *channel,
+                            gint format, gint width, gint height, gint stride,
+                            gint shmid G_GNUC_UNUSED, gpointer imgdata,
+                            VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    VirtViewerFrameExportHeader *header;
+    gsize size = FRAME_EXPORT_HEADER_SIZE + (gsize)height * stride;
+    gint fd, ro_fd;
+
+    frame_export_release_surface(self);
+
+    fd = frame_export_create_fd(size, &ro_fd);
+    if (fd < 0) {
+        g_warning("Cannot create frame export buffer: %s", g_strerror(errno));
+        return;
+    }
+    header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        g_warning("Cannot map frame export buffer: %s", g_strerror(errno));
+        close(fd);
+        close(ro_fd);
+        return;
+    }
+    /* the mapping is all we write through, clients only get ro_fd */
+    close(fd);
+
+    header->magic = FRAME_EXPORT_MAGIC;
+    header->version = FRAME_EXPORT_VERSION;
+    header->format = format;
+    header->width = width;
+    header->height = height;
+    header->stride = stride;
+    header->ring_size = FRAME_EXPORT_RING;
+    header->live = 1;
+
+    priv->export_fd = ro_fd;
+    priv->export_size = size;
+    priv->export_header = header;
+    priv->export_src = imgdata;
+    priv->export_bpp = (format == SPICE_SURFACE_FMT_16_555 ||
+                        format == SPICE_SURFACE_FMT_16_565) ? 2 : 4;
+
+    g_debug("exporting %dx%d frames of display %d", width, height, priv->channelid);
+    frame_export_invalidate(channel, 0, 0, width, height, self);
+}
+
+static void
+frame_export_primary_destroy(SpiceChannel *channel G_GNUC_UNUSED,
+                             VirtViewerDisplaySpice *self)
+{
+    frame_export_release_surface(self);
+}
+
+static void
+frame_export_connect_channel(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    SpiceDisplayPrimary primary;
+
+    virt_viewer_signal_connect_object(priv->channel, "display-primary-create",
+                                      G_CALLBACK(frame_export_primary_create), self, 0);
+    virt_viewer_signal_connect_object(priv->channel, "display-primary-destroy",
+                                      G_CALLBACK(frame_export_primary_destroy), self, 0);
+    virt_viewer_signal_connect_object(priv->channel, "display-invalidate",
+                                      G_CALLBACK(frame_export_invalidate), self, 0);
+
+    /* the surface usually exists before the display does */
+    if (spice_display_get_primary(priv->channel, 0, &primary))
+        frame_export_primary_create(priv->channel, primary.format,
+                                    primary.width, primary.height, primary.stride,
+                                    primary.shmid, primary.data, self);
+}
+
+/* hands the current buffer to whoever connects, then hangs up */
+static gboolean
+frame_export_accept(GIOChannel *source G_GNUC_UNUSED,
+                    GIOCondition condition G_GNUC_UNUSED,
+                    gpointer opaque)
+{
+    VirtViewerDisplaySpice *self = opaque;
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    gchar control[CMSG_SPACE(sizeof(gint))];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    gchar *line;
+    gint sock;
+
+    sock = accept(priv->export_listen_fd, NULL, NULL);
+    if (sock < 0)
+        return TRUE;
+
+    line = g_strdup_printf("VVFX %d %" G_GSIZE_FORMAT "\n", FRAME_EXPORT_VERSION,
+                           priv->export_header ? priv->export_size : 0);
+    iov.iov_base = line;
+    iov.iov_len = strlen(line);
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (priv->export_header != NULL) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(gint));
+        memcpy(CMSG_DATA(cmsg), &priv->export_fd, sizeof(gint));
+    }
+
+    if (sendmsg(sock, &msg, 0) < 0)
+        g_debug("failed to send frame buffer: %s", g_strerror(errno));
+
+    g_free(line);
+    close(sock);
+
+    return TRUE;
+}
+
+/*
+ * Publishes the guest surface of this display in shared memory, and
+ * listens on <dir>/display-<n>.sock: each client connecting there gets a
+ * "VVFX <version> <size>" line along with the buffer's file descriptor,
+ * to be mapped read-only. Frames are copied once, as the guest updates
+ * them, and never encoded. Only displays owning their channel are
+ * exported: monitors sharing a surface are all part of the first one.
+ */
+static void
+frame_export_start(VirtViewerDisplaySpice *self, const gchar *dir)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+    struct sockaddr_un addr;
+    GIOChannel *channel;
+    gchar *name;
+    gint fd;
+
+    if (dir == NULL || priv->monitorid != 0)
+        return;
+
+    name = g_strdup_printf("display-%d.sock", priv->channelid + 1);
+    priv->export_path = g_build_filename(dir, name, NULL);
+    g_free(name);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(priv->export_path) >= sizeof(addr.sun_path)) {
+        g_warning("Frame export socket path %s is too long", priv->export_path);
+        goto error;
+    }
+    strcpy(addr.sun_path, priv->export_path);
+
+    g_mkdir_with_parents(dir, 0700);
+    unlink(priv->export_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 4) < 0) {
+        g_warning("Cannot listen on %s: %s", priv->export_path, g_strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        goto error;
+    }
+
+    priv->export_listen_fd = fd;
+    channel = g_io_channel_unix_new(fd);
+    priv->export_listen_id = g_io_add_watch(channel, G_IO_IN, frame_export_accept, self);
+    g_io_channel_unref(channel);
+
+    frame_export_connect_channel(self);
+    return;
+
+error:
+    g_free(priv->export_path);
+    priv->export_path = NULL;
+}
+
+static void
+frame_export_stop(VirtViewerDisplaySpice *self)
+{
+    VirtViewerDisplaySpicePrivate *priv = self->priv;
+
+    frame_export_release_surface(self);
+
+    if (priv->export_listen_id != 0) {
+        g_source_remove(priv->export_listen_id);
+        priv->export_listen_id = 0;
+    }
+    if (priv->export_listen_fd >= 0) {
+        close(priv->export_listen_fd);
+        priv->export_listen_fd = -1;
+    }
+    if (priv->export_path != NULL) {
+        unlink(priv->export_path);
+        g_free(priv->export_path);
+        priv->export_path = NULL;
+    }
+}
+#endif
+
+GtkWidget *
+virt_viewer_display_spice_new(VirtViewerSessionSpice *session,
+                              SpiceChannel *channel,
+                              gint monitorid)
+{
+    VirtViewerDisplaySpice *self;
+    VirtViewerApp *app;
+    gint channelid;
+
+    g_return_val_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel), NULL);
+
+    g_object_get(channel, "channel-id", &channelid, NULL);
+    // We don't allow monitorid != 0 && channelid != 0
+    g_return_val_if_fail(channelid == 0 || monitorid == 0, NULL);
+
+    self = g_object_new(VIRT_VIEWER_TYPE_DISPLAY_SPICE,
+                        "session", session,
+                        // either monitorid is always 0 or channelid
+                        // is, we can't have display (0, 2) and (2, 0)
+                        // for example
+                        "nth-display", channelid + monitorid,
+                        NULL);
+    self->priv->channel = channel;
+    self->priv->channelid = channelid;
+    self->priv->monitorid = monitorid;
+
     virt_viewer_signal_connect_object(self, "size-allocate",
                                       G_CALLBACK(virt_viewer_display_spice_size_allocate), self, 0);
 
@@ -312,17 +1058,58 @@ virt_viewer_display_spice_new(VirtViewerSessionSpice *session,
     virt_viewer_signal_connect_object(self, "notify::zoom-level",
                                       G_CALLBACK(zoom_level_changed), app, 0);
     fullscreen_changed(self, NULL, app);
-    enable_accel_changed(app, NULL, self);
+
+    virt_viewer_signal_connect_object(channel, "display-invalidate",
+                                      G_CALLBACK(pace_invalidate), self, 0);
+    virt_viewer_signal_connect_object(app, "notify::max-fps",
+                                      G_CALLBACK(max_fps_changed), self, 0);
+    virt_viewer_signal_connect_object(app, "notify::power-save",
+                                      G_CALLBACK(max_fps_changed), self, 0);
+    max_fps_changed(app, NULL, self);
+    if (doDebug)
+        self->priv->report_id = g_timeout_add_seconds(DISPLAY_REPORT_INTERVAL, pace_report, self);
+
+    /* the first display is always wanted, the others get their widget
+     * once the guest enables them */
+    if (channelid + monitorid == 0)
+        virt_viewer_display_spice_create_widget(self);
+
+#ifndef G_OS_WIN32
+    frame_export_start(self, virt_viewer_app_get_frame_export_dir(app));
+#endif
 
     return GTK_WIDGET(self);
 }
 
+void
+virt_viewer_display_spice_set_channel(VirtViewerDisplaySpice *self,
+                                      SpiceChannel *channel)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY_SPICE(self));
+    g_return_if_fail(SPICE_IS_DISPLAY_CHANNEL(channel));
+
+    /* the SpiceDisplay widget follows the channel id on its own */
+    pace_cancel(self);
+    self->priv->pace_pending = FALSE;
+    self->priv->paced_channel = NULL;
+    self->priv->paced_display = NULL;
+    self->priv->channel = channel;
+    virt_viewer_signal_connect_object(channel, "display-invalidate",
+                                      G_CALLBACK(pace_invalidate), self, 0);
+
+#ifndef G_OS_WIN32
+    if (self->priv->export_path != NULL)
+        frame_export_connect_channel(self);
+#endif
+}
+
 static void
 virt_viewer_display_spice_release_cursor(VirtViewerDisplay *display)
 {
     VirtViewerDisplaySpice *self = VIRT_VIEWER_DISPLAY_SPICE(display);
 
-    spice_display_mouse_ungrab(self->priv->display);
+    if (self->priv->display != NULL)
+        spice_display_mouse_ungrab(self->priv->display);
 }
 
 
@@ -67,6 +67,7 @@ struct _VirtViewerDisplaySpiceClass {
 GType virt_viewer_display_spice_get_type(void);
 
 GtkWidget* virt_viewer_display_spice_new(VirtViewerSessionSpice *session, SpiceChannel *channel, gint monitorid);
+void virt_viewer_display_spice_set_channel(VirtViewerDisplaySpice *self, SpiceChannel *channel);
 
 G_END_DECLS
 
@@ -121,6 +121,23 @@ virt_viewer_display_vnc_initialized(VncDisplay *vnc G_GNUC_UNUSED,
     g_signal_emit_by_name(display, "display-desktop-resize");
 }
 
+/* gtk-vnc only tells about framebuffer updates by repainting them */
+#if GTK_CHECK_VERSION(3, 0, 0)
+static gboolean
+virt_viewer_display_vnc_drawn(GtkWidget *vnc G_GNUC_UNUSED,
+                              cairo_t *cr G_GNUC_UNUSED,
+                              VirtViewerDisplay *display)
+#else
+static gboolean
+virt_viewer_display_vnc_drawn(GtkWidget *vnc G_GNUC_UNUSED,
+                              GdkEventExpose *event G_GNUC_UNUSED,
+                              VirtViewerDisplay *display)
+#endif
+{
+    virt_viewer_display_damage(display);
+    return FALSE;
+}
+
 static void
 virt_viewer_display_vnc_send_keys(VirtViewerDisplay* display,
                                   const guint *keyvals,
@@ -206,6 +223,13 @@ virt_viewer_display_vnc_new(VirtViewerSessionVnc *session,
                      G_CALLBACK(virt_viewer_display_vnc_key_ungrab), display);
     g_signal_connect(display->priv->vnc, "vnc-initialized",
                      G_CALLBACK(virt_viewer_display_vnc_initialized), display);
+#if GTK_CHECK_VERSION(3, 0, 0)
+    g_signal_connect_after(display->priv->vnc, "draw",
+                           G_CALLBACK(virt_viewer_display_vnc_drawn), display);
+#else
+    g_signal_connect_after(display->priv->vnc, "expose-event",
+                           G_CALLBACK(virt_viewer_display_vnc_drawn), display);
+#endif
 
     return GTK_WIDGET(display);
 }
@@ -26,6 +26,8 @@
 
 #include <locale.h>
 #include <math.h>
+#include <string.h>
+#include <glib/gi18n.h>
 
 #include "virt-gtk-compat.h"
 #include "virt-viewer-session.h"
@@ -34,6 +36,28 @@
 
 #define VIRT_VIEWER_DISPLAY_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_DISPLAY, VirtViewerDisplayPrivate))
 
+/*
+ * Input pipeline, see virt_viewer_display_input_event. Latencies are
+ * counted per event class in buckets of up to 1, 2, 4, ... 64 ms and
+ * above.
+ */
+typedef enum {
+    INPUT_MOTION,
+    INPUT_BUTTON, /* buttons and scrolling */
+    INPUT_KEY,
+    INPUT_CLASSES,
+} InputClass;
+
+static const gchar *input_class_names[] = { "motion", "button", "key" };
+
+typedef struct {
+    InputClass class;
+    gint64 arrival;
+} InputSent;
+
+#define INPUT_BUCKETS 8
+#define INPUT_MOTION_FPS 60 /* when there is no --max-fps */
+
 struct _VirtViewerDisplayPrivate
 {
 #if !GTK_CHECK_VERSION(3, 0, 0)
@@ -49,6 +73,26 @@ struct _VirtViewerDisplayPrivate
     guint show_hint;
     VirtViewerSession *session;
     gboolean fullscreen;
+    gboolean hidden;
+    guint64 frames_received; /* updates from the guest */
+    guint64 frames_presented; /* frames actually painted */
+    gint64 unpresented_since; /* first update not painted yet */
+    gint64 latency; /* smoothed, in microseconds */
+
+    /* input pipeline, see virt_viewer_display_input_event */
+    GdkEvent *input_motion; /* latest motion held back, NULL if none */
+    gint64 input_motion_since; /* arrival of the oldest motion it replaces */
+    guint input_queued; /* motions merged into input_motion */
+    guint input_queued_max;
+    guint input_id;
+    gint64 input_sent; /* last motion handed to the protocol widget */
+    gboolean input_replaying;
+    gint64 input_arrival; /* of the event the protocol widget is handling, 0 if none */
+    InputClass input_class;
+    GArray *input_unsent; /* InputSent, handled but maybe not written yet */
+    guint input_wire_id;
+    guint64 input_merged;
+    guint64 input_wire[INPUT_CLASSES][INPUT_BUCKETS]; /* histograms of the time to the wire */
 };
 
 #if !GTK_CHECK_VERSION(3, 0, 0)
@@ -73,6 +117,8 @@ static void virt_viewer_display_get_property(GObject *object,
                                              GValue *value,
                                              GParamSpec *pspec);
 static void virt_viewer_display_grab_focus(GtkWidget *widget);
+static void virt_viewer_display_input_flush(VirtViewerDisplay *self);
+static void virt_viewer_display_input_cancel(VirtViewerDisplay *self);
 
 G_DEFINE_ABSTRACT_TYPE(VirtViewerDisplay, virt_viewer_display, GTK_TYPE_BIN)
 
@@ -89,14 +135,36 @@ enum {
     PROP_SESSION,
     PROP_SELECTABLE,
     PROP_MONITOR,
+    PROP_HIDDEN,
 };
 
+static void
+virt_viewer_display_dispose(GObject *object)
+{
+    VirtViewerDisplay *self = VIRT_VIEWER_DISPLAY(object);
+    GString *stats = g_string_new(NULL);
+
+    virt_viewer_display_input_cancel(self);
+    if (self->priv->input_wire_id != 0) {
+        g_source_remove(self->priv->input_wire_id);
+        self->priv->input_wire_id = 0;
+    }
+    g_clear_pointer(&self->priv->input_unsent, g_array_unref);
+    virt_viewer_display_get_input_stats(self, stats);
+    if (stats->len > 0)
+        g_debug("display %d input:\n%s", self->priv->nth_display, stats->str);
+    g_string_free(stats, TRUE);
+
+    G_OBJECT_CLASS(virt_viewer_display_parent_class)->dispose(object);
+}
+
 static void
 virt_viewer_display_class_init(VirtViewerDisplayClass *class)
 {
     GObjectClass *object_class = G_OBJECT_CLASS(class);
     GtkWidgetClass *widget_class = GTK_WIDGET_CLASS(class);
 
+    object_class->dispose = virt_viewer_display_dispose;
     object_class->set_property = virt_viewer_display_set_property;
     object_class->get_property = virt_viewer_display_get_property;
 
@@ -203,6 +271,14 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
                                                          FALSE,
                                                          G_PARAM_READABLE));
 
+    g_object_class_install_property(object_class,
+                                    PROP_HIDDEN,
+                                    g_param_spec_boolean("hidden",
+                                                         "Hidden",
+                                                         "Nobody can currently see the display",
+                                                         FALSE,
+                                                         G_PARAM_READABLE));
+
     g_signal_new("display-pointer-grab",
                  G_OBJECT_CLASS_TYPE(object_class),
                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
@@ -253,6 +329,16 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
                  G_TYPE_NONE,
                  0);
 
+    g_signal_new("display-damage",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
+                 G_STRUCT_OFFSET(VirtViewerDisplayClass, display_damage),
+                 NULL,
+                 NULL,
+                 g_cclosure_marshal_VOID__VOID,
+                 G_TYPE_NONE,
+                 0);
+
     g_signal_new("monitor-geometry-changed",
                  G_OBJECT_CLASS_TYPE(object_class),
                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
@@ -266,6 +352,236 @@ virt_viewer_display_class_init(VirtViewerDisplayClass *class)
     g_type_class_add_private(class, sizeof(VirtViewerDisplayPrivate));
 }
 
+/* @latency: microseconds between the event reaching us and it being
+ * written to the connection; the network and the guest are not part of it */
+static void
+virt_viewer_display_input_record(VirtViewerDisplay *self, InputClass class, gint64 latency)
+{
+    guint bucket = 0;
+
+    while (bucket < INPUT_BUCKETS - 1 && latency > (1000 << bucket))
+        bucket++;
+    self->priv->input_wire[class][bucket]++;
+}
+
+/*
+ * spice-gtk and gtk-vnc only queue the messages of an event, and write
+ * their queue to the socket from an idle of the main loop. This one is
+ * added after theirs, at the same priority, so it runs once the events
+ * handled meanwhile are on the wire, unless the socket is full.
+ */
+static gboolean
+virt_viewer_display_input_written(gpointer opaque)
+{
+    VirtViewerDisplay *self = opaque;
+    VirtViewerDisplayPrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time();
+    guint i;
+
+    priv->input_wire_id = 0;
+    for (i = 0; i < priv->input_unsent->len; i++) {
+        InputSent *sent = &g_array_index(priv->input_unsent, InputSent, i);
+
+        virt_viewer_display_input_record(self, sent->class, now - sent->arrival);
+    }
+    g_array_set_size(priv->input_unsent, 0);
+
+    return FALSE;
+}
+
+/* the protocol widget is done with the event */
+static void
+virt_viewer_display_input_event_after(GtkWidget *child G_GNUC_UNUSED,
+                                      GdkEvent *event G_GNUC_UNUSED,
+                                      VirtViewerDisplay *self)
+{
+    VirtViewerDisplayPrivate *priv = self->priv;
+    InputSent sent;
+
+    if (priv->input_arrival == 0)
+        return;
+
+    sent.class = priv->input_class;
+    sent.arrival = priv->input_arrival;
+    priv->input_arrival = 0;
+    if (priv->input_unsent == NULL)
+        priv->input_unsent = g_array_new(FALSE, FALSE, sizeof(InputSent));
+    g_array_append_val(priv->input_unsent, sent);
+
+    if (priv->input_wire_id == 0)
+        priv->input_wire_id = g_idle_add_full(G_PRIORITY_DEFAULT,
+                                              virt_viewer_display_input_written,
+                                              self, NULL);
+}
+
+/* the next event handed to the protocol widget arrived at @arrival */
+static void
+virt_viewer_display_input_track(VirtViewerDisplay *self, InputClass class, gint64 arrival)
+{
+    self->priv->input_class = class;
+    self->priv->input_arrival = arrival;
+}
+
+static gboolean
+virt_viewer_display_input_timeout(gpointer opaque)
+{
+    VirtViewerDisplay *self = opaque;
+
+    self->priv->input_id = 0;
+    virt_viewer_display_input_flush(self);
+
+    return FALSE;
+}
+
+/* hand the motion held back, if any, to the protocol widget */
+static void
+virt_viewer_display_input_flush(VirtViewerDisplay *self)
+{
+    VirtViewerDisplayPrivate *priv = self->priv;
+    GtkWidget *child = gtk_bin_get_child(GTK_BIN(self));
+    GdkEvent *event = priv->input_motion;
+
+    if (priv->input_id != 0) {
+        g_source_remove(priv->input_id);
+        priv->input_id = 0;
+    }
+    if (event == NULL)
+        return;
+
+    priv->input_motion = NULL;
+    priv->input_queued = 0;
+    if (child != NULL) {
+        virt_viewer_display_input_track(self, INPUT_MOTION, priv->input_motion_since);
+        priv->input_replaying = TRUE;
+        gtk_widget_event(child, event);
+        priv->input_replaying = FALSE;
+        priv->input_arrival = 0;
+    }
+    priv->input_sent = g_get_monotonic_time();
+    gdk_event_free(event);
+}
+
+static void
+virt_viewer_display_input_cancel(VirtViewerDisplay *self)
+{
+    VirtViewerDisplayPrivate *priv = self->priv;
+
+    if (priv->input_id != 0) {
+        g_source_remove(priv->input_id);
+        priv->input_id = 0;
+    }
+    if (priv->input_motion != NULL) {
+        gdk_event_free(priv->input_motion);
+        priv->input_motion = NULL;
+    }
+    priv->input_queued = 0;
+}
+
+static gint64
+virt_viewer_display_input_interval(VirtViewerDisplay *self)
+{
+    gint fps = 0;
+
+    if (self->priv->session != NULL)
+        fps = virt_viewer_app_get_max_fps(virt_viewer_session_get_app(self->priv->session));
+
+    return G_USEC_PER_SEC / (fps > 0 ? fps : INPUT_MOTION_FPS);
+}
+
+/*
+ * Sits in front of the protocol widget. Pointer motion goes through at
+ * most once per frame interval: motions arriving in between replace the
+ * one held back, which is sent when the interval is over. Buttons, keys
+ * and scrolling are never held or dropped; the motion held back goes
+ * first so that they reach the guest in order. What is recorded is the
+ * time from the event reaching us to it being written to the connection,
+ * see virt_viewer_display_input_written: the network and the guest are
+ * not part of it, see --measure-latency for that.
+ */
+static gboolean
+virt_viewer_display_input_event(GtkWidget *child G_GNUC_UNUSED,
+                                GdkEvent *event,
+                                VirtViewerDisplay *self)
+{
+    VirtViewerDisplayPrivate *priv = self->priv;
+    gint64 now, interval;
+
+    if (priv->input_replaying)
+        return FALSE;
+
+    now = g_get_monotonic_time();
+    priv->input_arrival = 0;
+    switch (event->type) {
+    case GDK_MOTION_NOTIFY:
+        /* with hints, the widget queries the position itself */
+        if (event->motion.is_hint)
+            return FALSE;
+
+        interval = virt_viewer_display_input_interval(self);
+        if (priv->input_motion == NULL && now - priv->input_sent >= interval) {
+            priv->input_sent = now;
+            virt_viewer_display_input_track(self, INPUT_MOTION, now);
+            return FALSE;
+        }
+
+        if (priv->input_motion != NULL) {
+            gdk_event_free(priv->input_motion);
+            priv->input_merged++;
+        } else {
+            priv->input_motion_since = now;
+        }
+        priv->input_motion = gdk_event_copy(event);
+        priv->input_queued++;
+        priv->input_queued_max = MAX(priv->input_queued_max, priv->input_queued);
+
+        if (priv->input_id == 0)
+            priv->input_id = g_timeout_add(MAX((interval - (now - priv->input_sent)) / 1000, 1),
+                                           virt_viewer_display_input_timeout, self);
+        return TRUE;
+
+    case GDK_BUTTON_PRESS:
+    case GDK_2BUTTON_PRESS:
+    case GDK_3BUTTON_PRESS:
+    case GDK_BUTTON_RELEASE:
+    case GDK_SCROLL:
+        virt_viewer_display_input_flush(self);
+        virt_viewer_display_input_track(self, INPUT_BUTTON, now);
+        return FALSE;
+
+    case GDK_KEY_PRESS:
+    case GDK_KEY_RELEASE:
+        virt_viewer_display_input_flush(self);
+        virt_viewer_display_input_track(self, INPUT_KEY, now);
+        return FALSE;
+
+    default:
+        return FALSE;
+    }
+}
+
+static void
+virt_viewer_display_child_added(GtkContainer *container,
+                                GtkWidget *child,
+                                gpointer user_data G_GNUC_UNUSED)
+{
+    VirtViewerDisplay *self = VIRT_VIEWER_DISPLAY(container);
+
+    gtk_widget_set_child_visible(child, !self->priv->hidden);
+    virt_viewer_signal_connect_object(child, "event",
+                                      G_CALLBACK(virt_viewer_display_input_event), self, 0);
+    virt_viewer_signal_connect_object(child, "event-after",
+                                      G_CALLBACK(virt_viewer_display_input_event_after), self, 0);
+}
+
+static void
+virt_viewer_display_child_removed(GtkContainer *container,
+                                  GtkWidget *child G_GNUC_UNUSED,
+                                  gpointer user_data G_GNUC_UNUSED)
+{
+    /* a motion held back belongs to the window of the old widget */
+    virt_viewer_display_input_cancel(VIRT_VIEWER_DISPLAY(container));
+}
+
 static void
 virt_viewer_display_init(VirtViewerDisplay *display)
 {
@@ -282,6 +598,9 @@ virt_viewer_display_init(VirtViewerDisplay *display)
     display->priv->dirty = TRUE;
     display->priv->size_request_once = FALSE;
 #endif
+
+    g_signal_connect_after(display, "add", G_CALLBACK(virt_viewer_display_child_added), NULL);
+    g_signal_connect(display, "remove", G_CALLBACK(virt_viewer_display_child_removed), NULL);
 }
 
 GtkWidget*
@@ -361,6 +680,9 @@ virt_viewer_display_get_property(GObject *object,
     case PROP_FULLSCREEN:
         g_value_set_boolean(value, virt_viewer_display_get_fullscreen(display));
         break;
+    case PROP_HIDDEN:
+        g_value_set_boolean(value, priv->hidden);
+        break;
 
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -642,9 +964,15 @@ gboolean virt_viewer_display_get_zoom(VirtViewerDisplay *display)
 void virt_viewer_display_send_keys(VirtViewerDisplay *display,
                                    const guint *keyvals, int nkeyvals)
 {
+    gint64 start;
+
     g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(display));
 
+    /* like typed keys, after the pointer motion that came before */
+    start = g_get_monotonic_time();
+    virt_viewer_display_input_flush(display);
     VIRT_VIEWER_DISPLAY_GET_CLASS(display)->send_keys(display, keyvals, nkeyvals);
+    virt_viewer_display_input_record(display, INPUT_KEY, g_get_monotonic_time() - start);
 }
 
 GdkPixbuf* virt_viewer_display_get_pixbuf(VirtViewerDisplay *display)
@@ -654,6 +982,290 @@ GdkPixbuf* virt_viewer_display_get_pixbuf(VirtViewerDisplay *display)
     return VIRT_VIEWER_DISPLAY_GET_CLASS(display)->get_pixbuf(display);
 }
 
+typedef struct {
+    GdkPixbuf *pixbuf;
+    gchar *file;
+    gchar *format;
+} VirtViewerDisplayScreenshot;
+
+static void
+virt_viewer_display_screenshot_free(gpointer opaque)
+{
+    VirtViewerDisplayScreenshot *shot = opaque;
+
+    g_object_unref(shot->pixbuf);
+    g_free(shot->file);
+    g_free(shot->format);
+    g_free(shot);
+}
+
+static gboolean
+virt_viewer_display_write_ppm(GdkPixbuf *pixbuf, const gchar *file, GError **error)
+{
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    gint stride = gdk_pixbuf_get_rowstride(pixbuf);
+    gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+    const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    GByteArray *out;
+    gchar *header;
+    gboolean ret;
+    gint x, y;
+
+    header = g_strdup_printf("P6\n%d %d\n255\n", width, height);
+    out = g_byte_array_sized_new(strlen(header) + width * height * 3);
+    g_byte_array_append(out, (guint8 *)header, strlen(header));
+    g_free(header);
+
+    for (y = 0; y < height; y++) {
+        const guchar *row = pixels + y * stride;
+
+        if (channels == 3) {
+            g_byte_array_append(out, row, width * 3);
+            continue;
+        }
+        for (x = 0; x < width; x++)
+            g_byte_array_append(out, row + x * channels, 3);
+    }
+
+    ret = g_file_set_contents(file, (gchar *)out->data, out->len, error);
+    g_byte_array_unref(out);
+
+    return ret;
+}
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+
+static void
+qoi_put_u32(GByteArray *out, guint32 v)
+{
+    guint8 b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+    g_byte_array_append(out, b, 4);
+}
+
+static void
+qoi_put(GByteArray *out, guint8 v)
+{
+    g_byte_array_append(out, &v, 1);
+}
+
+/* Lossless "Quite OK Image" encoding, see https://qoiformat.org/ */
+static gboolean
+virt_viewer_display_write_qoi(GdkPixbuf *pixbuf, const gchar *file, GError **error)
+{
+    static const guint8 padding[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    gint width = gdk_pixbuf_get_width(pixbuf);
+    gint height = gdk_pixbuf_get_height(pixbuf);
+    gint stride = gdk_pixbuf_get_rowstride(pixbuf);
+    gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+    const guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+    guint8 index[64][4] = { { 0 } };
+    guint8 prev[4] = { 0, 0, 0, 255 };
+    guint8 px[4] = { 0, 0, 0, 255 };
+    GByteArray *out;
+    gboolean ret;
+    gint run = 0;
+    gint x, y;
+
+    out = g_byte_array_sized_new(14 + width * height + sizeof(padding));
+    g_byte_array_append(out, (const guint8 *)"qoif", 4);
+    qoi_put_u32(out, width);
+    qoi_put_u32(out, height);
+    qoi_put(out, channels);
+    qoi_put(out, 0); /* sRGB with linear alpha */
+
+    for (y = 0; y < height; y++) {
+        const guchar *row = pixels + y * stride;
+
+        for (x = 0; x < width; x++) {
+            gboolean last = (y == height - 1 && x == width - 1);
+            gint h;
+
+            memcpy(px, row + x * channels, channels);
+
+            if (memcmp(px, prev, 4) == 0) {
+                run++;
+                if (run == 62 || last) {
+                    qoi_put(out, QOI_OP_RUN | (run - 1));
+                    run = 0;
+                }
+                continue;
+            }
+
+            if (run > 0) {
+                qoi_put(out, QOI_OP_RUN | (run - 1));
+                run = 0;
+            }
+
+            h = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+            if (memcmp(index[h], px, 4) == 0) {
+                qoi_put(out, QOI_OP_INDEX | h);
+            } else {
+                memcpy(index[h], px, 4);
+
+                if (px[3] == prev[3]) {
+                    gint8 vr = px[0] - prev[0];
+                    gint8 vg = px[1] - prev[1];
+                    gint8 vb = px[2] - prev[2];
+                    gint8 vg_r = vr - vg;
+                    gint8 vg_b = vb - vg;
+
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                        qoi_put(out, QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2));
+                    } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+                               vg_b > -9 && vg_b < 8) {
+                        qoi_put(out, QOI_OP_LUMA | (vg + 32));
+                        qoi_put(out, (vg_r + 8) << 4 | (vg_b + 8));
+                    } else {
+                        qoi_put(out, QOI_OP_RGB);
+                        g_byte_array_append(out, px, 3);
+                    }
+                } else {
+                    qoi_put(out, QOI_OP_RGBA);
+                    g_byte_array_append(out, px, 4);
+                }
+            }
+            memcpy(prev, px, 4);
+        }
+    }
+    g_byte_array_append(out, padding, sizeof(padding));
+
+    ret = g_file_set_contents(file, (gchar *)out->data, out->len, error);
+    g_byte_array_unref(out);
+
+    return ret;
+}
+
+/* runs in a worker thread, only touches the pixbuf copy it owns */
+static gboolean
+virt_viewer_display_write_screenshot(VirtViewerDisplayScreenshot *shot, GError **error)
+{
+    if (g_str_equal(shot->format, "ppm"))
+        return virt_viewer_display_write_ppm(shot->pixbuf, shot->file, error);
+    if (g_str_equal(shot->format, "qoi"))
+        return virt_viewer_display_write_qoi(shot->pixbuf, shot->file, error);
+    if (g_str_equal(shot->format, "png-fast"))
+        return gdk_pixbuf_save(shot->pixbuf, shot->file, "png", error,
+                               "compression", "1",
+                               "tEXt::Generator App", PACKAGE, NULL);
+    if (g_str_equal(shot->format, "png"))
+        return gdk_pixbuf_save(shot->pixbuf, shot->file, "png", error,
+                               "tEXt::Generator App", PACKAGE, NULL);
+
+    return gdk_pixbuf_save(shot->pixbuf, shot->file, shot->format, error, NULL);
+}
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+static void
+virt_viewer_display_screenshot_thread(GTask *task,
+                                      gpointer source G_GNUC_UNUSED,
+                                      gpointer task_data,
+                                      GCancellable *cancellable G_GNUC_UNUSED)
+{
+    GError *error = NULL;
+
+    if (virt_viewer_display_write_screenshot(task_data, &error))
+        g_task_return_boolean(task, TRUE);
+    else
+        g_task_return_error(task, error);
+}
+#else
+static void
+virt_viewer_display_screenshot_thread(GSimpleAsyncResult *result,
+                                      GObject *source G_GNUC_UNUSED,
+                                      GCancellable *cancellable G_GNUC_UNUSED)
+{
+    GError *error = NULL;
+
+    if (!virt_viewer_display_write_screenshot(g_simple_async_result_get_op_res_gpointer(result),
+                                              &error)) {
+        g_simple_async_result_set_from_error(result, error);
+        g_error_free(error);
+    }
+}
+#endif
+
+/*
+ * Saves the current content of the display to @file. Only the copy of the
+ * frame is taken here, encoding and writing happen in a worker thread.
+ * @format is "ppm", "qoi", "png-fast" (PNG with a low zlib level) or any
+ * writable gdk-pixbuf format.
+ */
+void
+virt_viewer_display_save_screenshot_async(VirtViewerDisplay *self,
+                                          const gchar *file,
+                                          const gchar *format,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data)
+{
+    VirtViewerDisplayScreenshot *shot;
+    GdkPixbuf *pixbuf;
+
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+    g_return_if_fail(file != NULL);
+    g_return_if_fail(format != NULL);
+
+    pixbuf = virt_viewer_display_get_pixbuf(self);
+    if (pixbuf == NULL) {
+#if GLIB_CHECK_VERSION(2, 36, 0)
+        g_task_report_new_error(self, callback, user_data,
+                                virt_viewer_display_save_screenshot_async,
+                                VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                                "%s", _("The display has no content yet"));
+#else
+        g_simple_async_report_error_in_idle(G_OBJECT(self), callback, user_data,
+                                            VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                                            "%s", _("The display has no content yet"));
+#endif
+        return;
+    }
+
+    shot = g_new0(VirtViewerDisplayScreenshot, 1);
+    shot->pixbuf = pixbuf;
+    shot->file = g_strdup(file);
+    shot->format = g_strdup(format);
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    {
+        GTask *task = g_task_new(self, NULL, callback, user_data);
+
+        g_task_set_task_data(task, shot, virt_viewer_display_screenshot_free);
+        g_task_run_in_thread(task, virt_viewer_display_screenshot_thread);
+        g_object_unref(task);
+    }
+#else
+    {
+        GSimpleAsyncResult *result;
+
+        result = g_simple_async_result_new(G_OBJECT(self), callback, user_data,
+                                           virt_viewer_display_save_screenshot_async);
+        g_simple_async_result_set_op_res_gpointer(result, shot,
+                                                  virt_viewer_display_screenshot_free);
+        g_simple_async_result_run_in_thread(result, virt_viewer_display_screenshot_thread,
+                                            G_PRIORITY_DEFAULT, NULL);
+        g_object_unref(result);
+    }
+#endif
+}
+
+gboolean
+virt_viewer_display_save_screenshot_finish(VirtViewerDisplay *self G_GNUC_UNUSED,
+                                           GAsyncResult *result,
+                                           GError **error)
+{
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    return g_task_propagate_boolean(G_TASK(result), error);
+#else
+    return !g_simple_async_result_propagate_error(G_SIMPLE_ASYNC_RESULT(result), error);
+#endif
+}
+
 guint virt_viewer_display_get_show_hint(VirtViewerDisplay *self)
 {
     g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), 0);
@@ -767,6 +1379,141 @@ void virt_viewer_display_set_fullscreen(VirtViewerDisplay *self, gboolean fullsc
     g_object_notify(G_OBJECT(self), "fullscreen");
 }
 
+/*
+ * Called by the window holding the display when it gets minimized,
+ * fully covered or shown again. While hidden, the protocol widget is
+ * unmapped so guest updates are still decoded into its canvas but
+ * never drawn; mapping it again redraws it in full right away.
+ */
+void virt_viewer_display_set_hidden(VirtViewerDisplay *self, gboolean hidden)
+{
+    GtkWidget *child;
+
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+
+    if (self->priv->hidden == hidden)
+        return;
+
+    g_debug("display %d is now %s", self->priv->nth_display, hidden ? "hidden" : "visible");
+    self->priv->hidden = hidden;
+    /* time spent hidden isn't presentation latency */
+    self->priv->unpresented_since = 0;
+    child = gtk_bin_get_child(GTK_BIN(self));
+    if (child != NULL)
+        gtk_widget_set_child_visible(child, !hidden);
+    g_object_notify(G_OBJECT(self), "hidden");
+}
+
+gboolean virt_viewer_display_get_hidden(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
+
+    return self->priv->hidden;
+}
+
+/*
+ * Called by the protocol implementations for each update they get from
+ * the guest and for each frame they paint, so that updates dropped by
+ * coalescing or while hidden show up as the difference of the two.
+ * The latency is the time between the oldest update of a frame and
+ * its painting.
+ */
+void virt_viewer_display_count_frames(VirtViewerDisplay *self, guint received, guint presented)
+{
+    VirtViewerDisplayPrivate *priv;
+
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+    priv = self->priv;
+
+    priv->frames_received += received;
+    priv->frames_presented += presented;
+
+    if (received && priv->unpresented_since == 0)
+        priv->unpresented_since = g_get_monotonic_time();
+    if (presented && priv->unpresented_since != 0) {
+        gint64 latency = g_get_monotonic_time() - priv->unpresented_since;
+
+        priv->latency = priv->latency ? (priv->latency * 7 + latency) / 8 : latency;
+        priv->unpresented_since = 0;
+    }
+}
+
+/*
+ * Called by the protocol implementations when the guest framebuffer
+ * changed, so that virt_viewer_display_get_pixbuf() returns something
+ * new. Emits "display-damage".
+ */
+void virt_viewer_display_damage(VirtViewerDisplay *self)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+
+    g_signal_emit_by_name(self, "display-damage");
+}
+
+/* smoothed presentation latency in microseconds, 0 if unknown */
+gint64 virt_viewer_display_get_latency(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), 0);
+
+    return self->priv->latency;
+}
+
+void virt_viewer_display_get_frame_counts(VirtViewerDisplay *self,
+                                          guint64 *received,
+                                          guint64 *presented)
+{
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+
+    if (received)
+        *received = self->priv->frames_received;
+    if (presented)
+        *presented = self->priv->frames_presented;
+}
+
+/* number of pointer motions waiting in the input pipeline */
+guint virt_viewer_display_get_input_queue(VirtViewerDisplay *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), 0);
+
+    return self->priv->input_queued;
+}
+
+/*
+ * Appends the input pipeline state and, for each event class seen, the
+ * non-empty buckets of the time to the wire, one line each.
+ */
+void virt_viewer_display_get_input_stats(VirtViewerDisplay *self, GString *stats)
+{
+    VirtViewerDisplayPrivate *priv;
+    guint class, bucket;
+
+    g_return_if_fail(VIRT_VIEWER_IS_DISPLAY(self));
+    priv = self->priv;
+
+    g_string_append_printf(stats, "input: %u queued (max %u), %" G_GUINT64_FORMAT " merged\n",
+                           priv->input_queued, priv->input_queued_max, priv->input_merged);
+
+    for (class = 0; class < INPUT_CLASSES; class++) {
+        gboolean first = TRUE;
+
+        for (bucket = 0; bucket < INPUT_BUCKETS; bucket++) {
+            guint64 count = priv->input_wire[class][bucket];
+
+            if (count == 0)
+                continue;
+            if (first)
+                g_string_append_printf(stats, "%s to wire:", input_class_names[class]);
+            if (bucket < INPUT_BUCKETS - 1)
+                g_string_append_printf(stats, " <%dms %" G_GUINT64_FORMAT, 1 << bucket, count);
+            else
+                g_string_append_printf(stats, " >%dms %" G_GUINT64_FORMAT, 1 << (bucket - 1), count);
+            first = FALSE;
+        }
+        if (!first)
+            g_string_append_c(stats, '\n');
+    }
+}
+
 gboolean virt_viewer_display_get_fullscreen(VirtViewerDisplay *self)
 {
     g_return_val_if_fail(VIRT_VIEWER_IS_DISPLAY(self), FALSE);
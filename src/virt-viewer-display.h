@@ -87,6 +87,7 @@ struct _VirtViewerDisplayClass {
     void (*display_keyboard_ungrab)(VirtViewerDisplay *display);
 
     void (*display_desktop_resize)(VirtViewerDisplay *display);
+    void (*display_damage)(VirtViewerDisplay *display);
 };
 
 GType virt_viewer_display_get_type(void);
@@ -111,6 +112,14 @@ gboolean virt_viewer_display_get_zoom(VirtViewerDisplay *display);
 void virt_viewer_display_send_keys(VirtViewerDisplay *display,
                                    const guint *keyvals, int nkeyvals);
 GdkPixbuf* virt_viewer_display_get_pixbuf(VirtViewerDisplay *display);
+void virt_viewer_display_save_screenshot_async(VirtViewerDisplay *display,
+                                               const gchar *file,
+                                               const gchar *format,
+                                               GAsyncReadyCallback callback,
+                                               gpointer user_data);
+gboolean virt_viewer_display_save_screenshot_finish(VirtViewerDisplay *display,
+                                                    GAsyncResult *result,
+                                                    GError **error);
 void virt_viewer_display_set_show_hint(VirtViewerDisplay *display, guint mask, gboolean enable);
 guint virt_viewer_display_get_show_hint(VirtViewerDisplay *display);
 VirtViewerSession* virt_viewer_display_get_session(VirtViewerDisplay *display);
@@ -118,6 +127,16 @@ void virt_viewer_display_set_monitor(VirtViewerDisplay *display, gint monitor);
 gint virt_viewer_display_get_monitor(VirtViewerDisplay *display);
 void virt_viewer_display_set_fullscreen(VirtViewerDisplay *display, gboolean fullscreen);
 gboolean virt_viewer_display_get_fullscreen(VirtViewerDisplay *display);
+void virt_viewer_display_set_hidden(VirtViewerDisplay *display, gboolean hidden);
+gboolean virt_viewer_display_get_hidden(VirtViewerDisplay *display);
+void virt_viewer_display_count_frames(VirtViewerDisplay *display, guint received, guint presented);
+void virt_viewer_display_get_frame_counts(VirtViewerDisplay *display,
+                                          guint64 *received,
+                                          guint64 *presented);
+void virt_viewer_display_damage(VirtViewerDisplay *display);
+gint64 virt_viewer_display_get_latency(VirtViewerDisplay *display);
+guint virt_viewer_display_get_input_queue(VirtViewerDisplay *display);
+void virt_viewer_display_get_input_stats(VirtViewerDisplay *display, GString *stats);
 void virt_viewer_display_release_cursor(VirtViewerDisplay *display);
 
 void virt_viewer_display_close(VirtViewerDisplay *display);
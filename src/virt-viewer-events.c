@@ -28,35 +28,111 @@
 #include <stdlib.h>
 #include <glib.h>
 #ifdef G_OS_WIN32
+#include <winsock2.h>
 #include <io.h>
 #endif
 #include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
 
 #include "virt-viewer-events.h"
 
+/*
+ * All libvirt file handles and timers are serviced by a single GSource.
+ * Each handle owns a GPollFD registered once with that source, and
+ * interest changes only rewrite GPollFD.events, so the common
+ * READABLE <-> READABLE|WRITABLE toggle done by the RPC layer does not
+ * allocate or create new GSources. Handles and timers are looked up by
+ * their id in hash tables.
+ *
+ * libvirt may call into the implementation from any thread doing RPC,
+ * so the tables are protected by the "events" lock, which is never held
+ * while running a libvirt callback.
+ */
+
 struct virt_viewer_events_handle
 {
     int watch;
     int fd;
     int events;
-    int enabled;
+    gboolean polled;
+    GPollFD pollfd;
+#ifdef G_OS_WIN32
     GIOChannel *channel;
-    guint source;
+#endif
     virEventHandleCallback cb;
     void *opaque;
     virFreeCallback ff;
 };
 
+struct virt_viewer_events_timeout
+{
+    int timer;
+    int interval;
+    gint64 expiry; /* -1 when disabled */
+    virEventTimeoutCallback cb;
+    void *opaque;
+    virFreeCallback ff;
+};
+
+G_LOCK_DEFINE_STATIC(events);
+
+static GSource *events_source = NULL;
+
 static int nextwatch = 1;
-static unsigned int nhandles = 0;
-static struct virt_viewer_events_handle **handles = NULL;
+static GHashTable *handles = NULL;
 
-static gboolean
-virt_viewer_events_dispatch_handle(GIOChannel *source G_GNUC_UNUSED,
-                                   GIOCondition condition,
-                                   gpointer opaque)
+static int nexttimer = 1;
+static unsigned int nenabledtimeouts = 0;
+static GHashTable *timeouts = NULL;
+
+/* ids collected by check(), dispatched by dispatch() */
+static GArray *ready_handles = NULL;
+static GArray *ready_timeouts = NULL;
+/* emptied id arrays kept for the next dispatch, one pair per nesting level */
+static GPtrArray *spare_ready = NULL;
+
+
+static gint64
+virt_viewer_events_now(GSource *source)
+{
+#if GLIB_CHECK_VERSION(2, 28, 0)
+    return g_source_get_time(source);
+#else
+    GTimeVal tv;
+
+    g_source_get_current_time(source, &tv);
+    return (gint64)tv.tv_sec * G_USEC_PER_SEC + tv.tv_usec;
+#endif
+}
+
+/* changes made from another thread must interrupt a poll() in progress */
+static void
+virt_viewer_events_wakeup(void)
+{
+    GMainContext *context = g_source_get_context(events_source);
+
+    if (!g_main_context_is_owner(context))
+        g_main_context_wakeup(context);
+}
+
+static GIOCondition
+virt_viewer_events_to_condition(int events)
+{
+    GIOCondition cond = 0;
+
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        cond |= G_IO_IN;
+    if (events & VIR_EVENT_HANDLE_WRITABLE)
+        cond |= G_IO_OUT;
+    if (events)
+        cond |= G_IO_HUP | G_IO_ERR;
+
+    return cond;
+}
+
+static int
+virt_viewer_events_from_condition(GIOCondition condition)
 {
-    struct virt_viewer_events_handle *data = opaque;
     int events = 0;
 
     if (condition & G_IO_IN)
@@ -68,13 +144,228 @@ virt_viewer_events_dispatch_handle(GIOChannel *source G_GNUC_UNUSED,
     if (condition & G_IO_ERR)
         events |= VIR_EVENT_HANDLE_ERROR;
 
-    g_debug("Dispatch handler %d %d %p", data->fd, events, data->opaque);
+    return events;
+}
+
+
+static gboolean
+virt_viewer_events_source_prepare(GSource *source,
+                                  gint *timeout)
+{
+    GHashTableIter iter;
+    gpointer value;
+    gint64 now, next = -1;
+
+    *timeout = -1;
+
+    G_LOCK(events);
+    if (nenabledtimeouts == 0) {
+        G_UNLOCK(events);
+        return FALSE;
+    }
+
+    g_hash_table_iter_init(&iter, timeouts);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct virt_viewer_events_timeout *data = value;
 
-    (data->cb)(data->watch, data->fd, events, data->opaque);
+        if (data->expiry < 0)
+            continue;
+        if (next < 0 || data->expiry < next)
+            next = data->expiry;
+    }
+    G_UNLOCK(events);
+
+    if (next < 0)
+        return FALSE;
+
+    now = virt_viewer_events_now(source);
+    if (next <= now) {
+        *timeout = 0;
+        return TRUE;
+    }
+
+    /* round up so we never wake up just before the deadline */
+    *timeout = (gint)MIN((next - now + 999) / 1000, G_MAXINT);
+    return FALSE;
+}
+
+static gboolean
+virt_viewer_events_source_check(GSource *source)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_array_set_size(ready_handles, 0);
+    g_array_set_size(ready_timeouts, 0);
+
+    G_LOCK(events);
+    g_hash_table_iter_init(&iter, handles);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        struct virt_viewer_events_handle *data = value;
+
+        if (!data->polled || !data->pollfd.revents)
+            continue;
+
+#ifdef G_OS_WIN32
+        {
+            WSANETWORKEVENTS ev;
+            GIOCondition cond = 0;
+
+            if (WSAEnumNetworkEvents((SOCKET)_get_osfhandle(data->fd),
+                                     (HANDLE)data->pollfd.fd, &ev) == 0) {
+                if (ev.lNetworkEvents & (FD_READ | FD_ACCEPT))
+                    cond |= G_IO_IN;
+                if (ev.lNetworkEvents & (FD_WRITE | FD_CONNECT))
+                    cond |= G_IO_OUT;
+                if (ev.lNetworkEvents & FD_CLOSE)
+                    cond |= G_IO_HUP;
+            }
+            data->pollfd.revents = cond & data->pollfd.events;
+            if (!data->pollfd.revents)
+                continue;
+        }
+#endif
+
+        g_array_append_val(ready_handles, data->watch);
+    }
+
+    if (nenabledtimeouts > 0) {
+        gint64 now = virt_viewer_events_now(source);
+
+        g_hash_table_iter_init(&iter, timeouts);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            struct virt_viewer_events_timeout *data = value;
+
+            if (data->expiry >= 0 && data->expiry <= now)
+                g_array_append_val(ready_timeouts, data->timer);
+        }
+    }
+    G_UNLOCK(events);
+
+    return ready_handles->len > 0 || ready_timeouts->len > 0;
+}
+
+static GArray *
+virt_viewer_events_take_ready(void)
+{
+    if (spare_ready->len == 0)
+        return g_array_new(FALSE, FALSE, sizeof(int));
+
+    return g_ptr_array_remove_index(spare_ready, spare_ready->len - 1);
+}
+
+static void
+virt_viewer_events_release_ready(GArray *ready)
+{
+    g_array_set_size(ready, 0);
+    g_ptr_array_add(spare_ready, ready);
+}
+
+static gboolean
+virt_viewer_events_source_dispatch(GSource *source,
+                                   GSourceFunc callback G_GNUC_UNUSED,
+                                   gpointer user_data G_GNUC_UNUSED)
+{
+    GArray *hready, *tready;
+    guint i;
+
+    /* callbacks may add, update or remove entries, or even iterate
+     * the main loop again, so work on our own copy of the ready ids
+     * and look each one up again before running it */
+    hready = ready_handles;
+    tready = ready_timeouts;
+    ready_handles = virt_viewer_events_take_ready();
+    ready_timeouts = virt_viewer_events_take_ready();
+
+    for (i = 0 ; i < hready->len ; i++) {
+        int watch = g_array_index(hready, int, i);
+        struct virt_viewer_events_handle *data;
+        virEventHandleCallback cb;
+        void *opaque;
+        int fd, events;
+
+        G_LOCK(events);
+        data = g_hash_table_lookup(handles, GINT_TO_POINTER(watch));
+        if (!data || !data->polled) {
+            G_UNLOCK(events);
+            continue;
+        }
+        events = virt_viewer_events_from_condition(data->pollfd.revents);
+        data->pollfd.revents = 0;
+        cb = data->cb;
+        fd = data->fd;
+        opaque = data->opaque;
+        G_UNLOCK(events);
+
+        if (events)
+            (cb)(watch, fd, events, opaque);
+    }
+
+    for (i = 0 ; i < tready->len ; i++) {
+        int timer = g_array_index(tready, int, i);
+        struct virt_viewer_events_timeout *data;
+        virEventTimeoutCallback cb;
+        void *opaque;
+
+        G_LOCK(events);
+        data = g_hash_table_lookup(timeouts, GINT_TO_POINTER(timer));
+        if (!data || data->expiry < 0) {
+            G_UNLOCK(events);
+            continue;
+        }
+        data->expiry = virt_viewer_events_now(source) +
+            (gint64)data->interval * 1000;
+        cb = data->cb;
+        opaque = data->opaque;
+        G_UNLOCK(events);
+
+        (cb)(timer, opaque);
+    }
+
+    virt_viewer_events_release_ready(hready);
+    virt_viewer_events_release_ready(tready);
 
     return TRUE;
 }
 
+static GSourceFuncs virt_viewer_events_source_funcs = {
+    .prepare = virt_viewer_events_source_prepare,
+    .check = virt_viewer_events_source_check,
+    .dispatch = virt_viewer_events_source_dispatch,
+};
+
+
+static void
+virt_viewer_events_set_interest(struct virt_viewer_events_handle *data,
+                                int events)
+{
+    GIOCondition cond = virt_viewer_events_to_condition(events);
+
+    data->events = events;
+
+    if (!events) {
+        if (data->polled) {
+            g_source_remove_poll(events_source, &data->pollfd);
+            data->polled = FALSE;
+        }
+        data->pollfd.revents = 0;
+        return;
+    }
+
+#ifdef G_OS_WIN32
+    g_io_channel_win32_make_pollfd(data->channel, cond, &data->pollfd);
+#else
+    data->pollfd.events = cond;
+#endif
+
+    if (!data->polled) {
+        g_source_add_poll(events_source, &data->pollfd);
+        data->polled = TRUE;
+    }
+
+    virt_viewer_events_wakeup();
+}
+
 
 static
 int virt_viewer_events_add_handle(int fd,
@@ -84,90 +375,48 @@ int virt_viewer_events_add_handle(int fd,
                                   virFreeCallback ff)
 {
     struct virt_viewer_events_handle *data;
-    GIOCondition cond = 0;
 
-    handles = g_realloc(handles, sizeof(*handles)*(nhandles+1));
-    data = g_malloc(sizeof(*data));
-    memset(data, 0, sizeof(*data));
+    data = g_new0(struct virt_viewer_events_handle, 1);
 
-    if (events & VIR_EVENT_HANDLE_READABLE)
-        cond |= G_IO_IN;
-    if (events & VIR_EVENT_HANDLE_WRITABLE)
-        cond |= G_IO_OUT;
-
-    data->watch = nextwatch++;
     data->fd = fd;
-    data->events = events;
     data->cb = cb;
     data->opaque = opaque;
+    data->ff = ff;
 #ifdef G_OS_WIN32
     g_debug("Converted fd %d to handle %"PRIiPTR, fd, _get_osfhandle(fd));
     data->channel = g_io_channel_win32_new_socket(_get_osfhandle(fd));
 #else
-    data->channel = g_io_channel_unix_new(fd);
+    data->pollfd.fd = fd;
 #endif
-    data->ff = ff;
 
-    g_debug("Add handle %d %d %p", data->fd, events, data->opaque);
+    g_debug("Add handle %d %d %p", fd, events, opaque);
 
-    data->source = g_io_add_watch(data->channel,
-                                  cond,
-                                  virt_viewer_events_dispatch_handle,
-                                  data);
-
-    handles[nhandles++] = data;
+    G_LOCK(events);
+    data->watch = nextwatch++;
+    g_hash_table_insert(handles, GINT_TO_POINTER(data->watch), data);
+    virt_viewer_events_set_interest(data, events);
+    G_UNLOCK(events);
 
     return data->watch;
 }
 
-static struct virt_viewer_events_handle *
-virt_viewer_events_find_handle(int watch)
-{
-    unsigned int i;
-    for (i = 0 ; i < nhandles ; i++)
-        if (handles[i]->watch == watch)
-            return handles[i];
-
-    return NULL;
-}
-
 static void
 virt_viewer_events_update_handle(int watch,
                                  int events)
 {
-    struct virt_viewer_events_handle *data = virt_viewer_events_find_handle(watch);
+    struct virt_viewer_events_handle *data;
 
+    G_LOCK(events);
+    data = g_hash_table_lookup(handles, GINT_TO_POINTER(watch));
     if (!data) {
+        G_UNLOCK(events);
         g_debug("Update for missing handle watch %d", watch);
         return;
     }
 
-    if (events) {
-        GIOCondition cond = 0;
-        if (events == data->events)
-            return;
-
-        if (data->source)
-            g_source_remove(data->source);
-
-        cond |= G_IO_HUP;
-        if (events & VIR_EVENT_HANDLE_READABLE)
-            cond |= G_IO_IN;
-        if (events & VIR_EVENT_HANDLE_WRITABLE)
-            cond |= G_IO_OUT;
-        data->source = g_io_add_watch(data->channel,
-                                      cond,
-                                      virt_viewer_events_dispatch_handle,
-                                      data);
-        data->events = events;
-    } else {
-        if (!data->source)
-            return;
-
-        g_source_remove(data->source);
-        data->source = 0;
-        data->events = 0;
-    }
+    if (events != data->events)
+        virt_viewer_events_set_interest(data, events);
+    G_UNLOCK(events);
 }
 
 
@@ -182,7 +431,10 @@ virt_viewer_events_cleanup_handle(gpointer user_data)
     if (data->ff)
         (data->ff)(data->opaque);
 
-    free(data);
+#ifdef G_OS_WIN32
+    g_io_channel_unref(data->channel);
+#endif
+    g_free(data);
     return FALSE;
 }
 
@@ -190,49 +442,48 @@ virt_viewer_events_cleanup_handle(gpointer user_data)
 static int
 virt_viewer_events_remove_handle(int watch)
 {
-    struct virt_viewer_events_handle *data = virt_viewer_events_find_handle(watch);
+    struct virt_viewer_events_handle *data;
 
+    G_LOCK(events);
+    data = g_hash_table_lookup(handles, GINT_TO_POINTER(watch));
     if (!data) {
+        G_UNLOCK(events);
         g_debug("Remove of missing watch %d", watch);
         return -1;
     }
 
-    g_debug("Remove handle %d %d", watch, data->fd);
-
-    if (!data->source)
-        return -1;
+    virt_viewer_events_set_interest(data, 0);
+    g_hash_table_remove(handles, GINT_TO_POINTER(watch));
+    G_UNLOCK(events);
 
-    g_source_remove(data->source);
-    data->source = 0;
-    data->events = 0;
+    g_debug("Remove handle %d %d", watch, data->fd);
 
+    /* libvirt requires the free callback to run outside of the
+     * remove call, since it may hold locks the callback needs */
     g_idle_add(virt_viewer_events_cleanup_handle, data);
     return 0;
 }
 
-struct virt_viewer_events_timeout
-{
-    int timer;
-    int interval;
-    guint source;
-    virEventTimeoutCallback cb;
-    void *opaque;
-    virFreeCallback ff;
-};
-
 
-static int nexttimer = 1;
-static unsigned int ntimeouts = 0;
-static struct virt_viewer_events_timeout **timeouts = NULL;
-
-static gboolean
-virt_viewer_events_dispatch_timeout(void *opaque)
+static void
+virt_viewer_events_set_interval(struct virt_viewer_events_timeout *data,
+                                int interval)
 {
-    struct virt_viewer_events_timeout *data = opaque;
-    g_debug("Dispatch timeout %p %p %d %p", data, data->cb, data->timer, data->opaque);
-    (data->cb)(data->timer, data->opaque);
+    gboolean was_enabled = data->expiry >= 0;
 
-    return TRUE;
+    data->interval = interval;
+    if (interval >= 0) {
+        data->expiry = virt_viewer_events_now(events_source) +
+            (gint64)interval * 1000;
+        if (!was_enabled)
+            nenabledtimeouts++;
+    } else {
+        data->expiry = -1;
+        if (was_enabled)
+            nenabledtimeouts--;
+    }
+
+    virt_viewer_events_wakeup();
 }
 
 static int
@@ -243,21 +494,18 @@ virt_viewer_events_add_timeout(int interval,
 {
     struct virt_viewer_events_timeout *data;
 
-    timeouts = g_realloc(timeouts, sizeof(*timeouts)*(ntimeouts+1));
-    data = g_malloc(sizeof(*data));
-    memset(data, 0, sizeof(*data));
+    data = g_new0(struct virt_viewer_events_timeout, 1);
 
-    data->timer = nexttimer++;
-    data->interval = interval;
+    data->expiry = -1;
     data->cb = cb;
     data->opaque = opaque;
     data->ff = ff;
-    if (interval >= 0)
-        data->source = g_timeout_add(interval,
-                                     virt_viewer_events_dispatch_timeout,
-                                     data);
 
-    timeouts[ntimeouts++] = data;
+    G_LOCK(events);
+    data->timer = nexttimer++;
+    g_hash_table_insert(timeouts, GINT_TO_POINTER(data->timer), data);
+    virt_viewer_events_set_interval(data, interval);
+    G_UNLOCK(events);
 
     g_debug("Add timeout %p %d %p %p %d", data, interval, cb, opaque, data->timer);
 
@@ -265,46 +513,25 @@ virt_viewer_events_add_timeout(int interval,
 }
 
 
-static struct virt_viewer_events_timeout *
-virt_viewer_events_find_timeout(int timer)
-{
-    unsigned int i;
-    for (i = 0 ; i < ntimeouts ; i++)
-        if (timeouts[i]->timer == timer)
-            return timeouts[i];
-
-    return NULL;
-}
-
-
 static void
 virt_viewer_events_update_timeout(int timer,
                                   int interval)
 {
-    struct virt_viewer_events_timeout *data = virt_viewer_events_find_timeout(timer);
+    struct virt_viewer_events_timeout *data;
 
+    G_LOCK(events);
+    data = g_hash_table_lookup(timeouts, GINT_TO_POINTER(timer));
     if (!data) {
+        G_UNLOCK(events);
         g_debug("Update of missing timer %d", timer);
         return;
     }
 
-    g_debug("Update timeout %p %d %d", data, timer, interval);
-
-    if (interval >= 0) {
-        if (data->source)
-            return;
-
-        data->interval = interval;
-        data->source = g_timeout_add(data->interval,
-                                     virt_viewer_events_dispatch_timeout,
-                                     data);
-    } else {
-        if (!data->source)
-            return;
-
-        g_source_remove(data->source);
-        data->source = 0;
-    }
+    /* an already armed timer keeps its current deadline, like the
+     * g_timeout_add() based implementation this replaces */
+    if ((interval >= 0) != (data->expiry >= 0))
+        virt_viewer_events_set_interval(data, interval);
+    G_UNLOCK(events);
 }
 
 
@@ -319,7 +546,7 @@ virt_viewer_events_cleanup_timeout(gpointer user_data)
     if (data->ff)
         (data->ff)(data->opaque);
 
-    free(data);
+    g_free(data);
     return FALSE;
 }
 
@@ -327,27 +554,178 @@ virt_viewer_events_cleanup_timeout(gpointer user_data)
 static int
 virt_viewer_events_remove_timeout(int timer)
 {
-    struct virt_viewer_events_timeout *data = virt_viewer_events_find_timeout(timer);
+    struct virt_viewer_events_timeout *data;
 
+    G_LOCK(events);
+    data = g_hash_table_lookup(timeouts, GINT_TO_POINTER(timer));
     if (!data) {
+        G_UNLOCK(events);
         g_debug("Remove of missing timer %d", timer);
         return -1;
     }
 
-    g_debug("Remove timeout %p %d", data, timer);
-
-    if (!data->source)
-        return -1;
+    virt_viewer_events_set_interval(data, -1);
+    g_hash_table_remove(timeouts, GINT_TO_POINTER(timer));
+    G_UNLOCK(events);
 
-    g_source_remove(data->source);
-    data->source = 0;
+    g_debug("Remove timeout %p %d", data, timer);
 
     g_idle_add(virt_viewer_events_cleanup_timeout, data);
     return 0;
 }
 
 
+/*
+ * Work done on other threads (libvirt callbacks, RPC workers) that must
+ * happen on the GTK thread is posted to main_calls and drained from an
+ * idle callback. In threaded mode libvirt's default event loop
+ * implementation also runs on a dedicated thread.
+ */
+typedef struct {
+    GSourceFunc func;
+    gpointer data;
+    GAsyncQueue *reply; /* NULL for asynchronous calls */
+} VirtViewerEventsCall;
+
+static GThread *main_thread = NULL;
+static GAsyncQueue *main_calls = NULL;
+static gint main_calls_scheduled = 0;
+
+static void
+virt_viewer_events_init_main_calls(void)
+{
+    if (main_calls)
+        return;
+
+    main_thread = g_thread_self();
+    main_calls = g_async_queue_new();
+}
+
+static gboolean
+virt_viewer_events_drain_main_calls(gpointer user_data G_GNUC_UNUSED)
+{
+    VirtViewerEventsCall *call;
+
+    /* reset first: a push racing with the loop below either gets
+     * popped here or schedules a new drain */
+    g_atomic_int_set(&main_calls_scheduled, 0);
+
+    while ((call = g_async_queue_try_pop(main_calls)) != NULL) {
+        (call->func)(call->data);
+        if (call->reply)
+            g_async_queue_push(call->reply, call);
+        else
+            g_free(call);
+    }
+
+    return FALSE;
+}
+
+static void
+virt_viewer_events_push_main_call(VirtViewerEventsCall *call)
+{
+    g_async_queue_push(main_calls, call);
+    if (g_atomic_int_compare_and_exchange(&main_calls_scheduled, 0, 1))
+        g_idle_add(virt_viewer_events_drain_main_calls, NULL);
+}
+
+static gboolean
+virt_viewer_events_is_main_thread(void)
+{
+    return main_thread == NULL || main_thread == g_thread_self();
+}
+
+void
+virt_viewer_events_call_main(GSourceFunc func, gpointer data)
+{
+    VirtViewerEventsCall *call;
+
+    if (virt_viewer_events_is_main_thread()) {
+        func(data);
+        return;
+    }
+
+    call = g_new0(VirtViewerEventsCall, 1);
+    call->func = func;
+    call->data = data;
+    virt_viewer_events_push_main_call(call);
+}
+
+void
+virt_viewer_events_call_main_sync(GSourceFunc func, gpointer data)
+{
+    VirtViewerEventsCall call = { func, data, NULL };
+
+    if (virt_viewer_events_is_main_thread()) {
+        func(data);
+        return;
+    }
+
+    call.reply = g_async_queue_new();
+    virt_viewer_events_push_main_call(&call);
+    g_async_queue_pop(call.reply);
+    g_async_queue_unref(call.reply);
+}
+
+static gpointer
+virt_viewer_events_thread(gpointer user_data G_GNUC_UNUSED)
+{
+    for (;;) {
+        if (virEventRunDefaultImpl() < 0) {
+            virErrorPtr err = virGetLastError();
+            g_warning("libvirt event loop failed: %s",
+                      err && err->message ? err->message : "unknown error");
+        }
+    }
+
+    return NULL;
+}
+
+gboolean
+virt_viewer_events_register_thread(GError **error)
+{
+    GThread *thread;
+
+    if (virEventRegisterDefaultImpl() < 0) {
+        virErrorPtr err = virGetLastError();
+        g_set_error_literal(error, VIRT_VIEWER_ERROR, VIRT_VIEWER_ERROR_FAILED,
+                            err && err->message ? err->message : "unknown libvirt error");
+        return FALSE;
+    }
+
+    virt_viewer_events_init_main_calls();
+
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    thread = g_thread_try_new("libvirt-events", virt_viewer_events_thread, NULL, error);
+    if (thread)
+        g_thread_unref(thread);
+#else
+    thread = g_thread_create(virt_viewer_events_thread, NULL, FALSE, error);
+#endif
+    if (!thread)
+        return FALSE;
+
+    return TRUE;
+}
+
 void virt_viewer_events_register(void) {
+    virt_viewer_events_init_main_calls();
+
+    if (events_source == NULL) {
+        handles = g_hash_table_new(g_direct_hash, g_direct_equal);
+        timeouts = g_hash_table_new(g_direct_hash, g_direct_equal);
+        ready_handles = g_array_new(FALSE, FALSE, sizeof(int));
+        ready_timeouts = g_array_new(FALSE, FALSE, sizeof(int));
+        spare_ready = g_ptr_array_new();
+
+        events_source = g_source_new(&virt_viewer_events_source_funcs,
+                                     sizeof(GSource));
+        /* libvirt callbacks may spin a nested main loop (auth dialogs,
+         * error dialogs), other handles must keep being serviced then */
+        g_source_set_can_recurse(events_source, TRUE);
+        g_source_attach(events_source, NULL);
+    }
+
     virEventRegisterImpl(virt_viewer_events_add_handle,
                          virt_viewer_events_update_handle,
                          virt_viewer_events_remove_handle,
@@ -27,6 +27,10 @@
 
 void virt_viewer_events_register(void);
 
+gboolean virt_viewer_events_register_thread(GError **error);
+void virt_viewer_events_call_main(GSourceFunc func, gpointer data);
+void virt_viewer_events_call_main_sync(GSourceFunc func, gpointer data);
+
 #endif
 /*
  * Local variables:
@@ -106,6 +106,18 @@ gchar** virt_viewer_file_get_secure_channels(VirtViewerFile* self, gsize* length
 void virt_viewer_file_set_secure_channels(VirtViewerFile* self, const gchar* const* value, gsize length);
 gint virt_viewer_file_get_delete_this_file(VirtViewerFile* self);
 void virt_viewer_file_set_delete_this_file(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_max_fps(VirtViewerFile* self);
+void virt_viewer_file_set_max_fps(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_adaptive_quality(VirtViewerFile* self);
+void virt_viewer_file_set_adaptive_quality(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_quality_rtt_high(VirtViewerFile* self);
+void virt_viewer_file_set_quality_rtt_high(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_quality_rtt_low(VirtViewerFile* self);
+void virt_viewer_file_set_quality_rtt_low(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_quality_bandwidth_max(VirtViewerFile* self);
+void virt_viewer_file_set_quality_bandwidth_max(VirtViewerFile* self, gint value);
+gint virt_viewer_file_get_mouse_latency_threshold(VirtViewerFile* self);
+void virt_viewer_file_set_mouse_latency_threshold(VirtViewerFile* self, gint value);
 gchar* virt_viewer_file_get_secure_attention(VirtViewerFile* self);
 void virt_viewer_file_set_secure_attention(VirtViewerFile* self, const gchar* value);
 gchar* virt_viewer_file_get_ovirt_host(VirtViewerFile* self);
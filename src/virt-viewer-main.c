@@ -52,6 +52,7 @@ int main(int argc, char **argv)
     gboolean attach = FALSE;
     gboolean waitvm = FALSE;
     gboolean reconnect = FALSE;
+    gboolean libvirt_thread = FALSE;
     VirtViewer *viewer = NULL;
     char *base_name;
     char *help_msg = NULL;
@@ -68,6 +69,8 @@ int main(int argc, char **argv)
           N_("Wait for domain to start"), NULL },
         { "reconnect", 'r', 0, G_OPTION_ARG_NONE, &reconnect,
           N_("Reconnect to domain upon restart"), NULL },
+        { "libvirt-thread", '\0', 0, G_OPTION_ARG_NONE, &libvirt_thread,
+          N_("Run libvirt calls and events in a separate thread"), NULL },
         { G_OPTION_REMAINING, '\0', 0, G_OPTION_ARG_STRING_ARRAY, &args,
           NULL, "-- DOMAIN-NAME|ID|UUID" },
         { NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL }
@@ -113,6 +116,8 @@ int main(int argc, char **argv)
     if (viewer == NULL)
         goto cleanup;
 
+    g_object_set(viewer, "libvirt-thread", libvirt_thread, NULL);
+
     if (!virt_viewer_app_start(VIRT_VIEWER_APP(viewer)))
         goto cleanup;
 
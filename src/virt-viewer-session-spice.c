@@ -31,6 +31,12 @@
 #include <spice-util.h>
 #include <spice-client.h>
 
+#ifdef __linux__
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
 #include <usb-device-widget.h>
 #include "virt-viewer-file.h"
 #include "virt-viewer-util.h"
@@ -62,8 +68,90 @@ struct _VirtViewerSessionSpicePrivate {
     gboolean has_sw_smartcard_reader;
     guint pass_try;
     gboolean did_auto_conf;
+
+    /* In-place resume after the connection dropped */
+    guint resume_id;
+    guint resume_attempts;
+    gint64 blackout_start;
+    GHashTable *parked_displays; /* display channel id -> GPtrArray */
+
+    /* see virt_viewer_session_spice_get_stats */
+    GHashTable *stats_bytes; /* "type id" -> total-read-bytes */
+    gint64 stats_time;
+
+    /* adaptive quality, see virt_viewer_session_spice_adapt_quality */
+    gboolean quality_adaptive;
+    gint quality_rtt_high; /* ms */
+    gint quality_rtt_low;
+    gint quality_bandwidth_max; /* kB/s, 0 for no limit */
+    guint quality_id;
+    gint quality_level; /* QualityLevel */
+    guint quality_pressure; /* consecutive samples above the high thresholds */
+    guint quality_relaxed; /* and below the low ones */
+    gint64 quality_time;
+    guint64 quality_bytes;
+    gint full_color_depth; /* settings restored at QUALITY_FULL */
+    gchar **full_disable_effects;
+    gint full_compression; /* SPICE_IMAGE_COMPRESSION_INVALID if not configured */
+
+    /* automatic mouse mode, see virt_viewer_session_spice_check_mouse */
+    gint mouse_threshold; /* ms, 0 to leave the mode alone */
+    guint mouse_id;
+    guint mouse_high; /* consecutive samples above the threshold */
+    guint mouse_low; /* and below half of it */
+    gboolean mouse_switched; /* client mode was requested for latency */
+    gint64 pointer_sent; /* motion waiting for its cursor update, 0 if none */
+    gint64 pointer_time; /* of the last latency sample */
+    gint64 pointer_latency; /* smoothed, in microseconds */
+    gint64 pointer_total; /* since the last report */
+    gint64 pointer_max;
+    guint pointer_samples;
 };
 
+/* Backoff bounds for resuming a dropped session, in milliseconds */
+#define RESUME_DELAY_MIN 100
+#define RESUME_DELAY_MAX 5000
+#define RESUME_MAX_ATTEMPTS 10
+
+/*
+ * Adaptive quality levels. The link is sampled every QUALITY_INTERVAL
+ * seconds: quality drops one level after QUALITY_DEGRADE_SAMPLES samples
+ * in a row above quality-rtt-high or quality-bandwidth-max, and goes back
+ * up one level after QUALITY_RESTORE_SAMPLES samples below quality-rtt-low
+ * and half of quality-bandwidth-max. The gap between the thresholds and
+ * the longer wait before restoring keep it from oscillating.
+ */
+typedef enum {
+    QUALITY_FULL,    /* as configured */
+    QUALITY_REDUCED, /* dictionary and lossy compression, no desktop effects
+                      * from the next connection on */
+    QUALITY_LOW,     /* same, with 16-bit colors */
+} QualityLevel;
+
+static const gchar *quality_names[] = { "full", "reduced", "low" };
+
+#define QUALITY_INTERVAL 2
+#define QUALITY_DEGRADE_SAMPLES 2
+#define QUALITY_RESTORE_SAMPLES 5
+#define QUALITY_RTT_HIGH 150
+#define QUALITY_RTT_LOW 60
+
+/*
+ * Automatic mouse mode. Input latency is the delay between a pointer
+ * motion and the cursor update the guest sends back in server mode, or
+ * the round-trip time when there is no recent sample, as in client mode.
+ * After MOUSE_SWITCH_SAMPLES samples in a row above mouse-latency-threshold
+ * the session moves to client mode, where the cursor is drawn locally, if
+ * the agent is there. It goes back to server mode after
+ * MOUSE_RESTORE_SAMPLES samples below half of the threshold. Off unless a
+ * threshold is given, like adaptive quality.
+ */
+#define MOUSE_INTERVAL 2
+#define MOUSE_SWITCH_SAMPLES 2
+#define MOUSE_RESTORE_SAMPLES 5
+#define POINTER_TIMEOUT G_USEC_PER_SEC /* motion the guest never answered */
+#define POINTER_SAMPLE_AGE (10 * G_USEC_PER_SEC)
+
 #define VIRT_VIEWER_SESSION_SPICE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE((o), VIRT_VIEWER_TYPE_SESSION_SPICE, VirtViewerSessionSpicePrivate))
 
 enum {
@@ -88,7 +176,12 @@ static void virt_viewer_session_spice_channel_destroy(SpiceSession *s,
 static void virt_viewer_session_spice_smartcard_insert(VirtViewerSession *session);
 static void virt_viewer_session_spice_smartcard_remove(VirtViewerSession *session);
 static gboolean virt_viewer_session_spice_fullscreen_auto_conf(VirtViewerSessionSpice *self);
+static void virt_viewer_session_spice_provisional_auto_conf(VirtViewerSessionSpice *self);
+static void virt_viewer_session_spice_cancel_resume(VirtViewerSessionSpice *self);
+static void virt_viewer_session_spice_schedule_resume(VirtViewerSessionSpice *self);
 static void virt_viewer_session_spice_apply_monitor_geometry(VirtViewerSession *self, GdkRectangle *monitors, guint nmonitors);
+static void virt_viewer_session_spice_stop_quality(VirtViewerSessionSpice *self);
+static void virt_viewer_session_spice_stop_mouse(VirtViewerSessionSpice *self);
 
 static void
 virt_viewer_session_spice_get_property(GObject *object, guint property_id,
@@ -124,6 +217,17 @@ virt_viewer_session_spice_dispose(GObject *obj)
 {
     VirtViewerSessionSpice *spice = VIRT_VIEWER_SESSION_SPICE(obj);
 
+    if (spice->priv->parked_displays) {
+        virt_viewer_session_spice_cancel_resume(spice);
+        g_hash_table_unref(spice->priv->parked_displays);
+        spice->priv->parked_displays = NULL;
+    }
+    g_clear_pointer(&spice->priv->stats_bytes, g_hash_table_unref);
+    virt_viewer_session_spice_stop_quality(spice);
+    virt_viewer_session_spice_stop_mouse(spice);
+    g_strfreev(spice->priv->full_disable_effects);
+    spice->priv->full_disable_effects = NULL;
+
     if (spice->priv->session) {
         spice_session_disconnect(spice->priv->session);
         g_object_unref(spice->priv->session);
@@ -145,6 +249,432 @@ virt_viewer_session_spice_mime_type(VirtViewerSession *self G_GNUC_UNUSED)
     return "application/x-spice";
 }
 
+/*
+ * Round-trip time of the main channel connection in microseconds, from
+ * the kernel TCP statistics; 0 if unknown: not on Linux, not over TCP,
+ * or a spice-gtk without the "socket" channel property.
+ */
+static guint
+virt_viewer_session_spice_get_rtt(VirtViewerSessionSpice *self)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+    GSocket *socket = NULL;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    guint rtt = 0;
+
+    if (self->priv->main_channel == NULL ||
+        g_object_class_find_property(G_OBJECT_GET_CLASS(self->priv->main_channel), "socket") == NULL)
+        return 0;
+
+    g_object_get(self->priv->main_channel, "socket", &socket, NULL);
+    if (socket == NULL)
+        return 0;
+
+    if (getsockopt(g_socket_get_fd(socket), IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+        rtt = info.tcpi_rtt;
+    g_object_unref(socket);
+
+    return rtt;
+#else
+    return 0;
+#endif
+}
+
+static gint
+surface_format_bpp(gint format)
+{
+    switch (format) {
+    case SPICE_SURFACE_FMT_1_A:
+        return 1;
+    case SPICE_SURFACE_FMT_8_A:
+        return 8;
+    case SPICE_SURFACE_FMT_16_555:
+    case SPICE_SURFACE_FMT_16_565:
+        return 16;
+    default:
+        return 32;
+    }
+}
+
+static void
+virt_viewer_session_spice_get_stats(VirtViewerSession *session, GString *stats)
+{
+    VirtViewerSessionSpice *self = VIRT_VIEWER_SESSION_SPICE(session);
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time();
+    gdouble elapsed = (now - priv->stats_time) / (gdouble)G_USEC_PER_SEC;
+    GList *channels, *l;
+    guint rtt;
+
+    if (priv->session == NULL)
+        return;
+
+    channels = spice_session_get_channels(priv->session);
+    for (l = channels; l != NULL; l = l->next) {
+        SpiceChannel *channel = l->data;
+        SpiceDisplayPrimary primary;
+        gint type, id;
+        gulong bytes;
+        gpointer last;
+        gchar *key;
+
+        g_object_get(channel,
+                     "channel-type", &type,
+                     "channel-id", &id,
+                     "total-read-bytes", &bytes,
+                     NULL);
+        key = g_strdup_printf("%s %d", spice_channel_type_to_string(type), id);
+
+        /* a channel reconnected since the last call starts from 0 again */
+        if (priv->stats_time != 0 && elapsed > 0 &&
+            g_hash_table_lookup_extended(priv->stats_bytes, key, NULL, &last) &&
+            bytes >= GPOINTER_TO_SIZE(last))
+            g_string_append_printf(stats, "%s: %.1f kB/s\n", key,
+                                   (bytes - GPOINTER_TO_SIZE(last)) / 1024.0 / elapsed);
+
+        if (SPICE_IS_DISPLAY_CHANNEL(channel) &&
+            spice_display_get_primary(channel, 0, &primary))
+            g_string_append_printf(stats, "%s: %dx%d, %d bpp\n", key,
+                                   primary.width, primary.height,
+                                   surface_format_bpp(primary.format));
+
+        g_hash_table_replace(priv->stats_bytes, key, GSIZE_TO_POINTER(bytes));
+    }
+    g_list_free(channels);
+    priv->stats_time = now;
+
+    rtt = virt_viewer_session_spice_get_rtt(self);
+    if (rtt != 0)
+        g_string_append_printf(stats, "rtt: %.1f ms\n", rtt / 1000.0);
+    else
+        g_string_append(stats, "rtt: n/a\n");
+
+    if (priv->main_channel != NULL) {
+        gint mouse_mode;
+
+        g_object_get(priv->main_channel, "mouse-mode", &mouse_mode, NULL);
+        g_string_append_printf(stats, "mouse: %s\n",
+                               mouse_mode == SPICE_MOUSE_MODE_CLIENT ? "client" : "server");
+    }
+
+    if (priv->pointer_time != 0 && now - priv->pointer_time < POINTER_SAMPLE_AGE)
+        g_string_append_printf(stats, "pointer: %.1f ms\n", priv->pointer_latency / 1000.0);
+    else
+        g_string_append(stats, "pointer: n/a\n");
+
+    if (priv->quality_adaptive)
+        g_string_append_printf(stats, "quality: %s\n", quality_names[priv->quality_level]);
+}
+
+static void
+virt_viewer_session_spice_set_quality(VirtViewerSessionSpice *self, gint level)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    static const gchar *effects[] = { "wallpaper", "font-smooth", "animation", NULL };
+    gint depth = priv->full_color_depth;
+    gint old_depth;
+#if SPICE_GTK_CHECK_VERSION(0, 31, 0)
+    GList *channels, *l;
+    gint compression;
+#endif
+
+    priv->quality_level = level;
+    if (level >= QUALITY_LOW && (depth == 0 || depth > 16))
+        depth = 16;
+
+    /* spice-gtk only hands the effects to the agent when it starts, so
+     * they apply once the session resumes or reconnects */
+    g_object_get(priv->session, "color-depth", &old_depth, NULL);
+    g_object_set(priv->session,
+                 "color-depth", depth,
+                 "disable-effects",
+                 level >= QUALITY_REDUCED ? (gchar **)effects : priv->full_disable_effects,
+                 NULL);
+
+    /* the guest agent gets the depth along with the monitor layout */
+    if (depth != old_depth && priv->main_channel != NULL) {
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(priv->main_channel), "color-depth"))
+            g_object_set(priv->main_channel, "color-depth", depth, NULL);
+        spice_main_send_monitor_config(priv->main_channel);
+    }
+
+#if SPICE_GTK_CHECK_VERSION(0, 31, 0)
+    /* GLZ shares a dictionary across images, and the automatic modes let
+     * the server fall back to lossy JPEG for photographic content. Without
+     * a configured compression, QUALITY_FULL keeps AUTO_GLZ, the QEMU
+     * default: there is no message to go back to the server setting. */
+    compression = level >= QUALITY_REDUCED ?
+        SPICE_IMAGE_COMPRESSION_AUTO_GLZ : priv->full_compression;
+    if (compression == SPICE_IMAGE_COMPRESSION_INVALID)
+        return;
+
+    channels = spice_session_get_channels(priv->session);
+    for (l = channels; l != NULL; l = l->next) {
+        if (!SPICE_IS_DISPLAY_CHANNEL(l->data))
+            continue;
+        spice_display_change_preferred_compression(SPICE_CHANNEL(l->data), compression);
+    }
+    g_list_free(channels);
+#endif
+}
+
+static gboolean
+virt_viewer_session_spice_adapt_quality(gpointer opaque)
+{
+    VirtViewerSessionSpice *self = opaque;
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time();
+    guint64 bytes = 0;
+    gdouble rate = 0;
+    guint rtt = virt_viewer_session_spice_get_rtt(self) / 1000;
+    gboolean pressure, relaxed;
+    GList *channels, *l;
+    gint level = priv->quality_level;
+
+    channels = spice_session_get_channels(priv->session);
+    for (l = channels; l != NULL; l = l->next) {
+        gulong channel_bytes;
+
+        g_object_get(l->data, "total-read-bytes", &channel_bytes, NULL);
+        bytes += channel_bytes;
+    }
+    g_list_free(channels);
+
+    if (priv->quality_time != 0 && bytes >= priv->quality_bytes)
+        rate = (bytes - priv->quality_bytes) / 1024.0 /
+            ((now - priv->quality_time) / (gdouble)G_USEC_PER_SEC);
+    priv->quality_time = now;
+    priv->quality_bytes = bytes;
+
+    pressure = (rtt != 0 && rtt > priv->quality_rtt_high) ||
+        (priv->quality_bandwidth_max > 0 && rate > priv->quality_bandwidth_max);
+    relaxed = (rtt == 0 || rtt < priv->quality_rtt_low) &&
+        (priv->quality_bandwidth_max == 0 || rate < priv->quality_bandwidth_max / 2);
+
+    priv->quality_pressure = pressure ? priv->quality_pressure + 1 : 0;
+    priv->quality_relaxed = relaxed ? priv->quality_relaxed + 1 : 0;
+
+    if (priv->quality_pressure >= QUALITY_DEGRADE_SAMPLES && level < QUALITY_LOW)
+        level++;
+    else if (priv->quality_relaxed >= QUALITY_RESTORE_SAMPLES && level > QUALITY_FULL)
+        level--;
+    else
+        return TRUE;
+
+    g_message("adaptive quality: %s -> %s (rtt %u ms, %.1f kB/s)",
+              quality_names[priv->quality_level], quality_names[level], rtt, rate);
+    priv->quality_pressure = 0;
+    priv->quality_relaxed = 0;
+    virt_viewer_session_spice_set_quality(self, level);
+
+    return TRUE;
+}
+
+static void
+virt_viewer_session_spice_start_quality(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+
+    virt_viewer_session_spice_stop_quality(self);
+    if (!priv->quality_adaptive)
+        return;
+
+    /* a resumed session keeps its level, and what full quality was */
+    if (priv->quality_level == QUALITY_FULL) {
+        g_strfreev(priv->full_disable_effects);
+        g_object_get(priv->session,
+                     "color-depth", &priv->full_color_depth,
+                     "disable-effects", &priv->full_disable_effects,
+                     NULL);
+#if SPICE_GTK_CHECK_VERSION(0, 31, 0)
+        priv->full_compression = SPICE_IMAGE_COMPRESSION_INVALID;
+        if (g_object_class_find_property(G_OBJECT_GET_CLASS(priv->session), "preferred-compression"))
+            g_object_get(priv->session, "preferred-compression", &priv->full_compression, NULL);
+#endif
+    }
+    priv->quality_time = 0;
+    priv->quality_pressure = 0;
+    priv->quality_relaxed = 0;
+    priv->quality_id = g_timeout_add_seconds(QUALITY_INTERVAL,
+                                             virt_viewer_session_spice_adapt_quality, self);
+}
+
+static void
+virt_viewer_session_spice_stop_quality(VirtViewerSessionSpice *self)
+{
+    if (self->priv->quality_id != 0) {
+        g_source_remove(self->priv->quality_id);
+        self->priv->quality_id = 0;
+    }
+}
+
+static void
+virt_viewer_session_spice_quality_from_file(VirtViewerSessionSpice *self,
+                                            VirtViewerFile *file)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+
+    if (virt_viewer_file_is_set(file, "adaptive-quality"))
+        priv->quality_adaptive = virt_viewer_file_get_adaptive_quality(file);
+    if (virt_viewer_file_is_set(file, "quality-rtt-high"))
+        priv->quality_rtt_high = virt_viewer_file_get_quality_rtt_high(file);
+    if (virt_viewer_file_is_set(file, "quality-rtt-low"))
+        priv->quality_rtt_low = virt_viewer_file_get_quality_rtt_low(file);
+    if (virt_viewer_file_is_set(file, "quality-bandwidth-max"))
+        priv->quality_bandwidth_max = virt_viewer_file_get_quality_bandwidth_max(file);
+
+    if (priv->quality_rtt_low > priv->quality_rtt_high) {
+        g_warning("quality-rtt-low is above quality-rtt-high, using %d ms for both",
+                  priv->quality_rtt_high);
+        priv->quality_rtt_low = priv->quality_rtt_high;
+    }
+}
+
+/*
+ * Called by the displays for each pointer motion sent to the guest. Only
+ * the first motion is timed until the guest answers, the ones in between
+ * would be measured against the answer to the first.
+ */
+void
+virt_viewer_session_spice_pointer_moved(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time();
+    gint mode;
+
+    if (priv->mouse_id == 0 || priv->main_channel == NULL)
+        return;
+
+    /* in client mode the guest does not send the cursor position back */
+    g_object_get(priv->main_channel, "mouse-mode", &mode, NULL);
+    if (mode != SPICE_MOUSE_MODE_SERVER)
+        return;
+
+    if (priv->pointer_sent == 0 || now - priv->pointer_sent > POINTER_TIMEOUT)
+        priv->pointer_sent = now;
+}
+
+static void
+virt_viewer_session_spice_cursor_moved(SpiceCursorChannel *channel G_GNUC_UNUSED,
+                                       gint x G_GNUC_UNUSED,
+                                       gint y G_GNUC_UNUSED,
+                                       VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time();
+    gint64 latency;
+
+    if (priv->pointer_sent == 0)
+        return;
+
+    latency = now - priv->pointer_sent;
+    priv->pointer_sent = 0;
+    if (latency > POINTER_TIMEOUT)
+        return;
+
+    priv->pointer_latency = priv->pointer_time == 0 ? latency :
+        (priv->pointer_latency * 7 + latency) / 8;
+    priv->pointer_time = now;
+    priv->pointer_total += latency;
+    priv->pointer_max = MAX(priv->pointer_max, latency);
+    priv->pointer_samples++;
+}
+
+static gboolean
+virt_viewer_session_spice_check_mouse(gpointer opaque)
+{
+    VirtViewerSessionSpice *self = opaque;
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    gint64 now = g_get_monotonic_time();
+    gboolean agent;
+    guint latency;
+    gint mode;
+
+    if (priv->pointer_samples != 0) {
+        g_debug("pointer to cursor latency: %u samples, avg %.1f ms, max %.1f ms",
+                priv->pointer_samples,
+                priv->pointer_total / 1000.0 / priv->pointer_samples,
+                priv->pointer_max / 1000.0);
+        priv->pointer_samples = 0;
+        priv->pointer_total = 0;
+        priv->pointer_max = 0;
+    }
+
+    if (priv->mouse_threshold == 0 || priv->main_channel == NULL)
+        return TRUE;
+
+    if (priv->pointer_time != 0 && now - priv->pointer_time < POINTER_SAMPLE_AGE)
+        latency = priv->pointer_latency / 1000;
+    else
+        latency = virt_viewer_session_spice_get_rtt(self) / 1000;
+    if (latency == 0)
+        return TRUE;
+
+    priv->mouse_high = latency > priv->mouse_threshold ? priv->mouse_high + 1 : 0;
+    priv->mouse_low = latency < priv->mouse_threshold / 2 ? priv->mouse_low + 1 : 0;
+
+    g_object_get(priv->main_channel,
+                 "mouse-mode", &mode,
+                 "agent-connected", &agent,
+                 NULL);
+
+    if (mode == SPICE_MOUSE_MODE_SERVER) {
+        /* the server refused client mode, or it was switched back by hand */
+        if (priv->mouse_switched) {
+            g_message("automatic mouse mode: staying in server mode");
+            priv->mouse_id = 0;
+            return FALSE;
+        }
+        if (!agent || priv->mouse_high < MOUSE_SWITCH_SAMPLES)
+            return TRUE;
+
+        g_message("automatic mouse mode: server -> client (input latency %u ms)", latency);
+        priv->mouse_switched = TRUE;
+        spice_main_request_mouse_mode(priv->main_channel, SPICE_MOUSE_MODE_CLIENT);
+    } else {
+        if (!priv->mouse_switched || priv->mouse_low < MOUSE_RESTORE_SAMPLES)
+            return TRUE;
+
+        g_message("automatic mouse mode: client -> server (input latency %u ms)", latency);
+        priv->mouse_switched = FALSE;
+        spice_main_request_mouse_mode(priv->main_channel, SPICE_MOUSE_MODE_SERVER);
+    }
+    priv->mouse_high = 0;
+    priv->mouse_low = 0;
+
+    return TRUE;
+}
+
+static void
+virt_viewer_session_spice_start_mouse(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+
+    virt_viewer_session_spice_stop_mouse(self);
+    if (priv->mouse_threshold == 0)
+        return;
+    priv->mouse_high = 0;
+    priv->mouse_low = 0;
+    priv->mouse_switched = FALSE;
+    priv->pointer_sent = 0;
+    priv->pointer_time = 0;
+    priv->pointer_samples = 0;
+    priv->pointer_total = 0;
+    priv->pointer_max = 0;
+    priv->mouse_id = g_timeout_add_seconds(MOUSE_INTERVAL,
+                                           virt_viewer_session_spice_check_mouse, self);
+}
+
+static void
+virt_viewer_session_spice_stop_mouse(VirtViewerSessionSpice *self)
+{
+    if (self->priv->mouse_id != 0) {
+        g_source_remove(self->priv->mouse_id);
+        self->priv->mouse_id = 0;
+    }
+}
+
 static void
 virt_viewer_session_spice_class_init(VirtViewerSessionSpiceClass *klass)
 {
@@ -164,6 +694,7 @@ virt_viewer_session_spice_class_init(VirtViewerSessionSpiceClass *klass)
     dclass->smartcard_insert = virt_viewer_session_spice_smartcard_insert;
     dclass->smartcard_remove = virt_viewer_session_spice_smartcard_remove;
     dclass->mime_type = virt_viewer_session_spice_mime_type;
+    dclass->get_stats = virt_viewer_session_spice_get_stats;
     dclass->apply_monitor_geometry = virt_viewer_session_spice_apply_monitor_geometry;
 
     g_type_class_add_private(klass, sizeof(VirtViewerSessionSpicePrivate));
@@ -185,6 +716,11 @@ static void
 virt_viewer_session_spice_init(VirtViewerSessionSpice *self G_GNUC_UNUSED)
 {
     self->priv = VIRT_VIEWER_SESSION_SPICE_GET_PRIVATE(self);
+    self->priv->parked_displays = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                        (GDestroyNotify)g_ptr_array_unref);
+    self->priv->stats_bytes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    self->priv->quality_rtt_high = QUALITY_RTT_HIGH;
+    self->priv->quality_rtt_low = QUALITY_RTT_LOW;
 }
 
 static void
@@ -294,6 +830,10 @@ virt_viewer_session_spice_close(VirtViewerSession *session)
 
     g_object_add_weak_pointer(G_OBJECT(self), (gpointer*)&self);
 
+    virt_viewer_session_spice_cancel_resume(self);
+    virt_viewer_session_spice_stop_quality(self);
+    virt_viewer_session_spice_stop_mouse(self);
+    self->priv->quality_level = QUALITY_FULL;
     virt_viewer_session_clear_displays(session);
 
     if (self->priv->session) {
@@ -451,6 +991,9 @@ virt_viewer_session_spice_open_uri(VirtViewerSession *session,
 
     if (file) {
         fill_session(file, self->priv->session);
+        virt_viewer_session_spice_quality_from_file(self, file);
+        if (virt_viewer_file_is_set(file, "mouse-latency-threshold"))
+            self->priv->mouse_threshold = virt_viewer_file_get_mouse_latency_threshold(file);
         if (!virt_viewer_file_fill_app(file, app, error))
             return FALSE;
     } else {
@@ -491,6 +1034,130 @@ virt_viewer_session_spice_channel_open_fd_request(SpiceChannel *channel,
     g_signal_emit_by_name(session, "session-channel-open", channel);
 }
 
+static void
+virt_viewer_session_spice_cancel_resume(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+
+    if (priv->resume_id != 0) {
+        g_source_remove(priv->resume_id);
+        priv->resume_id = 0;
+    }
+    priv->resume_attempts = 0;
+    priv->blackout_start = 0;
+    g_hash_table_remove_all(priv->parked_displays);
+}
+
+static void
+virt_viewer_session_spice_abort_resume(VirtViewerSessionSpice *self)
+{
+    g_debug("giving up resuming session after %u attempts", self->priv->resume_attempts);
+
+    virt_viewer_session_spice_cancel_resume(self);
+
+    /* Fall back to a full restart of the connection */
+    g_signal_emit_by_name(self, "session-reconnect");
+    if (self->priv->channel_count == 0)
+        g_signal_emit_by_name(self, "session-disconnected", NULL);
+    else
+        spice_session_disconnect(self->priv->session);
+}
+
+static gboolean
+virt_viewer_session_spice_resume(gpointer opaque)
+{
+    VirtViewerSessionSpice *self = opaque;
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    gboolean openfd;
+    gboolean ret;
+
+    priv->resume_id = 0;
+
+    /* spice_session_disconnect() destroys the channels from an idle,
+     * don't reconnect until they are all gone */
+    if (priv->channel_count > 0) {
+        priv->resume_id = g_timeout_add(RESUME_DELAY_MIN, virt_viewer_session_spice_resume, self);
+        return FALSE;
+    }
+
+    g_debug("resuming session, attempt %u", priv->resume_attempts);
+
+    g_object_get(priv->session, "client-sockets", &openfd, NULL);
+    if (openfd)
+        ret = spice_session_open_fd(priv->session, -1);
+    else
+        ret = spice_session_connect(priv->session);
+
+    if (!ret)
+        virt_viewer_session_spice_schedule_resume(self);
+
+    return FALSE;
+}
+
+static void
+virt_viewer_session_spice_schedule_resume(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    guint delay;
+
+    if (priv->resume_id != 0)
+        return;
+
+    if (priv->resume_attempts >= RESUME_MAX_ATTEMPTS) {
+        virt_viewer_session_spice_abort_resume(self);
+        return;
+    }
+
+    /* Exponential backoff, half of it randomized so that clients dropped
+     * by the same glitch don't come back to the server in lockstep */
+    delay = MIN(RESUME_DELAY_MIN << MIN(priv->resume_attempts, 16), RESUME_DELAY_MAX);
+    delay = delay / 2 + g_random_int_range(0, delay / 2 + 1);
+    priv->resume_attempts++;
+
+    g_debug("scheduling session resume attempt %u in %u ms", priv->resume_attempts, delay);
+    g_signal_emit_by_name(self, "session-resuming", priv->resume_attempts);
+    priv->resume_id = g_timeout_add(delay, virt_viewer_session_spice_resume, self);
+}
+
+/*
+ * Reconnect the SpiceSession in place: displays are parked when their
+ * channel goes away and picked up again by the new channel with the same
+ * id, so windows and widgets survive a transient network drop.
+ */
+static void
+virt_viewer_session_spice_begin_resume(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+
+    if (priv->blackout_start == 0) {
+        priv->blackout_start = g_get_monotonic_time();
+        priv->resume_attempts = 0;
+    }
+
+    if (priv->session)
+        spice_session_disconnect(priv->session);
+
+    virt_viewer_session_spice_schedule_resume(self);
+}
+
+static void
+virt_viewer_session_spice_finish_resume(VirtViewerSessionSpice *self)
+{
+    VirtViewerSessionSpicePrivate *priv = self->priv;
+    guint blackout;
+
+    if (priv->blackout_start == 0)
+        return;
+
+    blackout = (g_get_monotonic_time() - priv->blackout_start) / 1000;
+    g_debug("session resumed after %u ms blackout, %u attempts",
+            blackout, priv->resume_attempts);
+
+    priv->blackout_start = 0;
+    priv->resume_attempts = 0;
+    g_signal_emit_by_name(self, "session-resumed", blackout);
+}
+
 static void
 virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED,
                                              SpiceChannelEvent event,
@@ -503,20 +1170,37 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED
 
     g_return_if_fail(self != NULL);
 
+    if (self->priv->blackout_start != 0 &&
+        (event == SPICE_CHANNEL_CLOSED ||
+         event == SPICE_CHANNEL_ERROR_CONNECT ||
+         event == SPICE_CHANNEL_ERROR_IO ||
+         event == SPICE_CHANNEL_ERROR_LINK)) {
+        g_debug("main channel: event %d while resuming, retrying", event);
+        virt_viewer_session_spice_begin_resume(self);
+        return;
+    }
+
     switch (event) {
     case SPICE_CHANNEL_OPENED:
         g_debug("main channel: opened");
+        virt_viewer_app_timeline_mark(virt_viewer_session_get_app(session), "spice-main-open");
+        virt_viewer_session_spice_provisional_auto_conf(self);
+        virt_viewer_session_spice_finish_resume(self);
+        virt_viewer_session_spice_start_quality(self);
+        virt_viewer_session_spice_start_mouse(self);
         g_signal_emit_by_name(session, "session-connected");
         break;
     case SPICE_CHANNEL_CLOSED:
-        g_debug("main channel: closed");
-        /* Ensure the other channels get closed too */
+        /* our own disconnections destroy the channels without this event,
+         * so the server went away: park the displays and try to resume,
+         * which ensures the other channels get closed too */
+        g_debug("main channel: closed, resuming session");
+        virt_viewer_session_spice_stop_quality(self);
+        virt_viewer_session_spice_stop_mouse(self);
 #if defined(G_OS_WIN32)
         send_and_read_from_pipe(EVDI_CHANNEL_CLOSE, TRUE);
 #endif		
-        virt_viewer_session_clear_displays(session);
-        if (self->priv->session)
-            spice_session_disconnect(self->priv->session);
+        virt_viewer_session_spice_begin_resume(self);
         break;
     case SPICE_CHANNEL_SWITCHING:
         g_debug("main channel: switching host");
@@ -552,11 +1236,11 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED
                 user = g_strdup(g_get_user_name());
         }
 
-        ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
-                                                   "SPICE",
-                                                   NULL,
-                                                   username_required ? &user : NULL,
-                                                   &password);
+        ret = virt_viewer_app_collect_credentials(virt_viewer_session_get_app(session),
+                                                  "SPICE",
+                                                  NULL,
+                                                  username_required ? &user : NULL,
+                                                  &password);
         if (!ret) {
             g_signal_emit_by_name(session, "session-cancelled");
         } else {
@@ -585,9 +1269,9 @@ virt_viewer_session_spice_main_channel_event(SpiceChannel *channel G_GNUC_UNUSED
             SpiceURI *proxy = spice_session_get_proxy_uri(self->priv->session);
             g_warn_if_fail(proxy != NULL);
 
-            ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
-                                                       "proxy", NULL,
-                                                       &user, &password);
+            ret = virt_viewer_app_collect_credentials(virt_viewer_session_get_app(session),
+                                                      "proxy", NULL,
+                                                      &user, &password);
             if (!ret) {
                 g_signal_emit_by_name(session, "session-cancelled");
             } else {
@@ -646,12 +1330,8 @@ virt_viewer_session_spice_input_channel_event(SpiceChannel *channel G_GNUC_UNUSE
 
     switch (event) {
     case SPICE_CHANNEL_CLOSED:
-        g_debug("input channel: error");
-        /* Ensure the other channels get closed too */
-        virt_viewer_session_clear_displays(session);
-        if (self->priv->session)
-            spice_session_disconnect(self->priv->session);
-	g_signal_emit_by_name(session, "session-reconnect");
+        g_debug("input channel: closed, resuming session");
+        virt_viewer_session_spice_begin_resume(self);
         break;
     default:
         break;
@@ -708,10 +1388,17 @@ virt_viewer_session_spice_usb_device_selection(VirtViewerSession *session,
 }
 
 static void
-agent_connected_changed(SpiceChannel *cmain G_GNUC_UNUSED,
+agent_connected_changed(SpiceChannel *cmain,
                         GParamSpec *pspec G_GNUC_UNUSED,
                         VirtViewerSessionSpice *self)
 {
+    gboolean agent_connected;
+
+    g_object_get(cmain, "agent-connected", &agent_connected, NULL);
+    if (agent_connected)
+        virt_viewer_app_timeline_mark(virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self)),
+                                      "spice-agent");
+
     // this will force refresh of application menu
     g_signal_emit_by_name(self, "session-display-updated");
 
@@ -731,15 +1418,111 @@ destroy_display(gpointer data)
     g_object_unref(display);
 }
 
+static GPtrArray*
+virt_viewer_session_spice_channel_displays(VirtViewerSessionSpice *self,
+                                           SpiceChannel *channel)
+{
+    GPtrArray *displays;
+    GtkWidget *display;
+    guint i;
+
+    displays = g_object_get_data(G_OBJECT(channel), "virt-viewer-displays");
+    if (displays == NULL) {
+        gint id;
+
+        g_object_get(channel, "channel-id", &id, NULL);
+        displays = g_hash_table_lookup(self->priv->parked_displays, GINT_TO_POINTER(id));
+        if (displays != NULL) {
+            g_debug("reusing parked displays for channel #%d", id);
+            g_hash_table_steal(self->priv->parked_displays, GINT_TO_POINTER(id));
+            for (i = 0; i < displays->len; i++) {
+                display = g_ptr_array_index(displays, i);
+                if (display == NULL)
+                    continue;
+                virt_viewer_display_spice_set_channel(VIRT_VIEWER_DISPLAY_SPICE(display),
+                                                      channel);
+                /* in case they left the session meanwhile */
+                virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self),
+                                                VIRT_VIEWER_DISPLAY(display));
+            }
+        } else {
+            displays = g_ptr_array_new();
+            g_ptr_array_set_free_func(displays, destroy_display);
+        }
+        g_object_set_data_full(G_OBJECT(channel), "virt-viewer-displays",
+                               displays, (GDestroyNotify)g_ptr_array_unref);
+    }
+
+    return displays;
+}
+
+/*
+ * --fast-start: create the widget of the first monitor as soon as the
+ * display channel exists, so it gets the primary surface and draws
+ * without waiting for the monitors configuration.
+ */
+static void
+virt_viewer_session_spice_early_display(VirtViewerSessionSpice *self,
+                                        SpiceChannel *channel)
+{
+    GPtrArray *displays = virt_viewer_session_spice_channel_displays(self, channel);
+    GtkWidget *display;
+
+    if (displays->len == 0)
+        g_ptr_array_set_size(displays, 1);
+
+    display = g_ptr_array_index(displays, 0);
+    if (display == NULL) {
+        display = virt_viewer_display_spice_new(self, channel, 0);
+        g_debug("creating early spice display");
+        g_ptr_array_index(displays, 0) = g_object_ref_sink(display);
+    }
+
+    virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self),
+                                    VIRT_VIEWER_DISPLAY(display));
+}
+
+static const SpiceDisplayMonitorConfig*
+find_monitor(GArray *monitors, guint id)
+{
+    guint i;
+
+    if (monitors == NULL)
+        return NULL;
+
+    for (i = 0; i < monitors->len; i++) {
+        const SpiceDisplayMonitorConfig *monitor =
+            &g_array_index(monitors, SpiceDisplayMonitorConfig, i);
+        if (monitor->id == id)
+            return monitor;
+    }
+
+    return NULL;
+}
+
+static gboolean
+monitor_enabled(const SpiceDisplayMonitorConfig *monitor)
+{
+    return monitor != NULL && monitor->width != 0 && monitor->height != 0;
+}
+
+/*
+ * The agent may reconfigure the monitors often, and every display touched
+ * here ends up in window and menu updates in the app. Compare the new
+ * configuration with the previous one of the channel and only create,
+ * enable, disable or resize the displays it actually changes.
+ */
 static void
 virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
                                            GParamSpec *pspec G_GNUC_UNUSED,
                                            VirtViewerSessionSpice *self)
 {
     GArray *monitors = NULL;
+    GArray *previous;
     GPtrArray *displays = NULL;
     GtkWidget *display;
     guint i, monitors_max;
+    guint created = 0, changed = 0;
 
     g_object_get(channel,
                  "monitors", &monitors,
@@ -748,43 +1531,64 @@ virt_viewer_session_spice_display_monitors(SpiceChannel *channel,
     g_return_if_fail(monitors != NULL);
     g_return_if_fail(monitors->len <= monitors_max);
 
-    displays = g_object_get_data(G_OBJECT(channel), "virt-viewer-displays");
-    if (displays == NULL) {
-        displays = g_ptr_array_new();
-        g_ptr_array_set_free_func(displays, destroy_display);
-        g_object_set_data_full(G_OBJECT(channel), "virt-viewer-displays",
-                               displays, (GDestroyNotify)g_ptr_array_unref);
-    }
+    displays = virt_viewer_session_spice_channel_displays(self, channel);
+    previous = g_object_get_data(G_OBJECT(channel), "virt-viewer-monitors");
 
-    g_ptr_array_set_size(displays, monitors_max);
+    if (displays->len != monitors_max)
+        g_ptr_array_set_size(displays, monitors_max);
 
     for (i = 0; i < monitors_max; i++) {
         display = g_ptr_array_index(displays, i);
-        if (display == NULL) {
-            display = virt_viewer_display_spice_new(self, channel, i);
-            g_debug("creating spice display (#:%d)", i);
-            g_ptr_array_index(displays, i) = g_object_ref_sink(display);
-        }
+        if (display != NULL)
+            continue;
 
+        display = virt_viewer_display_spice_new(self, channel, i);
+        g_debug("creating spice display (#:%d)", i);
+        g_ptr_array_index(displays, i) = g_object_ref_sink(display);
         virt_viewer_session_add_display(VIRT_VIEWER_SESSION(self),
                                         VIRT_VIEWER_DISPLAY(display));
+        created++;
     }
 
     for (i = 0; i < monitors->len; i++) {
         SpiceDisplayMonitorConfig *monitor = &g_array_index(monitors, SpiceDisplayMonitorConfig, i);
+        const SpiceDisplayMonitorConfig *old = find_monitor(previous, monitor->id);
+
+        if (monitor->id >= displays->len)
+            continue;
         display = g_ptr_array_index(displays, monitor->id);
-        g_return_if_fail(display != NULL);
 
-        if (monitor->width == 0 || monitor->height == 0)
+        if (!monitor_enabled(monitor))
+            continue;
+        if (monitor_enabled(old) &&
+            old->width == monitor->width && old->height == monitor->height)
             continue;
 
         virt_viewer_display_set_enabled(VIRT_VIEWER_DISPLAY(display), TRUE);
         virt_viewer_display_set_desktop_size(VIRT_VIEWER_DISPLAY(display),
                                              monitor->width, monitor->height);
+        changed++;
+    }
+
+    /* monitors the guest turned off since the last configuration */
+    for (i = 0; previous != NULL && i < previous->len; i++) {
+        SpiceDisplayMonitorConfig *old = &g_array_index(previous, SpiceDisplayMonitorConfig, i);
+
+        if (!monitor_enabled(old) || old->id >= displays->len ||
+            monitor_enabled(find_monitor(monitors, old->id)))
+            continue;
+
+        display = g_ptr_array_index(displays, old->id);
+        virt_viewer_display_set_enabled(VIRT_VIEWER_DISPLAY(display), FALSE);
+        changed++;
     }
 
-    g_clear_pointer(&monitors, g_array_unref);
+    g_debug("monitors of display channel %p: %u created, %u changed",
+            channel, created, changed);
 
+    /* takes over our reference */
+    g_object_set_data_full(G_OBJECT(channel), "virt-viewer-monitors",
+                           monitors, (GDestroyNotify)g_array_unref);
 }
 
 static void
@@ -805,6 +1609,7 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
     g_debug("New spice channel %p %s %d", channel, g_type_name(G_OBJECT_TYPE(channel)), id);
 
     if (SPICE_IS_MAIN_CHANNEL(channel)) {
+        virt_viewer_app_timeline_mark(virt_viewer_session_get_app(session), "spice-main-channel");
         if (self->priv->main_channel != NULL)
             g_signal_handlers_disconnect_by_func(self->priv->main_channel,
                                                  virt_viewer_session_spice_main_channel_event, self);
@@ -819,14 +1624,22 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
 
         virt_viewer_signal_connect_object(channel, "notify::agent-connected",
                                           G_CALLBACK(agent_connected_changed), self, 0);
+    } else {
+        /* announced by the main channel, about to connect */
+        g_signal_emit_by_name(session, "session-channel-announced");
     }
 
     if (SPICE_IS_DISPLAY_CHANNEL(channel)) {
+        virt_viewer_app_timeline_mark(virt_viewer_session_get_app(session),
+                                      "spice-display-channel-%d", id);
         g_signal_emit_by_name(session, "session-initialized");
 
         virt_viewer_signal_connect_object(channel, "notify::monitors",
                                           G_CALLBACK(virt_viewer_session_spice_display_monitors), self, 0);
 
+        if (virt_viewer_app_get_fast_start(virt_viewer_session_get_app(session)))
+            virt_viewer_session_spice_early_display(self, channel);
+
         spice_channel_connect(channel);
     }
 
@@ -838,6 +1651,11 @@ virt_viewer_session_spice_channel_new(SpiceSession *s,
         g_debug("new inputs channel");
     }
 
+    if (SPICE_IS_CURSOR_CHANNEL(channel)) {
+        virt_viewer_signal_connect_object(channel, "cursor-move",
+                                          G_CALLBACK(virt_viewer_session_spice_cursor_moved), self, 0);
+    }
+
     if (SPICE_IS_PLAYBACK_CHANNEL(channel)) {
         g_debug("new audio channel");
         if (self->priv->audio == NULL)
@@ -862,15 +1680,56 @@ property_notify_do_auto_conf(GObject *gobject G_GNUC_UNUSED,
     virt_viewer_session_spice_fullscreen_auto_conf(self);
 }
 
+static void
+virt_viewer_session_spice_set_displays(SpiceMainChannel *cmain,
+                                       const GdkRectangle *displays,
+                                       gsize ndisplays)
+{
+    gsize i;
+
+    spice_main_set_display_enabled(cmain, -1, FALSE);
+
+    for (i = 0; i < ndisplays; i++) {
+        const GdkRectangle *rect = &displays[i];
+
+        spice_main_set_display(cmain, i, rect->x, rect->y, rect->width, rect->height);
+        spice_main_set_display_enabled(cmain, i, TRUE);
+        g_debug("Set SPICE display %" G_GSIZE_FORMAT " to (%d,%d)-(%dx%d)",
+                  i, rect->x, rect->y, rect->width, rect->height);
+    }
+}
+
+/*
+ * --fast-start: as soon as the main channel is open, hand the full screen
+ * layout to spice-gtk, which sends it once the agent announces itself
+ * instead of after our own agent-connected round trip.
+ */
+static void
+virt_viewer_session_spice_provisional_auto_conf(VirtViewerSessionSpice *self)
+{
+    SpiceMainChannel *cmain = virt_viewer_session_spice_get_main_channel(self);
+    VirtViewerApp *app = virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self));
+    const GdkRectangle *displays;
+    gsize ndisplays = 0;
+
+    if (self->priv->did_auto_conf || cmain == NULL ||
+        !virt_viewer_app_get_fast_start(app) ||
+        !virt_viewer_app_get_fullscreen(app))
+        return;
+
+    displays = virt_viewer_app_get_initial_layout(app, &ndisplays);
+    g_debug("Provisional full screen auto-conf, %" G_GSIZE_FORMAT " host monitors", ndisplays);
+    virt_viewer_session_spice_set_displays(cmain, displays, ndisplays);
+    virt_viewer_app_timeline_mark(app, "provisional-auto-conf");
+}
+
 static gboolean
 virt_viewer_session_spice_fullscreen_auto_conf(VirtViewerSessionSpice *self)
 {
-    GdkScreen *screen = gdk_screen_get_default();
     SpiceMainChannel* cmain = virt_viewer_session_spice_get_main_channel(self);
     VirtViewerApp *app = NULL;
-    GdkRectangle *displays;
+    const GdkRectangle *displays;
     gboolean agent_connected;
-    gint i;
     gsize ndisplays = 0;
 
     /* only do auto-conf once at startup. Avoid repeating auto-conf later due to
@@ -899,35 +1758,13 @@ virt_viewer_session_spice_fullscreen_auto_conf(VirtViewerSessionSpice *self)
         return FALSE;
     }
 
-    spice_main_set_display_enabled(cmain, -1, FALSE);
-
-    ndisplays = virt_viewer_app_get_n_initial_displays(app);
+    displays = virt_viewer_app_get_initial_layout(app, &ndisplays);
     g_debug("Performing full screen auto-conf, %" G_GSIZE_FORMAT " host monitors", ndisplays);
-    displays = g_new0(GdkRectangle, ndisplays);
-
-    for (i = 0; i < ndisplays; i++) {
-        GdkRectangle* rect = &displays[i];
-        gint j = virt_viewer_app_get_initial_monitor_for_display(app, i);
-        if (j == -1)
-            continue;
-
-        gdk_screen_get_monitor_geometry(screen, j, rect);
-    }
-
-    virt_viewer_shift_monitors_to_origin(displays, ndisplays);
-
-    for (i = 0; i < ndisplays; i++) {
-        GdkRectangle *rect = &displays[i];
-
-        spice_main_set_display(cmain, i, rect->x, rect->y, rect->width, rect->height);
-        spice_main_set_display_enabled(cmain, i, TRUE);
-        g_debug("Set SPICE display %d to (%d,%d)-(%dx%d)",
-                  i, rect->x, rect->y, rect->width, rect->height);
-    }
-    g_free(displays);
+    virt_viewer_session_spice_set_displays(cmain, displays, ndisplays);
 
     spice_main_send_monitor_config(cmain);
     self->priv->did_auto_conf = TRUE;
+    virt_viewer_app_timeline_mark(app, "fullscreen-auto-conf");
     return TRUE;
 }
 
@@ -952,7 +1789,13 @@ virt_viewer_session_spice_channel_destroy(G_GNUC_UNUSED SpiceSession *s,
 
     if (SPICE_IS_DISPLAY_CHANNEL(channel)) {
         g_debug("zap display channel (#%d)", id);
-        g_object_set_data(G_OBJECT(channel), "virt-viewer-displays", NULL);
+        if (self->priv->blackout_start != 0) {
+            GPtrArray *displays = g_object_steal_data(G_OBJECT(channel), "virt-viewer-displays");
+            if (displays != NULL)
+                g_hash_table_replace(self->priv->parked_displays, GINT_TO_POINTER(id), displays);
+        } else {
+            g_object_set_data(G_OBJECT(channel), "virt-viewer-displays", NULL);
+        }
     }
 
     if (SPICE_IS_PLAYBACK_CHANNEL(channel) && self->priv->audio) {
@@ -968,7 +1811,7 @@ virt_viewer_session_spice_channel_destroy(G_GNUC_UNUSED SpiceSession *s,
     }
 
     self->priv->channel_count--;
-    if (self->priv->channel_count == 0)
+    if (self->priv->channel_count == 0 && self->priv->blackout_start == 0)
         g_signal_emit_by_name(self, "session-disconnected", NULL);
 }
 
@@ -1026,6 +1869,9 @@ virt_viewer_session_spice_new(VirtViewerApp *app, GtkWindow *main_window)
 
     create_spice_session(self);
     self->priv->main_window = g_object_ref(main_window);
+    /* both opt-in, the connection file may still turn them on or off */
+    self->priv->quality_adaptive = virt_viewer_app_get_adaptive_quality(app);
+    self->priv->mouse_threshold = virt_viewer_app_get_mouse_latency_threshold(app);
 
     virt_viewer_signal_connect_object(app, "notify::fullscreen",
                                       G_CALLBACK(property_notify_do_auto_conf), self, 0);
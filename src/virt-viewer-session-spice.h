@@ -67,6 +67,7 @@ GType virt_viewer_session_spice_get_type(void);
 
 VirtViewerSession* virt_viewer_session_spice_new(VirtViewerApp *app, GtkWindow *main_window);
 SpiceMainChannel* virt_viewer_session_spice_get_main_channel(VirtViewerSessionSpice *self);
+void virt_viewer_session_spice_pointer_moved(VirtViewerSessionSpice *self);
 
 G_END_DECLS
 
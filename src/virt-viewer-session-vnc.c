@@ -99,6 +99,8 @@ virt_viewer_session_vnc_connected(VncDisplay *vnc G_GNUC_UNUSED,
                                   VirtViewerSessionVnc *session)
 {
     GtkWidget *display = virt_viewer_display_vnc_new(session, session->priv->vnc);
+    virt_viewer_app_timeline_mark(virt_viewer_session_get_app(VIRT_VIEWER_SESSION(session)),
+                                  "vnc-connected");
     g_signal_emit_by_name(session, "session-connected");
     virt_viewer_session_add_display(VIRT_VIEWER_SESSION(session),
                                     VIRT_VIEWER_DISPLAY(display));
@@ -122,6 +124,8 @@ static void
 virt_viewer_session_vnc_initialized(VncDisplay *vnc G_GNUC_UNUSED,
                                     VirtViewerSessionVnc *session)
 {
+    virt_viewer_app_timeline_mark(virt_viewer_session_get_app(VIRT_VIEWER_SESSION(session)),
+                                  "vnc-initialized");
     g_signal_emit_by_name(session, "session-initialized");
 }
 
@@ -298,10 +302,10 @@ virt_viewer_session_vnc_auth_credential(GtkWidget *src G_GNUC_UNUSED,
     }
 
     if (wantUsername || wantPassword) {
-        gboolean ret = virt_viewer_auth_collect_credentials(self->priv->main_window,
-                                                            "VNC", NULL,
-                                                            wantUsername ? &username : NULL,
-                                                            wantPassword ? &password : NULL);
+        gboolean ret = virt_viewer_app_collect_credentials(virt_viewer_session_get_app(VIRT_VIEWER_SESSION(self)),
+                                                           "VNC", NULL,
+                                                           wantUsername ? &username : NULL,
+                                                           wantPassword ? &password : NULL);
 
         if (!ret) {
             vnc_display_close(self->priv->vnc);
@@ -41,8 +41,17 @@ struct _VirtViewerSessionPrivate
     gboolean has_usbredir;
     gchar *uri;
     VirtViewerFile *file;
+
+    /* monitor geometry changes are applied after a quiet period */
+    guint geometry_update_id;
+    gint64 geometry_changed_at;
+    guint geometry_coalesced;
+    guint geometry_suppressed;
 };
 
+/* quiet period before the monitor layout is sent to the guest, in ms */
+#define GEOMETRY_QUIET_PERIOD 200
+
 G_DEFINE_ABSTRACT_TYPE(VirtViewerSession, virt_viewer_session, G_TYPE_OBJECT)
 
 enum {
@@ -61,6 +70,9 @@ virt_viewer_session_finalize(GObject *obj)
     VirtViewerSession *session = VIRT_VIEWER_SESSION(obj);
     GList *tmp = session->priv->displays;
 
+    if (session->priv->geometry_update_id != 0)
+        g_source_remove(session->priv->geometry_update_id);
+
     while (tmp) {
         g_object_unref(tmp->data);
         tmp = tmp->next;
@@ -224,6 +236,26 @@ virt_viewer_session_class_init(VirtViewerSessionClass *class)
                  G_TYPE_NONE,
                  0);
 	
+    g_signal_new("session-resuming",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_FIRST,
+                 G_STRUCT_OFFSET(VirtViewerSessionClass, session_resuming),
+                 NULL, NULL,
+                 g_cclosure_marshal_VOID__UINT,
+                 G_TYPE_NONE,
+                 1,
+                 G_TYPE_UINT);
+
+    g_signal_new("session-resumed",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_FIRST,
+                 G_STRUCT_OFFSET(VirtViewerSessionClass, session_resumed),
+                 NULL, NULL,
+                 g_cclosure_marshal_VOID__UINT,
+                 G_TYPE_NONE,
+                 1,
+                 G_TYPE_UINT);
+
     g_signal_new("session-initialized",
                  G_OBJECT_CLASS_TYPE(object_class),
                  G_SIGNAL_RUN_FIRST,
@@ -253,6 +285,16 @@ virt_viewer_session_class_init(VirtViewerSessionClass *class)
                  1,
                  G_TYPE_OBJECT);
 
+    /* a channel that is about to ask for its fd with session-channel-open */
+    g_signal_new("session-channel-announced",
+                 G_OBJECT_CLASS_TYPE(object_class),
+                 G_SIGNAL_RUN_FIRST,
+                 G_STRUCT_OFFSET(VirtViewerSessionClass, session_channel_announced),
+                 NULL, NULL,
+                 g_cclosure_marshal_VOID__VOID,
+                 G_TYPE_NONE,
+                 0);
+
     g_signal_new("session-auth-refused",
                  G_OBJECT_CLASS_TYPE(object_class),
                  G_SIGNAL_RUN_LAST | G_SIGNAL_NO_HOOKS,
@@ -358,8 +400,7 @@ virt_viewer_session_init(VirtViewerSession *session)
 }
 
 static void
-virt_viewer_session_on_monitor_geometry_changed(VirtViewerSession* self,
-                                                VirtViewerDisplay* display G_GNUC_UNUSED)
+virt_viewer_session_apply_displays_geometry(VirtViewerSession* self)
 {
     VirtViewerSessionClass *klass;
     gboolean all_fullscreen = TRUE;
@@ -408,6 +449,60 @@ virt_viewer_session_on_monitor_geometry_changed(VirtViewerSession* self,
     g_free(monitors);
 }
 
+static gboolean
+virt_viewer_session_geometry_timeout(gpointer opaque)
+{
+    VirtViewerSession *self = opaque;
+    VirtViewerSessionPrivate *priv = self->priv;
+    gint64 quiet = (g_get_monotonic_time() - priv->geometry_changed_at) / 1000;
+
+    /* still resizing, wait until it settles */
+    if (quiet < GEOMETRY_QUIET_PERIOD) {
+        priv->geometry_update_id = g_timeout_add(GEOMETRY_QUIET_PERIOD - quiet,
+                                                 virt_viewer_session_geometry_timeout, self);
+        return FALSE;
+    }
+
+    g_debug("Applying monitor geometry, %u changes coalesced (%u suppressed so far)",
+            priv->geometry_coalesced, priv->geometry_suppressed);
+    priv->geometry_update_id = 0;
+    priv->geometry_coalesced = 0;
+    virt_viewer_session_apply_displays_geometry(self);
+
+    return FALSE;
+}
+
+/*
+ * Displays report every size allocation while a window is being resized,
+ * and every layout sent makes the guest do a mode set. Collect changes
+ * from all the displays and only send the layout once they stop.
+ */
+static void
+virt_viewer_session_on_monitor_geometry_changed(VirtViewerSession* self,
+                                                VirtViewerDisplay* display G_GNUC_UNUSED)
+{
+    VirtViewerSessionPrivate *priv = self->priv;
+
+    priv->geometry_changed_at = g_get_monotonic_time();
+    priv->geometry_coalesced++;
+
+    if (priv->geometry_update_id != 0) {
+        priv->geometry_suppressed++;
+        return;
+    }
+
+    priv->geometry_update_id = g_timeout_add(GEOMETRY_QUIET_PERIOD,
+                                             virt_viewer_session_geometry_timeout, self);
+}
+
+guint
+virt_viewer_session_get_suppressed_geometry_updates(VirtViewerSession *self)
+{
+    g_return_val_if_fail(VIRT_VIEWER_IS_SESSION(self), 0);
+
+    return self->priv->geometry_suppressed;
+}
+
 void virt_viewer_session_add_display(VirtViewerSession *session,
                                      VirtViewerDisplay *display)
 {
@@ -452,7 +547,16 @@ void virt_viewer_session_clear_displays(VirtViewerSession *session)
 
 void virt_viewer_session_update_displays_geometry(VirtViewerSession *session)
 {
-    virt_viewer_session_on_monitor_geometry_changed(session, NULL);
+    VirtViewerSessionPrivate *priv = session->priv;
+
+    /* not a resize, send right away along with anything pending */
+    if (priv->geometry_update_id != 0) {
+        g_source_remove(priv->geometry_update_id);
+        priv->geometry_update_id = 0;
+    }
+    priv->geometry_coalesced = 0;
+
+    virt_viewer_session_apply_displays_geometry(session);
 }
 
 
@@ -509,6 +613,23 @@ const gchar* virt_viewer_session_mime_type(VirtViewerSession *self)
     return klass->mime_type(self);
 }
 
+/*
+ * Appends human readable connection statistics (throughput, round-trip
+ * time...) to @stats, one item per line. Cheap enough to be called a few
+ * times per second; rates are computed since the previous call.
+ */
+void virt_viewer_session_get_stats(VirtViewerSession *self, GString *stats)
+{
+    VirtViewerSessionClass *klass;
+
+    g_return_if_fail(VIRT_VIEWER_IS_SESSION(self));
+    g_return_if_fail(stats != NULL);
+
+    klass = VIRT_VIEWER_SESSION_GET_CLASS(self);
+    if (klass->get_stats != NULL)
+        klass->get_stats(self, stats);
+}
+
 gboolean virt_viewer_session_channel_open_fd(VirtViewerSession *session,
                                              VirtViewerSessionChannel *channel, int fd)
 {
@@ -74,11 +74,14 @@ struct _VirtViewerSessionClass {
     void (* smartcard_insert) (VirtViewerSession* session);
     void (* smartcard_remove) (VirtViewerSession* session);
     const gchar* (* mime_type) (VirtViewerSession* session);
+    void (* get_stats) (VirtViewerSession* session, GString *stats);
 
     /* signals */
     void (*session_connected)(VirtViewerSession *session);
     void (*session_reconnect)(VirtViewerSession *session);
 	void (*session_inputstimeout)(VirtViewerSession *session);
+    void (*session_resuming)(VirtViewerSession *session, guint attempt);
+    void (*session_resumed)(VirtViewerSession *session, guint blackout_ms);
     void (*session_initialized)(VirtViewerSession *session);
     void (*session_disconnected)(VirtViewerSession *session, const gchar *msg);
     void (*session_auth_refused)(VirtViewerSession *session, const gchar *msg);
@@ -86,6 +89,7 @@ struct _VirtViewerSessionClass {
     void (*session_usb_failed)(VirtViewerSession *session, const gchar *msg);
 
     void (*session_channel_open)(VirtViewerSession *session, VirtViewerSessionChannel *channel);
+    void (*session_channel_announced)(VirtViewerSession *session);
 
     void (*session_display_added)(VirtViewerSession *session,
                                   VirtViewerDisplay *display);
@@ -103,6 +107,7 @@ GType virt_viewer_session_get_type(void);
 
 GtkWidget *virt_viewer_session_new(void);
 const gchar* virt_viewer_session_mime_type(VirtViewerSession *session);
+void virt_viewer_session_get_stats(VirtViewerSession *session, GString *stats);
 
 void virt_viewer_session_add_display(VirtViewerSession *session,
                                      VirtViewerDisplay *display);
@@ -110,6 +115,7 @@ void virt_viewer_session_remove_display(VirtViewerSession *session,
                                         VirtViewerDisplay *display);
 void virt_viewer_session_clear_displays(VirtViewerSession *session);
 void virt_viewer_session_update_displays_geometry(VirtViewerSession *session);
+guint virt_viewer_session_get_suppressed_geometry_updates(VirtViewerSession *self);
 
 void virt_viewer_session_close(VirtViewerSession* session);
 gboolean virt_viewer_session_open_fd(VirtViewerSession* session, int fd);
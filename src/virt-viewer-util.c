@@ -35,11 +35,26 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
 #include <libxml/xpath.h>
 #include <libxml/uri.h>
 
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+#include <glib-unix.h>
+#endif
+
+#ifdef __GLIBC__
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unwind.h>
+#define WATCHDOG_SAMPLE 1
+#endif
+
 #include "virt-viewer-util.h"
+#include "virt-glib-compat.h"
 
 GQuark
 virt_viewer_error_quark(void)
@@ -47,55 +62,89 @@ virt_viewer_error_quark(void)
   return g_quark_from_static_string ("virt-viewer-error-quark");
 }
 
-GtkBuilder *virt_viewer_util_load_ui(const char *name)
+/*
+ * UI descriptions are read from disk once per process and kept in
+ * memory: every window builds its menus from virt-viewer.xml, and the
+ * whole app is recreated on reconnect, so the lookup through the data
+ * directories would otherwise be repeated each time.
+ */
+static GHashTable *ui_cache = NULL;
+
+static gchar *
+virt_viewer_util_read_ui(const char *name, GError **error)
 {
     struct stat sb;
+    gchar *contents = NULL;
+    gchar *path;
+
+    if (stat(name, &sb) >= 0) {
+        g_file_get_contents(name, &contents, NULL, error);
+        return contents;
+    }
+
+    path = g_build_filename(PACKAGE_DATADIR, "ui", name, NULL);
+    if (!g_file_get_contents(path, &contents, NULL, error)) {
+        if (!g_error_matches(*error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning("Failed to add ui file '%s': %s", path, (*error)->message);
+        g_clear_error(error);
+    }
+    g_free(path);
+
+    if (contents == NULL) {
+        const gchar * const * dirs = g_get_system_data_dirs();
+        g_return_val_if_fail(dirs != NULL, NULL);
+
+        while (dirs[0] != NULL) {
+            path = g_build_filename(dirs[0], PACKAGE, "ui", name, NULL);
+            if (g_file_get_contents(path, &contents, NULL, NULL)) {
+                g_free(path);
+                break;
+            }
+            g_free(path);
+            dirs++;
+        }
+    }
+
+    return contents;
+}
+
+GtkBuilder *virt_viewer_util_load_ui(const char *name)
+{
     GtkBuilder *builder;
     GError *error = NULL;
+    const gchar *contents;
+
+    if (ui_cache == NULL)
+        ui_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    contents = g_hash_table_lookup(ui_cache, name);
+    if (contents == NULL) {
+        gchar *data = virt_viewer_util_read_ui(name, &error);
 
-    builder = gtk_builder_new();
-    if (stat(name, &sb) >= 0) {
-        gtk_builder_add_from_file(builder, name, &error);
-    } else {
-        gchar *path = g_build_filename(PACKAGE_DATADIR, "ui", name, NULL);
-        gboolean success = (gtk_builder_add_from_file(builder, path, &error) != 0);
         if (error) {
-            if (!(error->domain == G_FILE_ERROR && error->code == G_FILE_ERROR_NOENT))
-                g_warning("Failed to add ui file '%s': %s", path, error->message);
+            g_error("Cannot load UI description %s: %s", name,
+                    error->message);
             g_clear_error(&error);
+            return NULL;
         }
-        g_free(path);
-
-        if (!success) {
-            const gchar * const * dirs = g_get_system_data_dirs();
-            g_return_val_if_fail(dirs != NULL, NULL);
-
-            while (dirs[0] != NULL) {
-                path = g_build_filename(dirs[0], PACKAGE, "ui", name, NULL);
-                if (gtk_builder_add_from_file(builder, path, NULL) != 0) {
-                    g_free(path);
-                    break;
-                }
-                g_free(path);
-                dirs++;
-            }
-            if (dirs[0] == NULL)
-                goto failed;
+        if (data == NULL) {
+            g_error("failed to find UI description file");
+            return NULL;
         }
+        g_hash_table_insert(ui_cache, g_strdup(name), data);
+        contents = data;
     }
 
-    if (error) {
+    builder = gtk_builder_new();
+    if (gtk_builder_add_from_string(builder, contents, -1, &error) == 0) {
         g_error("Cannot load UI description %s: %s", name,
                 error->message);
         g_clear_error(&error);
-        goto failed;
+        g_object_unref(builder);
+        return NULL;
     }
 
     return builder;
- failed:
-    g_error("failed to find UI description file");
-    g_object_unref(builder);
-    return NULL;
 }
 
 int
@@ -290,6 +339,317 @@ static void log_handler(const gchar *log_domain,
     g_log_default_handler(log_domain, log_level, message, unused_data);
 }
 
+/*
+ * Main loop watchdog, see virt_viewer_watchdog_start. A stall is named
+ * after the functions of the innermost WATCHDOG_CHAIN frames of the
+ * program at the time it went over the threshold, not the call sites, so
+ * that one stuck function is one entry. Most of our functions are static
+ * and have no symbol at run time: those are given as program+offset of
+ * their first instruction, for addr2line -f -e.
+ */
+#define WATCHDOG_FRAMES 32
+#define WATCHDOG_CHAIN 4
+#define WATCHDOG_SIGNAL SIGURG
+
+typedef struct {
+    guint count;
+    gint64 total; /* microseconds */
+    gint64 max;
+} WatchdogStall;
+
+G_LOCK_DEFINE_STATIC(watchdog);
+
+static struct {
+    guint refs;
+    gint64 threshold; /* microseconds */
+    gint64 started;
+    GPollFunc poll;
+    GHashTable *stalls; /* name -> WatchdogStall, main thread only */
+    guint report_id;
+    /* under the watchdog lock */
+    gint64 busy_since; /* start of the current iteration, 0 while polling */
+    gint64 sampled; /* busy_since of the last iteration sampled */
+#ifdef WATCHDOG_SAMPLE
+    GThread *thread;
+    gint quit;
+    pthread_t main_thread;
+    struct sigaction old_action;
+    gchar *program; /* prefix of the symbols of our own frames */
+#endif
+} watchdog;
+
+#ifdef WATCHDOG_SAMPLE
+/* written by the signal handler, in the main thread */
+static volatile sig_atomic_t watchdog_sample_ready;
+static void *watchdog_frames[WATCHDOG_FRAMES];
+static int watchdog_nframes;
+
+/*
+ * Runs in the main thread while it is stalled, in the middle of anything,
+ * so it only takes a backtrace into static storage: nothing that locks or
+ * allocates. backtrace() is fine once libgcc is loaded, see
+ * virt_viewer_watchdog_start.
+ */
+static void
+virt_viewer_watchdog_sample(int signum G_GNUC_UNUSED)
+{
+    int saved_errno = errno;
+
+    watchdog_nframes = backtrace(watchdog_frames, WATCHDOG_FRAMES);
+    watchdog_sample_ready = 1;
+    errno = saved_errno;
+}
+
+static gpointer
+virt_viewer_watchdog_thread(gpointer data G_GNUC_UNUSED)
+{
+    gulong interval = MAX(watchdog.threshold / 4, 1000);
+
+    while (!g_atomic_int_get(&watchdog.quit)) {
+        gboolean stalled = FALSE;
+
+        g_usleep(interval);
+
+        G_LOCK(watchdog);
+        if (watchdog.busy_since != 0 && watchdog.sampled != watchdog.busy_since &&
+            g_get_monotonic_time() - watchdog.busy_since >= watchdog.threshold) {
+            watchdog.sampled = watchdog.busy_since;
+            stalled = TRUE;
+        }
+        G_UNLOCK(watchdog);
+
+        if (stalled)
+            pthread_kill(watchdog.main_thread, WATCHDOG_SIGNAL);
+    }
+
+    return NULL;
+}
+#endif
+
+static gchar *
+virt_viewer_watchdog_sample_name(void)
+{
+    GString *name = g_string_new(NULL);
+
+#ifdef WATCHDOG_SAMPLE
+    if (watchdog_sample_ready && watchdog_nframes > 1) {
+        const gchar *base = strrchr(watchdog.program, '/');
+        void *functions[WATCHDOG_FRAMES];
+        gchar **symbols;
+        guint kept = 0;
+        int i, n = 0;
+
+        /* frame 0 is the signal handler; the others are return addresses,
+         * which point past the call */
+        for (i = 1; i < watchdog_nframes; i++) {
+            void *function = _Unwind_FindEnclosingFunction((gchar *)watchdog_frames[i] - 1);
+
+            functions[n++] = function != NULL ? function : watchdog_frames[i];
+        }
+
+        base = base != NULL ? base + 1 : watchdog.program;
+        symbols = backtrace_symbols(functions, n);
+        for (i = 0; symbols != NULL && i < n && kept < WATCHDOG_CHAIN; i++) {
+            /* program(symbol+0x0) [address] or program(+0xoffset) [address] */
+            const gchar *open = strchr(symbols[i], '(');
+            const gchar *end = open != NULL ? strpbrk(open + 1, "+)") : NULL;
+
+            if (!g_str_has_prefix(symbols[i], watchdog.program) || end == NULL)
+                continue;
+            if (kept++ > 0)
+                g_string_append(name, " < ");
+            if (end == open + 1)
+                g_string_append_printf(name, "%s%.*s", base,
+                                       (int)strcspn(end, ")"), end);
+            else
+                g_string_append_len(name, open + 1, end - open - 1);
+        }
+        free(symbols);
+    }
+    watchdog_sample_ready = 0;
+#endif
+    if (name->len == 0)
+        g_string_append(name, "unknown");
+
+    return g_string_free(name, FALSE);
+}
+
+static void
+virt_viewer_watchdog_record(gint64 duration)
+{
+    gchar *name = virt_viewer_watchdog_sample_name();
+    WatchdogStall *stall = g_hash_table_lookup(watchdog.stalls, name);
+
+    g_debug("main loop stalled for %.1f ms in %s", duration / 1000.0, name);
+    if (stall == NULL) {
+        stall = g_new0(WatchdogStall, 1);
+        g_hash_table_insert(watchdog.stalls, name, stall);
+    } else {
+        g_free(name);
+    }
+    stall->count++;
+    stall->total += duration;
+    stall->max = MAX(stall->max, duration);
+}
+
+/* the time between two polls is one main loop iteration */
+static gint
+virt_viewer_watchdog_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 since;
+    gint ret;
+
+    G_LOCK(watchdog);
+    since = watchdog.busy_since;
+    watchdog.busy_since = 0;
+    G_UNLOCK(watchdog);
+    if (since != 0 && now - since >= watchdog.threshold)
+        virt_viewer_watchdog_record(now - since);
+
+    ret = watchdog.poll(fds, nfds, timeout);
+
+#ifdef WATCHDOG_SAMPLE
+    /* a sample that came in late, while polling */
+    watchdog_sample_ready = 0;
+#endif
+    G_LOCK(watchdog);
+    watchdog.busy_since = g_get_monotonic_time();
+    G_UNLOCK(watchdog);
+
+    return ret;
+}
+
+static gint
+virt_viewer_watchdog_compare(gconstpointer a, gconstpointer b)
+{
+    const WatchdogStall *x = g_hash_table_lookup(watchdog.stalls, a);
+    const WatchdogStall *y = g_hash_table_lookup(watchdog.stalls, b);
+
+    return x->total > y->total ? -1 : x->total < y->total;
+}
+
+/*
+ * Writes the stalls seen so far on stderr, the ones that took the most
+ * time in total first.
+ */
+void virt_viewer_watchdog_report(void)
+{
+    GList *names, *l;
+    guint count = 0;
+
+    if (watchdog.stalls == NULL)
+        return;
+
+    names = g_list_sort(g_hash_table_get_keys(watchdog.stalls), virt_viewer_watchdog_compare);
+    for (l = names; l != NULL; l = l->next)
+        count += ((WatchdogStall *)g_hash_table_lookup(watchdog.stalls, l->data))->count;
+
+    g_printerr("main loop: %u stalls over %" G_GINT64_FORMAT " ms in %.0f s\n",
+               count, watchdog.threshold / 1000,
+               (g_get_monotonic_time() - watchdog.started) / (gdouble)G_USEC_PER_SEC);
+    for (l = names; l != NULL; l = l->next) {
+        WatchdogStall *stall = g_hash_table_lookup(watchdog.stalls, l->data);
+
+        g_printerr("  %u x, max %.1f ms, total %.1f ms: %s\n",
+                   stall->count, stall->max / 1000.0, stall->total / 1000.0,
+                   (const gchar *)l->data);
+    }
+    g_list_free(names);
+}
+
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+static gboolean
+virt_viewer_watchdog_signal(gpointer data G_GNUC_UNUSED)
+{
+    virt_viewer_watchdog_report();
+    return TRUE;
+}
+#endif
+
+/*
+ * Watches the default main loop for iterations longer than
+ * @threshold_ms. On glibc a thread interrupts the main thread once per
+ * stall to see where it is. The summary is written when the last user
+ * calls virt_viewer_watchdog_stop(), and on SIGUSR1.
+ */
+void virt_viewer_watchdog_start(guint threshold_ms)
+{
+#ifdef WATCHDOG_SAMPLE
+    void *self = (void *)virt_viewer_watchdog_start;
+    struct sigaction action;
+    GError *error = NULL;
+    gchar **symbols;
+#endif
+
+    if (watchdog.refs++ > 0)
+        return;
+
+    watchdog.threshold = (gint64)threshold_ms * 1000;
+    watchdog.started = g_get_monotonic_time();
+    watchdog.stalls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    watchdog.poll = g_main_context_get_poll_func(NULL);
+    g_main_context_set_poll_func(NULL, virt_viewer_watchdog_poll);
+
+#ifdef WATCHDOG_SAMPLE
+    /* our frames are the ones from the same file as this function */
+    symbols = backtrace_symbols(&self, 1);
+    watchdog.program = g_strndup(symbols[0], strcspn(symbols[0], "("));
+    free(symbols);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = virt_viewer_watchdog_sample;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(WATCHDOG_SIGNAL, &action, &watchdog.old_action);
+    watchdog.main_thread = pthread_self();
+    /* backtrace() loads libgcc on first use, not something to do in a handler */
+    backtrace(watchdog_frames, 1);
+
+    g_atomic_int_set(&watchdog.quit, 0);
+#if GLIB_CHECK_VERSION(2, 32, 0)
+    watchdog.thread = g_thread_try_new("watchdog", virt_viewer_watchdog_thread, NULL, &error);
+#else
+    watchdog.thread = g_thread_create(virt_viewer_watchdog_thread, NULL, TRUE, &error);
+#endif
+    if (watchdog.thread == NULL) {
+        g_warning("Cannot start the main loop watchdog: %s", error->message);
+        g_clear_error(&error);
+    }
+#endif
+
+#if defined(G_OS_UNIX) && GLIB_CHECK_VERSION(2, 30, 0)
+    watchdog.report_id = g_unix_signal_add(SIGUSR1, virt_viewer_watchdog_signal, NULL);
+#endif
+    g_debug("main loop watchdog started, threshold %u ms", threshold_ms);
+}
+
+void virt_viewer_watchdog_stop(void)
+{
+    g_return_if_fail(watchdog.refs > 0);
+
+    if (--watchdog.refs > 0)
+        return;
+
+#ifdef WATCHDOG_SAMPLE
+    if (watchdog.thread != NULL) {
+        g_atomic_int_set(&watchdog.quit, 1);
+        g_thread_join(watchdog.thread);
+        watchdog.thread = NULL;
+    }
+    sigaction(WATCHDOG_SIGNAL, &watchdog.old_action, NULL);
+    g_clear_pointer(&watchdog.program, g_free);
+#endif
+    if (watchdog.report_id != 0) {
+        g_source_remove(watchdog.report_id);
+        watchdog.report_id = 0;
+    }
+    g_main_context_set_poll_func(NULL, watchdog.poll);
+
+    virt_viewer_watchdog_report();
+    g_clear_pointer(&watchdog.stalls, g_hash_table_unref);
+}
+
 void virt_viewer_util_init(const char *appname)
 {
 #ifdef G_OS_WIN32
@@ -55,6 +55,11 @@ gulong virt_viewer_signal_connect_object(gpointer instance,
 gchar* spice_hotkey_to_gtk_accelerator(const gchar *key);
 gint virt_viewer_compare_version(const gchar *s1, const gchar *s2);
 
+/* main loop stall watchdog */
+void virt_viewer_watchdog_start(guint threshold_ms);
+void virt_viewer_watchdog_stop(void);
+void virt_viewer_watchdog_report(void);
+
 /* monitor alignment */
 void virt_viewer_align_monitors_linear(GdkRectangle *displays, guint ndisplays);
 void virt_viewer_shift_monitors_to_origin(GdkRectangle *displays, guint ndisplays);
@@ -79,6 +79,7 @@ void virt_viewer_window_menu_file_usb_device_selection(GtkWidget *menu, VirtView
 void virt_viewer_window_menu_file_smartcard_insert(GtkWidget *menu, VirtViewerWindow *self);
 void virt_viewer_window_menu_file_smartcard_remove(GtkWidget *menu, VirtViewerWindow *self);
 void virt_viewer_window_menu_view_release_cursor(GtkWidget *menu, VirtViewerWindow *self);
+void virt_viewer_window_menu_view_hud(GtkWidget *menu, VirtViewerWindow *self);
 
 /* Internal methods */
 static void virt_viewer_window_enable_modifiers(VirtViewerWindow *self);
@@ -127,6 +128,18 @@ struct _VirtViewerWindowPrivate {
     gint zoomlevel;
     gboolean fullscreen;
     gchar *subtitle;
+
+    /* the display is throttled while nobody can see it */
+    gboolean iconified;
+    gboolean obscured;
+
+    /* performance overlay, see virt_viewer_window_update_hud */
+    GtkWidget *hud_box;
+    GtkWidget *hud;
+    guint hud_id;
+    gint64 hud_time;
+    guint64 hud_received;
+    guint64 hud_presented;
 		
 #ifdef G_OS_WIN32
 	gint						 win_x;
@@ -201,6 +214,11 @@ virt_viewer_window_dispose (GObject *object)
     VirtViewerWindowPrivate *priv = VIRT_VIEWER_WINDOW(object)->priv;
     GSList *it;
 
+    if (priv->hud_id) {
+        g_source_remove(priv->hud_id);
+        priv->hud_id = 0;
+    }
+
     if (priv->display) {
         g_object_unref(priv->display);
         priv->display = NULL;
@@ -324,37 +342,48 @@ can_activate_cb (GtkWidget *widget G_GNUC_UNUSED,
 }
 
 #if GTK_CHECK_VERSION(3, 0, 0)
-void init_with_css(void){
-    /*--- CSS -----------------*/
-    GtkCssProvider *provider; 
-    GdkDisplay *display;
-    GdkScreen *screen;
-    /*-------------------------*/
-    /** css  init */
-     provider = gtk_css_provider_new ();
-     display = gdk_display_get_default ();
-     screen = gdk_display_get_default_screen (display);
-
-     gtk_style_context_add_provider_for_screen (screen,
-                                     GTK_STYLE_PROVIDER (provider),
-                                     GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
-
-     gsize bytes_written, bytes_read;
-
-     #ifndef G_OS_WIN32
-      const gchar* home = g_build_filename(g_path_get_dirname(LOCALE_DIR),"css", "tcloud.css", NULL);  
-     #else
-      gchar* current_path = g_build_path(G_DIR_SEPARATOR_S, g_path_get_dirname(g_find_program_in_path(g_get_application_name())), NULL);
-      const gchar* home = g_build_path(G_DIR_SEPARATOR_S, g_path_get_dirname(current_path), "share", "css", "tcloud.css", NULL);
-     #endif
-
-     GError *error = 0;
-    
-     gtk_css_provider_load_from_path(provider,
-                                      g_filename_to_utf8(home, strlen(home), &bytes_read, &bytes_written, &error),
-                                    NULL);
-     
-     g_object_unref (provider);
+/*
+ * The style sheet applies to the whole screen, so it is parsed for the
+ * first window only; later windows, including those of an app recreated
+ * on reconnect, share the same provider.
+ */
+static void
+init_with_css(void)
+{
+    static GtkCssProvider *provider = NULL;
+    GError *error = NULL;
+    gchar *path, *dir;
+
+    if (provider != NULL)
+        return;
+
+    provider = gtk_css_provider_new();
+    gtk_style_context_add_provider_for_screen(gdk_display_get_default_screen(gdk_display_get_default()),
+                                              GTK_STYLE_PROVIDER(provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+
+#ifndef G_OS_WIN32
+    dir = g_path_get_dirname(LOCALE_DIR);
+    path = g_build_filename(dir, "css", "tcloud.css", NULL);
+#else
+    {
+        gchar *program = g_find_program_in_path(g_get_application_name());
+        gchar *bindir = g_path_get_dirname(program);
+
+        dir = g_path_get_dirname(bindir);
+        path = g_build_filename(dir, "share", "css", "tcloud.css", NULL);
+        g_free(bindir);
+        g_free(program);
+    }
+#endif
+
+    if (!gtk_css_provider_load_from_path(provider, path, &error)) {
+        g_debug("Failed to load style sheet %s: %s", path, error->message);
+        g_clear_error(&error);
+    }
+
+    g_free(path);
+    g_free(dir);
 }
 #endif
 
@@ -387,6 +416,43 @@ static void log_handler(const gchar *log_domain,
    g_free(tmp_buffer);
 }
 
+static void
+virt_viewer_window_update_hidden(VirtViewerWindow *self)
+{
+    VirtViewerWindowPrivate *priv = self->priv;
+
+    if (priv->display == NULL)
+        return;
+
+    virt_viewer_display_set_hidden(priv->display,
+                                   !gtk_widget_get_mapped(priv->window) ||
+                                   priv->iconified || priv->obscured);
+}
+
+static gboolean
+virt_viewer_window_state_event(GtkWidget *widget G_GNUC_UNUSED,
+                               GdkEventWindowState *event,
+                               VirtViewerWindow *self)
+{
+    self->priv->iconified = (event->new_window_state &
+                             (GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+    virt_viewer_window_update_hidden(self);
+
+    return FALSE;
+}
+
+/* not sent by compositing window managers, which keep every window drawn */
+static gboolean
+virt_viewer_window_visibility_event(GtkWidget *widget G_GNUC_UNUSED,
+                                    GdkEventVisibility *event,
+                                    VirtViewerWindow *self)
+{
+    self->priv->obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+    virt_viewer_window_update_hidden(self);
+
+    return FALSE;
+}
+
 static void
 virt_viewer_window_init (VirtViewerWindow *self)
 {
@@ -394,6 +460,7 @@ virt_viewer_window_init (VirtViewerWindow *self)
     GtkWidget *vbox;
     GdkColor color;
     GSList *accels;
+    gint64 ui_start = g_get_monotonic_time();
 
     self->priv = GET_PRIVATE(self);
     priv = self->priv;
@@ -420,6 +487,8 @@ virt_viewer_window_init (VirtViewerWindow *self)
                      "can-activate-accel", G_CALLBACK(can_activate_cb), self);
     g_signal_connect(gtk_builder_get_object(priv->builder, "menu-view-release-cursor"),
                      "can-activate-accel", G_CALLBACK(can_activate_cb), self);
+    g_signal_connect(gtk_builder_get_object(priv->builder, "menu-view-hud"),
+                     "can-activate-accel", G_CALLBACK(can_activate_cb), self);
     g_signal_connect(gtk_builder_get_object(priv->builder, "menu-view-zoom-reset"),
                      "can-activate-accel", G_CALLBACK(can_activate_cb), self);
     g_signal_connect(gtk_builder_get_object(priv->builder, "menu-view-zoom-in"),
@@ -437,6 +506,16 @@ virt_viewer_window_init (VirtViewerWindow *self)
     priv->window = GTK_WIDGET(gtk_builder_get_object(priv->builder, "viewer"));
     gtk_window_add_accel_group(GTK_WINDOW(priv->window), priv->accel_group);
 
+    gtk_widget_add_events(priv->window, GDK_VISIBILITY_NOTIFY_MASK);
+    g_signal_connect(priv->window, "window-state-event",
+                     G_CALLBACK(virt_viewer_window_state_event), self);
+    g_signal_connect(priv->window, "visibility-notify-event",
+                     G_CALLBACK(virt_viewer_window_visibility_event), self);
+    g_signal_connect_swapped(priv->window, "map",
+                             G_CALLBACK(virt_viewer_window_update_hidden), self);
+    g_signal_connect_swapped(priv->window, "unmap",
+                             G_CALLBACK(virt_viewer_window_update_hidden), self);
+
     virt_viewer_window_update_title(self);
     gtk_window_set_resizable(GTK_WINDOW(priv->window), TRUE);
 #if GTK_CHECK_VERSION(3, 0, 0)
@@ -470,6 +549,9 @@ virt_viewer_window_init (VirtViewerWindow *self)
 			init_with_css();
 #endif
 
+    g_debug("Window UI built in %" G_GINT64_FORMAT " us",
+            g_get_monotonic_time() - ui_start);
+
 GError *error = NULL;
 
 
@@ -1132,34 +1214,54 @@ static GdkPixbufFormat *get_image_format(const char *filename)
     return g_hash_table_lookup(image_formats_once.retval, ext);
 }
 
+static void
+virt_viewer_window_screenshot_saved(GObject *source,
+                                    GAsyncResult *result,
+                                    gpointer user_data)
+{
+    gchar *file = user_data;
+    GError *error = NULL;
+
+    if (!virt_viewer_display_save_screenshot_finish(VIRT_VIEWER_DISPLAY(source), result, &error)) {
+        g_warning("Failed to save screenshot %s: %s", file, error->message);
+        g_clear_error(&error);
+    } else {
+        g_debug("screenshot saved to %s", file);
+    }
+    g_free(file);
+}
+
 static void
 virt_viewer_window_save_screenshot(VirtViewerWindow *self,
                                    const char *file)
 {
     VirtViewerWindowPrivate *priv = self->priv;
-    GdkPixbuf *pix = virt_viewer_display_get_pixbuf(VIRT_VIEWER_DISPLAY(priv->display));
     GdkPixbufFormat *format = get_image_format(file);
-
-    if (format == NULL) {
+    gchar *type;
+    gchar *path;
+
+    if (g_str_has_suffix(file, ".ppm") || g_str_has_suffix(file, ".pnm")) {
+        type = g_strdup("ppm");
+        path = g_strdup(file);
+    } else if (g_str_has_suffix(file, ".qoi")) {
+        type = g_strdup("qoi");
+        path = g_strdup(file);
+    } else if (format == NULL) {
         g_debug("unknown file extension, falling back to png");
-        if (!g_str_has_suffix(file, ".png")) {
-            char *png_filename;
-            png_filename = g_strconcat(file, ".png", NULL);
-            gdk_pixbuf_save(pix, png_filename, "png", NULL,
-                            "tEXt::Generator App", PACKAGE, NULL);
-            g_free(png_filename);
-        } else {
-            gdk_pixbuf_save(pix, file, "png", NULL,
-                            "tEXt::Generator App", PACKAGE, NULL);
-        }
+        type = g_strdup("png");
+        if (!g_str_has_suffix(file, ".png"))
+            path = g_strconcat(file, ".png", NULL);
+        else
+            path = g_strdup(file);
     } else {
-        char *type = gdk_pixbuf_format_get_name(format);
-        g_debug("saving to %s", type);
-        gdk_pixbuf_save(pix, file, type, NULL, NULL);
-        g_free(type);
+        type = gdk_pixbuf_format_get_name(format);
+        path = g_strdup(file);
     }
 
-    g_object_unref(pix);
+    g_debug("saving to %s", type);
+    virt_viewer_display_save_screenshot_async(VIRT_VIEWER_DISPLAY(priv->display), path, type,
+                                              virt_viewer_window_screenshot_saved, path);
+    g_free(type);
 }
 
 G_MODULE_EXPORT void
@@ -1227,6 +1329,83 @@ virt_viewer_window_menu_view_release_cursor(GtkWidget *menu G_GNUC_UNUSED,
     virt_viewer_display_release_cursor(VIRT_VIEWER_DISPLAY(self->priv->display));
 }
 
+/* refresh rate of the performance overlay, in milliseconds */
+#define HUD_INTERVAL 500
+
+static gboolean
+virt_viewer_window_update_hud(gpointer opaque)
+{
+    VirtViewerWindow *self = opaque;
+    VirtViewerWindowPrivate *priv = self->priv;
+    VirtViewerSession *session = virt_viewer_app_get_session(priv->app);
+    GString *text = g_string_new(NULL);
+    gint64 now = g_get_monotonic_time();
+    gchar *markup;
+
+    if (priv->display != NULL) {
+        gdouble elapsed = (now - priv->hud_time) / (gdouble)G_USEC_PER_SEC;
+        guint64 received, presented;
+
+        virt_viewer_display_get_frame_counts(priv->display, &received, &presented);
+        if (priv->hud_time != 0 && elapsed > 0)
+            g_string_append_printf(text, "display %d: %.1f fps, %.1f updates/s\n",
+                                   virt_viewer_display_get_nth(priv->display),
+                                   (presented - priv->hud_presented) / elapsed,
+                                   (received - priv->hud_received) / elapsed);
+        g_string_append_printf(text, "latency: %.1f ms\n",
+                               virt_viewer_display_get_latency(priv->display) / 1000.0);
+        virt_viewer_display_get_input_stats(priv->display, text);
+        priv->hud_received = received;
+        priv->hud_presented = presented;
+    }
+    priv->hud_time = now;
+
+    if (session != NULL)
+        virt_viewer_session_get_stats(session, text);
+    if (text->len > 0)
+        g_string_truncate(text, text->len - 1);
+
+    markup = g_markup_printf_escaped("<tt>%s</tt>", text->str);
+    gtk_label_set_markup(GTK_LABEL(priv->hud), markup);
+    g_free(markup);
+    g_string_free(text, TRUE);
+
+    return TRUE;
+}
+
+/*
+ * The overlay only exists as a hidden label while it is off: nothing is
+ * sampled or drawn until it is shown, then it refreshes every HUD_INTERVAL.
+ */
+static void
+virt_viewer_window_show_hud(VirtViewerWindow *self, gboolean show)
+{
+    VirtViewerWindowPrivate *priv = self->priv;
+
+    if (show == (priv->hud_id != 0))
+        return;
+
+    if (show) {
+        priv->hud_time = 0;
+        virt_viewer_window_update_hud(self);
+        priv->hud_id = g_timeout_add(HUD_INTERVAL, virt_viewer_window_update_hud, self);
+        gtk_widget_show(priv->hud);
+        ViewOvBox_SetFraction(VIEW_OV_BOX(priv->hud_box), 1);
+    } else {
+        g_source_remove(priv->hud_id);
+        priv->hud_id = 0;
+        ViewOvBox_SetFraction(VIEW_OV_BOX(priv->hud_box), 0);
+        gtk_widget_hide(priv->hud);
+    }
+}
+
+G_MODULE_EXPORT void
+virt_viewer_window_menu_view_hud(GtkWidget *menu,
+                                 VirtViewerWindow *self)
+{
+    virt_viewer_window_show_hud(self, gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(menu)));
+}
+
 G_MODULE_EXPORT void
 virt_viewer_window_menu_help_guest_details(GtkWidget *menu G_GNUC_UNUSED,
                                            VirtViewerWindow *self)
@@ -1441,10 +1620,13 @@ void send_usb_and_read_from_pipe(uint32_t id, unsigned short vid, unsigned short
 
 
 static void send_cat(VirtViewerWindow *win){
-    SpiceGrabSequence *seq = spice_grab_sequence_new_from_string("Control_L+Alt_L+Delete");
-//    spice_display_send_keys(SPICE_DISPLAY(win->priv->display), seq->keysyms, seq->nkeysyms, SPICE_DISPLAY_KEY_EVENT_CLICK);
-	virt_viewer_display_send_keys(VIRT_VIEWER_DISPLAY(win->priv->display),
-                                  seq->keysyms, seq->nkeysyms);
+    static const guint keys[] = { GDK_Control_L, GDK_Alt_L, GDK_Delete };
+
+    g_return_if_fail(win->priv->display != NULL);
+
+    /* through the display input pipeline, in order with the pointer */
+    virt_viewer_display_send_keys(VIRT_VIEWER_DISPLAY(win->priv->display),
+                                  keys, G_N_ELEMENTS(keys));
 }
 static void menu_cb_sending_keys(GtkAction *action, void *data)
 {
@@ -2208,6 +2390,31 @@ static void menu_cb_mouse_mode(GtkAction *action, void *data)
 }
 
 
+#ifdef USE_USBREDIR
+static void
+usb_menu_populate(GtkMenuToolButton *button, VirtViewerWindow *self)
+{
+    GtkWidget *menu = gtk_menu_tool_button_get_menu(button);
+    GtkWidget *usb_item;
+    GtkWidget *usb_auto_item;
+    GList *children = gtk_container_get_children(GTK_CONTAINER(menu));
+
+    g_list_free(children);
+    if (children != NULL)
+        return;
+
+    usb_item = gtk_menu_item_new_with_label(_("Select usb redirection"));
+    usb_auto_item = gtk_menu_item_new_with_label(_("Configure automatic redirection"));
+
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), usb_item);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), usb_auto_item);
+
+    g_signal_connect(usb_item, "activate", G_CALLBACK(menu_cb_select_usb_devices), self);
+    g_signal_connect(usb_auto_item, "activate", G_CALLBACK(menu_cb_select_auto_usb_devices), self);
+    gtk_widget_show_all(menu);
+}
+#endif
+
 static void
 virt_viewer_window_toolbar_setup(VirtViewerWindow *self)
 {
@@ -2325,22 +2532,11 @@ virt_viewer_window_toolbar_setup(VirtViewerWindow *self)
 			 //USE_USBREDIR
 #ifdef  USE_USBREDIR
 			GtkWidget *menu;
-			GtkWidget *usb_item;
-			GtkWidget *usb_auto_item;
 	
+			/* items are added when the menu is first shown */
 			menu = gtk_menu_new();
 			gtk_widget_set_name(menu, "usb_menu");
 	
-			usb_item = gtk_menu_item_new_with_label(_("Select usb redirection"));
-			usb_auto_item = gtk_menu_item_new_with_label(_("Configure automatic redirection"));
-	
-			gtk_menu_shell_append(GTK_MENU_SHELL(menu), usb_item);
-			gtk_menu_shell_append(GTK_MENU_SHELL(menu), usb_auto_item);
-	
-			g_signal_connect(usb_item, "activate", G_CALLBACK(menu_cb_select_usb_devices), self);
-			
-			g_signal_connect(usb_auto_item, "activate", G_CALLBACK(menu_cb_select_auto_usb_devices), self);
-	
 			button = gtk_image_new_from_icon_name("rusb-redir-1",
 																						GTK_ICON_SIZE_INVALID);
 			button = GTK_WIDGET(gtk_menu_tool_button_new(button, NULL));
@@ -2350,7 +2546,7 @@ virt_viewer_window_toolbar_setup(VirtViewerWindow *self)
 			gtk_container_set_border_width(GTK_CONTAINER(menu), 0);
 			gtk_widget_set_sensitive(button, enable_toolbar);
 			gtk_menu_tool_button_set_menu(GTK_MENU_TOOL_BUTTON(button), menu);
-			gtk_widget_show_all(menu);
+			g_signal_connect(button, "show-menu", G_CALLBACK(usb_menu_populate), self);
 			gtk_widget_show_all(button);
 #endif
 			/* Poweroff function */
@@ -2382,11 +2578,21 @@ virt_viewer_window_toolbar_setup(VirtViewerWindow *self)
 			gtk_widget_set_sensitive(button, FALSE);
 			gtk_widget_show_all (GTK_WIDGET (button));
 
+    /* performance overlay, in the top left corner of the display */
+    priv->hud = gtk_label_new(NULL);
+    gtk_misc_set_padding(GTK_MISC(priv->hud), 6, 4);
+    priv->hud_box = ViewOvBox_New();
+    ViewOvBox_SetOver(VIEW_OV_BOX(priv->hud_box), priv->hud);
+    ViewOvBox_SetUnder(VIEW_OV_BOX(priv->hud_box), GTK_WIDGET(priv->notebook));
+    gtk_container_child_set(GTK_CONTAINER(priv->hud_box), priv->hud,
+                            "expand", FALSE, "fill", FALSE, "padding", 0, NULL);
+    gtk_widget_show(priv->hud_box);
+
     priv->layout = ViewAutoDrawer_New();
 
     ViewAutoDrawer_SetActive(VIEW_AUTODRAWER(priv->layout), FALSE);
     ViewOvBox_SetOver(VIEW_OV_BOX(priv->layout), priv->toolbar);
-    ViewOvBox_SetUnder(VIEW_OV_BOX(priv->layout), GTK_WIDGET(priv->notebook));
+    ViewOvBox_SetUnder(VIEW_OV_BOX(priv->layout), priv->hud_box);
     ViewAutoDrawer_SetOffset(VIEW_AUTODRAWER(priv->layout), -1);
     ViewAutoDrawer_SetFill(VIEW_AUTODRAWER(priv->layout), FALSE);
     ViewAutoDrawer_SetOverlapPixels(VIEW_AUTODRAWER(priv->layout), 1);
@@ -2532,11 +2738,13 @@ virt_viewer_window_set_display(VirtViewerWindow *self, VirtViewerDisplay *displa
 
     priv = self->priv;
     if (priv->display) {
+        virt_viewer_display_set_hidden(priv->display, FALSE);
         gtk_notebook_remove_page(GTK_NOTEBOOK(priv->notebook), 1);
         g_object_unref(priv->display);
         priv->display = NULL;
     }
 
+    priv->hud_time = 0;
     if (display != NULL) {
         priv->display = g_object_ref(display);
 
@@ -2570,6 +2778,7 @@ virt_viewer_window_set_display(VirtViewerWindow *self, VirtViewerDisplay *displa
                                           G_CALLBACK(display_show_hint), self, 0);
 
         display_show_hint(display, NULL, self);
+        virt_viewer_window_update_hidden(self);
 
         if (virt_viewer_display_get_enabled(display))
             virt_viewer_window_desktop_resize(display, self);
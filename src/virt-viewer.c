@@ -37,7 +37,7 @@
 
 #include <libvirt/libvirt.h>
 #include <libvirt/virterror.h>
-#include <libxml/xpath.h>
+#include <libxml/xmlreader.h>
 #include <libxml/uri.h>
 
 #if defined(HAVE_SOCKETPAIR)
@@ -60,23 +60,79 @@ struct _VirtViewerPrivate {
     gboolean auth_cancelled;
     gint domain_event;
     guint reconnect_poll; /* source id */
+    guint reconnect_delay; /* ms, grows until a connect attempt succeeds */
+    guint reconnect_attempts;
+    gboolean domain_down; /* the last attempt found the guest missing or shut off */
+
+    /* --libvirt-thread: libvirt RPC runs in rpc_pool, events on their own thread */
+    gboolean libvirt_thread;
+    GThreadPool *rpc_pool;
+    gboolean probe_pending;
+    gboolean starting;
+    int prefetched_fd;
+
+    /* --attach: graphics fds opened ahead of the channels that need them */
+    GThreadPool *fd_pool;
+    GQueue *pooled_fds; /* fd + 1, so that fd 0 is not NULL */
+    guint fds_pending;
+    GQueue *fd_waiters; /* channels that asked while their fd was pending */
+    guint fd_pool_expire; /* source id, set while the channels are connecting */
+    guint fd_pool_generation;
+    gboolean fd_pool_disabled;
+
+    /* <graphics> elements of the last domain XML seen, keyed on its digest */
+    gchar *graphics_digest;
+    GPtrArray *graphics;
 };
 
+enum {
+    PROP_0,
+    PROP_LIBVIRT_THREAD,
+    PROP_RECONNECT_ATTEMPTS,
+};
+
+/* Bounds of the backoff between libvirt reconnect attempts, in ms */
+#define VIRT_VIEWER_RECONNECT_DELAY_MIN 500
+#define VIRT_VIEWER_RECONNECT_DELAY_MAX 30000
+
+#define VIRT_VIEWER_FD_POOL_THREADS 4
+/* fds nobody asked for by then are closed again, in seconds */
+#define VIRT_VIEWER_FD_POOL_EXPIRE 10
+
 G_DEFINE_TYPE (VirtViewer, virt_viewer, VIRT_VIEWER_TYPE_APP)
 #define GET_PRIVATE(o)                                                        \
     (G_TYPE_INSTANCE_GET_PRIVATE ((o), VIRT_VIEWER_TYPE, VirtViewerPrivate))
 
 static gboolean virt_viewer_initial_connect(VirtViewerApp *self, GError **error);
 static gboolean virt_viewer_open_connection(VirtViewerApp *self, int *fd);
+static void virt_viewer_channel_open(VirtViewerApp *self, VirtViewerSession *session,
+                                     VirtViewerSessionChannel *channel);
 static void virt_viewer_deactivated(VirtViewerApp *self, gboolean connect_error);
 static gboolean virt_viewer_start(VirtViewerApp *self);
 static void virt_viewer_dispose (GObject *object);
+static gboolean virt_viewer_queue_probe(VirtViewer *self);
+static void virt_viewer_conn_event_threaded(virConnectPtr conn, int reason, void *opaque);
+static void virt_viewer_session_channel_announced(VirtViewerSession *session, VirtViewer *self);
+static void virt_viewer_start_reconnect_poll(VirtViewer *self);
+static void virt_viewer_fd_pool_fill(VirtViewer *self);
+static void virt_viewer_fd_pool_clear(VirtViewer *self);
+static void virt_viewer_fd_pool_release_waiters(VirtViewer *self, gboolean open);
 
 static void
 virt_viewer_get_property (GObject *object, guint property_id,
-                          GValue *value G_GNUC_UNUSED, GParamSpec *pspec)
+                          GValue *value, GParamSpec *pspec)
 {
+    VirtViewer *self = VIRT_VIEWER(object);
+
     switch (property_id) {
+    case PROP_LIBVIRT_THREAD:
+        g_value_set_boolean(value, self->priv->libvirt_thread);
+        break;
+
+    case PROP_RECONNECT_ATTEMPTS:
+        g_value_set_uint(value, self->priv->reconnect_attempts);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -84,9 +140,15 @@ virt_viewer_get_property (GObject *object, guint property_id,
 
 static void
 virt_viewer_set_property (GObject *object, guint property_id,
-                          const GValue *value G_GNUC_UNUSED, GParamSpec *pspec)
+                          const GValue *value, GParamSpec *pspec)
 {
+    VirtViewer *self = VIRT_VIEWER(object);
+
     switch (property_id) {
+    case PROP_LIBVIRT_THREAD:
+        self->priv->libvirt_thread = g_value_get_boolean(value);
+        break;
+
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
     }
@@ -107,7 +169,26 @@ virt_viewer_class_init (VirtViewerClass *klass)
     app_class->initial_connect = virt_viewer_initial_connect;
     app_class->deactivated = virt_viewer_deactivated;
     app_class->open_connection = virt_viewer_open_connection;
+    app_class->channel_open = virt_viewer_channel_open;
     app_class->start = virt_viewer_start;
+
+    g_object_class_install_property(object_class,
+                                    PROP_LIBVIRT_THREAD,
+                                    g_param_spec_boolean("libvirt-thread",
+                                                         "libvirt thread",
+                                                         "Run libvirt calls and events off the main loop",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(object_class,
+                                    PROP_RECONNECT_ATTEMPTS,
+                                    g_param_spec_uint("reconnect-attempts",
+                                                      "Reconnect attempts",
+                                                      "Number of times libvirt reconnection was attempted",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READABLE |
+                                                      G_PARAM_STATIC_STRINGS));
 }
 
 static void
@@ -115,39 +196,89 @@ virt_viewer_init(VirtViewer *self)
 {
     self->priv = GET_PRIVATE(self);
     self->priv->domain_event = -1;
+    self->priv->prefetched_fd = -1;
+    self->priv->pooled_fds = g_queue_new();
+    self->priv->fd_waiters = g_queue_new();
 }
 
 static gboolean
 virt_viewer_connect_timer(void *opaque)
 {
     VirtViewer *self = VIRT_VIEWER(opaque);
+    VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
 
     g_debug("Connect timer fired");
 
-    if (!virt_viewer_app_is_active(app) &&
-        !virt_viewer_app_initial_connect(app, NULL))
-        gtk_main_quit();
+    priv->reconnect_poll = 0;
+
+    if (!virt_viewer_app_is_active(app)) {
+        priv->reconnect_attempts++;
+        g_object_notify(G_OBJECT(self), "reconnect-attempts");
+        virt_viewer_app_trace(app, "Reconnect attempt %u to guest %s",
+                              priv->reconnect_attempts, priv->domkey);
+
+        if (!virt_viewer_app_initial_connect(app, NULL)) {
+            gtk_main_quit();
+            return FALSE;
+        }
+    }
 
     if (virt_viewer_app_is_active(app)) {
-        self->priv->reconnect_poll = 0;
+        priv->reconnect_delay = 0;
         return FALSE;
     }
 
-    return TRUE;
+    /* With a healthy connection delivering lifecycle events, a guest
+     * that is down has nothing to poll for, virt_viewer_reconnect_now()
+     * wakes us up when it starts. A running one sends no further event
+     * when its display comes up, so keep polling for that. */
+    if (priv->conn && priv->domain_event >= 0 && priv->domain_down) {
+        g_debug("Waiting for domain events");
+        priv->reconnect_delay = 0;
+        return FALSE;
+    }
+
+    virt_viewer_start_reconnect_poll(self);
+    return FALSE;
 }
 
 static void
 virt_viewer_start_reconnect_poll(VirtViewer *self)
 {
     VirtViewerPrivate *priv = self->priv;
+    guint delay;
 
     g_debug("reconnect_poll: %d", priv->reconnect_poll);
 
     if (priv->reconnect_poll != 0)
         return;
 
-    priv->reconnect_poll = g_timeout_add(500, virt_viewer_connect_timer, self);
+    /* Exponential backoff with half of the delay randomized, so that many
+     * viewers waiting on the same libvirtd don't all retry at once */
+    if (priv->reconnect_delay == 0)
+        priv->reconnect_delay = VIRT_VIEWER_RECONNECT_DELAY_MIN;
+    else
+        priv->reconnect_delay = MIN(priv->reconnect_delay * 2,
+                                    VIRT_VIEWER_RECONNECT_DELAY_MAX);
+    delay = priv->reconnect_delay / 2 +
+        g_random_int_range(0, priv->reconnect_delay / 2 + 1);
+
+    g_debug("Next reconnect attempt in %u ms", delay);
+    priv->reconnect_poll = g_timeout_add(delay, virt_viewer_connect_timer, self);
+}
+
+/* A lifecycle event arrived: drop any pending backoff and reset it */
+static void
+virt_viewer_reconnect_now(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+
+    if (priv->reconnect_poll != 0) {
+        g_source_remove(priv->reconnect_poll);
+        priv->reconnect_poll = 0;
+    }
+    priv->reconnect_delay = 0;
 }
 
 static void
@@ -156,6 +287,8 @@ virt_viewer_deactivated(VirtViewerApp *app, gboolean connect_error)
     VirtViewer *self = VIRT_VIEWER(app);
     VirtViewerPrivate *priv = self->priv;
 
+    virt_viewer_fd_pool_clear(self);
+
     if (priv->dom) {
         virDomainFree(priv->dom);
         priv->dom = NULL;
@@ -218,27 +351,26 @@ virt_viewer_parse_uuid(const char *name,
 
 
 static virDomainPtr
-virt_viewer_lookup_domain(VirtViewer *self)
+virt_viewer_lookup_domain(virConnectPtr conn, const char *domkey)
 {
     char *end;
-    VirtViewerPrivate *priv = self->priv;
     int id;
     virDomainPtr dom = NULL;
     unsigned char uuid[16];
 
-    if (priv->domkey == NULL) {
+    if (domkey == NULL) {
         return NULL;
     }
 
-    id = strtol(priv->domkey, &end, 10);
+    id = strtol(domkey, &end, 10);
     if (id >= 0 && end && !*end) {
-        dom = virDomainLookupByID(priv->conn, id);
+        dom = virDomainLookupByID(conn, id);
     }
-    if (!dom && virt_viewer_parse_uuid(priv->domkey, uuid) == 0) {
-        dom = virDomainLookupByUUID(priv->conn, uuid);
+    if (!dom && virt_viewer_parse_uuid(domkey, uuid) == 0) {
+        dom = virDomainLookupByUUID(conn, uuid);
     }
     if (!dom) {
-        dom = virDomainLookupByName(priv->conn, priv->domkey);
+        dom = virDomainLookupByName(conn, domkey);
     }
     return dom;
 }
@@ -271,46 +403,162 @@ virt_viewer_matches_domain(VirtViewer *self,
     return 0;
 }
 
-static char *
-virt_viewer_extract_xpath_string(const gchar *xmldesc,
-                                 const gchar *xpath)
+enum {
+    GRAPHICS_ATTR_TYPE,
+    GRAPHICS_ATTR_PORT,
+    GRAPHICS_ATTR_TLS_PORT,
+    GRAPHICS_ATTR_LISTEN,
+    GRAPHICS_ATTR_SOCKET,
+    GRAPHICS_ATTR_LAST
+};
+
+static const char *graphics_attr_names[GRAPHICS_ATTR_LAST] = {
+    "type", "port", "tlsPort", "listen", "socket",
+};
+
+/* attributes of one /domain/devices/graphics element */
+typedef struct {
+    gchar *attrs[GRAPHICS_ATTR_LAST];
+} VirtViewerGraphics;
+
+static void
+virt_viewer_graphics_free(gpointer data)
+{
+    VirtViewerGraphics *graphics = data;
+    int i;
+
+    for (i = 0; i < GRAPHICS_ATTR_LAST; i++)
+        g_free(graphics->attrs[i]);
+    g_free(graphics);
+}
+
+/*
+ * Collect the attributes of every /domain/devices/graphics element in a
+ * single streaming pass over the domain XML, skipping the subtrees that
+ * cannot contain one without building them.
+ */
+static GPtrArray *
+virt_viewer_extract_graphics(const gchar *xmldesc)
+{
+    xmlTextReaderPtr reader;
+    GPtrArray *result;
+    gboolean in_domain = FALSE, in_devices = FALSE;
+    int ret, i;
+
+    if (!xmldesc)
+        return NULL;
+
+    reader = xmlReaderForMemory(xmldesc, strlen(xmldesc), "domain.xml", NULL,
+                                XML_PARSE_NOENT | XML_PARSE_NONET |
+                                XML_PARSE_NOWARNING);
+    if (!reader)
+        return NULL;
+
+    result = g_ptr_array_new_with_free_func(virt_viewer_graphics_free);
+
+    ret = xmlTextReaderRead(reader);
+    while (ret == 1) {
+        int depth = xmlTextReaderDepth(reader);
+        const char *name = (const char *)xmlTextReaderConstLocalName(reader);
+
+        if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT) {
+            ret = xmlTextReaderRead(reader);
+            continue;
+        }
+
+        if (depth == 0) {
+            in_domain = g_str_equal(name, "domain");
+        } else if (depth == 1) {
+            in_devices = in_domain && g_str_equal(name, "devices");
+            if (!in_devices) {
+                ret = xmlTextReaderNext(reader);
+                continue;
+            }
+        } else if (depth == 2 && in_devices) {
+            if (g_str_equal(name, "graphics")) {
+                VirtViewerGraphics *graphics = g_new0(VirtViewerGraphics, 1);
+
+                for (i = 0; i < GRAPHICS_ATTR_LAST; i++) {
+                    xmlChar *value = xmlTextReaderGetAttribute(reader,
+                                                               (const xmlChar *)graphics_attr_names[i]);
+                    if (value && value[0] && !g_str_equal((const char *)value, "-1"))
+                        graphics->attrs[i] = g_strdup((const char *)value);
+                    xmlFree(value);
+                }
+                g_ptr_array_add(result, graphics);
+            }
+            ret = xmlTextReaderNext(reader);
+            continue;
+        }
+
+        ret = xmlTextReaderRead(reader);
+    }
+
+    xmlFreeTextReader(reader);
+
+    if (ret < 0) {
+        g_debug("Failed to parse domain XML");
+        g_ptr_array_free(result, TRUE);
+        return NULL;
+    }
+
+    return result;
+}
+
+/*
+ * Returns the <graphics> elements of @xmldesc, reusing the previous
+ * result when the XML is unchanged, as is usual when reconnecting.
+ */
+static GPtrArray *
+virt_viewer_get_graphics(VirtViewer *self, const gchar *xmldesc)
 {
-    xmlDocPtr xml = NULL;
-    xmlParserCtxtPtr pctxt = NULL;
-    xmlXPathContextPtr ctxt = NULL;
-    xmlXPathObjectPtr obj = NULL;
-    char *port = NULL;
+    VirtViewerPrivate *priv = self->priv;
+    gchar *digest;
+
+    if (!xmldesc)
+        return NULL;
+
+    digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, xmldesc, -1);
+    if (priv->graphics && g_strcmp0(digest, priv->graphics_digest) == 0) {
+        g_debug("Domain XML unchanged, reusing graphics details");
+        g_free(digest);
+        return priv->graphics;
+    }
+
+    if (priv->graphics)
+        g_ptr_array_free(priv->graphics, TRUE);
+    g_free(priv->graphics_digest);
+    priv->graphics = virt_viewer_extract_graphics(xmldesc);
+    priv->graphics_digest = priv->graphics ? digest : NULL;
+    if (!priv->graphics)
+        g_free(digest);
 
-    pctxt = xmlNewParserCtxt();
-    if (!pctxt || !pctxt->sax)
-        goto error;
+    return priv->graphics;
+}
 
-    xml = xmlCtxtReadDoc(pctxt, (const xmlChar *)xmldesc, "domain.xml", NULL,
-                         XML_PARSE_NOENT | XML_PARSE_NONET |
-                         XML_PARSE_NOWARNING);
-    if (!xml)
-        goto error;
+/*
+ * Equivalent of string(/domain/devices/graphics[@type='@type']/@attr):
+ * the value of @attr on the first graphics element of the given type
+ * that has it, or on any graphics element if @type is NULL.
+ */
+static gchar *
+virt_viewer_graphics_lookup(GPtrArray *graphics, const gchar *type, int attr)
+{
+    guint i;
 
-    ctxt = xmlXPathNewContext(xml);
-    if (!ctxt)
-        goto error;
+    if (!graphics)
+        return NULL;
 
-    obj = xmlXPathEval((const xmlChar *)xpath, ctxt);
-    if (!obj || obj->type != XPATH_STRING || !obj->stringval || !obj->stringval[0])
-        goto error;
-    if (!strcmp((const char*)obj->stringval, "-1"))
-        goto error;
+    for (i = 0; i < graphics->len; i++) {
+        VirtViewerGraphics *g = g_ptr_array_index(graphics, i);
 
-    port = g_strdup((const char*)obj->stringval);
-    xmlXPathFreeObject(obj);
-    obj = NULL;
+        if (type && g_strcmp0(g->attrs[GRAPHICS_ATTR_TYPE], type) != 0)
+            continue;
+        if (g->attrs[attr])
+            return g_strdup(g->attrs[attr]);
+    }
 
- error:
-    xmlXPathFreeObject(obj);
-    xmlXPathFreeContext(ctxt);
-    xmlFreeDoc(xml);
-    xmlFreeParserCtxt(pctxt);
-    return port;
+    return NULL;
 }
 
 
@@ -383,14 +631,20 @@ virt_viewer_is_reachable(const gchar *host, const char *transport,
 }
 
 
+/*
+ * @domxml and @conn_uri may be passed in when they were already fetched
+ * off the main loop, otherwise they are queried from libvirt here.
+ */
 static gboolean
 virt_viewer_extract_connect_info(VirtViewer *self,
-                                 virDomainPtr dom)
+                                 virDomainPtr dom,
+                                 const gchar *domxml,
+                                 const gchar *conn_uri)
 {
     char *type = NULL;
-    char *xpath = NULL;
+    GPtrArray *graphics;
     gboolean retval = FALSE;
-    char *xmldesc = virDomainGetXMLDesc(dom, 0);
+    char *xmldesc = domxml ? g_strdup(domxml) : virDomainGetXMLDesc(dom, 0);
     VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
     gchar *gport = NULL;
@@ -403,9 +657,13 @@ virt_viewer_extract_connect_info(VirtViewer *self,
     gint port = 0;
     gchar *uri = NULL;
 
+    if (!domxml)
+        virt_viewer_app_timeline_mark(app, "domain-xml");
     virt_viewer_app_free_connect_info(app);
 
-    if ((type = virt_viewer_extract_xpath_string(xmldesc, "string(/domain/devices/graphics/@type)")) == NULL) {
+    graphics = virt_viewer_get_graphics(self, xmldesc);
+    virt_viewer_app_timeline_mark(app, "graphics-extract");
+    if ((type = virt_viewer_graphics_lookup(graphics, NULL, GRAPHICS_ATTR_TYPE)) == NULL) {
         virt_viewer_app_simple_message_dialog(app, _("Cannot determine the graphic type for the guest %s"),
                                               priv->domkey);
         goto cleanup;
@@ -414,22 +672,14 @@ virt_viewer_extract_connect_info(VirtViewer *self,
     if (virt_viewer_app_create_session(app, type) < 0)
         goto cleanup;
 
-    xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@port)", type);
-    gport = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    g_free(xpath);
-    if (g_str_equal(type, "spice")) {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@tlsPort)", type);
-        gtlsport = virt_viewer_extract_xpath_string(xmldesc, xpath);
-        g_free(xpath);
-    }
+    gport = virt_viewer_graphics_lookup(graphics, type, GRAPHICS_ATTR_PORT);
+    if (g_str_equal(type, "spice"))
+        gtlsport = virt_viewer_graphics_lookup(graphics, type, GRAPHICS_ATTR_TLS_PORT);
 
-    if (gport || gtlsport) {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@listen)", type);
-        ghost = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    } else {
-        xpath = g_strdup_printf("string(/domain/devices/graphics[@type='%s']/@socket)", type);
-        unixsock = virt_viewer_extract_xpath_string(xmldesc, xpath);
-    }
+    if (gport || gtlsport)
+        ghost = virt_viewer_graphics_lookup(graphics, type, GRAPHICS_ATTR_LISTEN);
+    else
+        unixsock = virt_viewer_graphics_lookup(graphics, type, GRAPHICS_ATTR_SOCKET);
 
     if (ghost && gport) {
         g_debug("Guest graphics address is %s:%s", ghost, gport);
@@ -441,7 +691,7 @@ virt_viewer_extract_connect_info(VirtViewer *self,
         goto cleanup;
     }
 
-    uri = virConnectGetURI(priv->conn);
+    uri = conn_uri ? g_strdup(conn_uri) : virConnectGetURI(priv->conn);
     if (virt_viewer_util_extract_host(uri, NULL, &host, &transport, &user, &port) < 0) {
         virt_viewer_app_simple_message_dialog(app, _("Cannot determine the host for the guest %s"),
                                               priv->domkey);
@@ -490,14 +740,14 @@ virt_viewer_extract_connect_info(VirtViewer *self,
     g_free(transport);
     g_free(user);
     g_free(type);
-    g_free(xpath);
     g_free(xmldesc);
     g_free(uri);
     return retval;
 }
 
 static gboolean
-virt_viewer_update_display(VirtViewer *self, virDomainPtr dom)
+virt_viewer_update_display(VirtViewer *self, virDomainPtr dom,
+                           const gchar *xmldesc, const gchar *conn_uri)
 {
     VirtViewerPrivate *priv = self->priv;
     VirtViewerApp *app = VIRT_VIEWER_APP(self);
@@ -513,18 +763,21 @@ virt_viewer_update_display(VirtViewer *self, virDomainPtr dom)
     g_object_set(app, "guest-name", virDomainGetName(dom), NULL);
 
     if (!virt_viewer_app_has_session(app)) {
-        if (!virt_viewer_extract_connect_info(self, dom))
+        if (!virt_viewer_extract_connect_info(self, dom, xmldesc, conn_uri))
             return FALSE;
+
+        virt_viewer_signal_connect_object(virt_viewer_app_get_session(app),
+                                          "session-channel-announced",
+                                          G_CALLBACK(virt_viewer_session_channel_announced),
+                                          self, 0);
     }
 
     return TRUE;
 }
 
 static gboolean
-virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
+virt_viewer_domain_open_graphics(virDomainPtr dom, int *fd)
 {
-    VirtViewer *viewer = VIRT_VIEWER(self);
-    VirtViewerPrivate *priv = viewer->priv;
 #if defined(HAVE_SOCKETPAIR) || defined(HAVE_VIR_DOMAIN_OPEN_GRAPHICS_FD)
     virErrorPtr err;
 #endif
@@ -533,11 +786,8 @@ virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
 #endif
     *fd = -1;
 
-    if (!priv->dom)
-        return TRUE;
-
 #ifdef HAVE_VIR_DOMAIN_OPEN_GRAPHICS_FD
-    if ((*fd = virDomainOpenGraphicsFD(priv->dom, 0,
+    if ((*fd = virDomainOpenGraphicsFD(dom, 0,
                                        VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH)) >= 0)
         return TRUE;
 
@@ -552,7 +802,7 @@ virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
     if (socketpair(PF_UNIX, SOCK_STREAM, 0, pair) < 0)
         return FALSE;
 
-    if (virDomainOpenGraphics(priv->dom, 0, pair[0],
+    if (virDomainOpenGraphics(dom, 0, pair[0],
                               VIR_DOMAIN_OPEN_GRAPHICS_SKIPAUTH) < 0) {
         err = virGetLastError();
         g_debug("Error %s", err && err->message ? err->message : "Unknown");
@@ -566,6 +816,295 @@ virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
     return TRUE;
 }
 
+/*
+ * Graphics fd pool
+ *
+ * With --attach every SPICE channel gets its socket from libvirt. Rather
+ * than doing one RPC per channel as each one asks for it, an fd is opened
+ * on a worker thread as soon as the main channel announces a channel, so
+ * that they all open concurrently, and handed out from the pool. A channel
+ * that asks while its fd is still being opened waits for it.
+ *
+ * With --libvirt-thread, channels that find the pool empty get their fd
+ * opened on the same workers too, rather than blocking the GTK thread.
+ */
+typedef struct {
+    VirtViewer *self;
+    virDomainPtr dom;
+    VirtViewerSessionChannel *channel; /* NULL when filling the pool */
+    guint generation;
+    int fd;
+    gint64 elapsed; /* us */
+} VirtViewerFdRequest;
+
+static gboolean
+virt_viewer_fd_pool_opened(gpointer opaque)
+{
+    VirtViewerFdRequest *req = opaque;
+    VirtViewer *self = req->self;
+    VirtViewerPrivate *priv = self->priv;
+
+    if (req->channel) {
+        if (req->generation != priv->fd_pool_generation ||
+            !virt_viewer_app_has_session(VIRT_VIEWER_APP(self))) {
+            if (req->fd >= 0)
+                close(req->fd);
+        } else {
+            if (req->fd >= 0)
+                virt_viewer_app_trace(VIRT_VIEWER_APP(self),
+                                      "Opened graphics fd %d in %.1f ms",
+                                      req->fd, req->elapsed / 1000.0);
+            virt_viewer_app_channel_open_fd(VIRT_VIEWER_APP(self),
+                                            virt_viewer_app_get_session(VIRT_VIEWER_APP(self)),
+                                            req->channel, req->fd);
+        }
+        g_object_unref(req->channel);
+        goto cleanup;
+    }
+
+    if (req->generation != priv->fd_pool_generation) {
+        if (req->fd >= 0)
+            close(req->fd);
+        goto cleanup;
+    }
+
+    priv->fds_pending--;
+
+    if (req->fd < 0) {
+        /* the channels waiting open their own */
+        g_debug("Unable to pre-open graphics fd, disabling fd pool");
+        priv->fd_pool_disabled = TRUE;
+        virt_viewer_fd_pool_release_waiters(self, TRUE);
+        goto cleanup;
+    }
+
+    virt_viewer_app_trace(VIRT_VIEWER_APP(self),
+                          "Pre-opened graphics fd %d in %.1f ms",
+                          req->fd, req->elapsed / 1000.0);
+    if (!g_queue_is_empty(priv->fd_waiters)) {
+        VirtViewerSessionChannel *channel = g_queue_pop_head(priv->fd_waiters);
+
+        virt_viewer_app_channel_open_fd(VIRT_VIEWER_APP(self),
+                                        virt_viewer_app_get_session(VIRT_VIEWER_APP(self)),
+                                        channel, req->fd);
+        g_object_unref(channel);
+    } else if (priv->fd_pool_expire == 0) {
+        close(req->fd);
+    } else {
+        g_queue_push_tail(priv->pooled_fds, GINT_TO_POINTER(req->fd + 1));
+    }
+
+cleanup:
+    virDomainFree(req->dom);
+    g_object_unref(req->self);
+    g_free(req);
+    return FALSE;
+}
+
+static void
+virt_viewer_fd_pool_open(gpointer data, gpointer user_data G_GNUC_UNUSED)
+{
+    VirtViewerFdRequest *req = data;
+    gint64 start = g_get_monotonic_time();
+
+    if (!virt_viewer_domain_open_graphics(req->dom, &req->fd))
+        req->fd = -1;
+    req->elapsed = g_get_monotonic_time() - start;
+
+    virt_viewer_events_call_main(virt_viewer_fd_pool_opened, req);
+}
+
+static VirtViewerFdRequest *
+virt_viewer_fd_request_new(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerFdRequest *req = g_new0(VirtViewerFdRequest, 1);
+
+    req->self = g_object_ref(self);
+    req->dom = priv->dom;
+    virDomainRef(req->dom);
+    req->generation = priv->fd_pool_generation;
+    req->fd = -1;
+
+    return req;
+}
+
+static gboolean
+virt_viewer_fd_pool_start(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+    GError *error = NULL;
+
+    if (priv->fd_pool)
+        return TRUE;
+
+    priv->fd_pool = g_thread_pool_new(virt_viewer_fd_pool_open, NULL,
+                                      VIRT_VIEWER_FD_POOL_THREADS,
+                                      FALSE, &error);
+    if (!priv->fd_pool) {
+        g_debug("Unable to create fd pool threads: %s",
+                error ? error->message : "unknown error");
+        g_clear_error(&error);
+        priv->fd_pool_disabled = TRUE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+virt_viewer_fd_pool_drain(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+    gpointer fd;
+
+    while ((fd = g_queue_pop_head(priv->pooled_fds)) != NULL)
+        close(GPOINTER_TO_INT(fd) - 1);
+}
+
+/* channels still waiting by then open their own fd */
+static void
+virt_viewer_fd_pool_release_waiters(VirtViewer *self, gboolean open)
+{
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerSessionChannel *channel;
+
+    while ((channel = g_queue_pop_head(priv->fd_waiters)) != NULL) {
+        if (open && virt_viewer_app_has_session(VIRT_VIEWER_APP(self)))
+            VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->channel_open(VIRT_VIEWER_APP(self),
+                                                                        virt_viewer_app_get_session(VIRT_VIEWER_APP(self)),
+                                                                        channel);
+        g_object_unref(channel);
+    }
+}
+
+static gboolean
+virt_viewer_fd_pool_expired(gpointer opaque)
+{
+    VirtViewer *self = opaque;
+    VirtViewerPrivate *priv = self->priv;
+
+    if (!g_queue_is_empty(priv->pooled_fds))
+        g_debug("Closing %u unused graphics fds",
+                g_queue_get_length(priv->pooled_fds));
+    priv->fd_pool_expire = 0;
+    virt_viewer_fd_pool_drain(self);
+    virt_viewer_fd_pool_release_waiters(self, TRUE);
+
+    return FALSE;
+}
+
+/* one fd for the channel the session just announced: the pool only
+ * lives while the channels of a connection are coming up */
+static void
+virt_viewer_fd_pool_fill(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+
+    if (!priv->dom || priv->fd_pool_disabled ||
+        !virt_viewer_app_get_attach(VIRT_VIEWER_APP(self)))
+        return;
+
+    if (!virt_viewer_fd_pool_start(self))
+        return;
+
+    if (priv->fd_pool_expire == 0)
+        priv->fd_pool_expire = g_timeout_add_seconds(VIRT_VIEWER_FD_POOL_EXPIRE,
+                                                     virt_viewer_fd_pool_expired,
+                                                     self);
+    priv->fds_pending++;
+    g_thread_pool_push(priv->fd_pool, virt_viewer_fd_request_new(self), NULL);
+}
+
+/* drop pooled fds, they belong to a display that went away */
+static void
+virt_viewer_fd_pool_clear(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+
+    priv->fd_pool_generation++;
+    priv->fds_pending = 0;
+    if (priv->fd_pool_expire != 0) {
+        g_source_remove(priv->fd_pool_expire);
+        priv->fd_pool_expire = 0;
+    }
+    virt_viewer_fd_pool_drain(self);
+    virt_viewer_fd_pool_release_waiters(self, FALSE);
+}
+
+static void
+virt_viewer_session_channel_announced(VirtViewerSession *session G_GNUC_UNUSED,
+                                      VirtViewer *self)
+{
+    virt_viewer_fd_pool_fill(self);
+}
+
+static void
+virt_viewer_channel_open(VirtViewerApp *app,
+                         VirtViewerSession *session,
+                         VirtViewerSessionChannel *channel)
+{
+    VirtViewer *self = VIRT_VIEWER(app);
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerFdRequest *req;
+
+    /* its fd is on the way */
+    if (g_queue_is_empty(priv->pooled_fds) &&
+        priv->fds_pending > g_queue_get_length(priv->fd_waiters)) {
+        g_queue_push_tail(priv->fd_waiters, g_object_ref(channel));
+        return;
+    }
+
+    /* only the RPC is worth moving off the GTK thread */
+    if (!priv->rpc_pool || !priv->dom || priv->prefetched_fd >= 0 ||
+        !g_queue_is_empty(priv->pooled_fds) ||
+        !virt_viewer_fd_pool_start(self)) {
+        VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->channel_open(app, session, channel);
+        return;
+    }
+
+    req = virt_viewer_fd_request_new(self);
+    req->channel = g_object_ref(channel);
+    g_thread_pool_push(priv->fd_pool, req, NULL);
+}
+
+static gboolean
+virt_viewer_open_connection(VirtViewerApp *self G_GNUC_UNUSED, int *fd)
+{
+    VirtViewer *viewer = VIRT_VIEWER(self);
+    VirtViewerPrivate *priv = viewer->priv;
+    gint64 start;
+    gboolean ret;
+
+    *fd = -1;
+
+    if (!priv->dom)
+        return TRUE;
+
+    /* fetched by the libvirt thread along with the domain details */
+    if (priv->prefetched_fd >= 0) {
+        *fd = priv->prefetched_fd;
+        priv->prefetched_fd = -1;
+        return TRUE;
+    }
+
+    if (!g_queue_is_empty(priv->pooled_fds)) {
+        *fd = GPOINTER_TO_INT(g_queue_pop_head(priv->pooled_fds)) - 1;
+        virt_viewer_app_trace(self, "Using pre-opened graphics fd %d", *fd);
+        return TRUE;
+    }
+
+    start = g_get_monotonic_time();
+    ret = virt_viewer_domain_open_graphics(priv->dom, fd);
+    if (*fd >= 0) {
+        virt_viewer_app_trace(self, "Opened graphics fd %d in %.1f ms",
+                              *fd, (g_get_monotonic_time() - start) / 1000.0);
+        virt_viewer_app_timeline_mark(self, "graphics-fd");
+    }
+
+    return ret;
+}
+
 static int
 virt_viewer_domain_event(virConnectPtr conn G_GNUC_UNUSED,
                          virDomainPtr dom,
@@ -588,7 +1127,8 @@ virt_viewer_domain_event(virConnectPtr conn G_GNUC_UNUSED,
         break;
 
     case VIR_DOMAIN_EVENT_STARTED:
-        virt_viewer_update_display(self, dom);
+        virt_viewer_reconnect_now(self);
+        virt_viewer_update_display(self, dom, NULL, NULL);
         virt_viewer_app_activate(app, &error);
         if (error) {
             /* we may want to consolidate error reporting in
@@ -614,6 +1154,8 @@ virt_viewer_conn_event(virConnectPtr conn G_GNUC_UNUSED,
 
     virConnectClose(priv->conn);
     priv->conn = NULL;
+    /* the registration went away with the connection */
+    priv->domain_event = -1;
 
     virt_viewer_start_reconnect_poll(self);
 }
@@ -624,6 +1166,11 @@ virt_viewer_dispose (GObject *object)
     VirtViewer *self = VIRT_VIEWER(object);
     VirtViewerPrivate *priv = self->priv;
 
+    if (priv->reconnect_poll != 0) {
+        g_source_remove(priv->reconnect_poll);
+        priv->reconnect_poll = 0;
+    }
+
     if (priv->conn) {
         if (priv->domain_event >= 0) {
             virConnectDomainEventDeregisterAny(priv->conn,
@@ -631,6 +1178,8 @@ virt_viewer_dispose (GObject *object)
             priv->domain_event = -1;
         }
         virConnectUnregisterCloseCallback(priv->conn,
+                                          priv->rpc_pool ?
+                                          virt_viewer_conn_event_threaded :
                                           virt_viewer_conn_event);
         virConnectClose(priv->conn);
         priv->conn = NULL;
@@ -639,6 +1188,33 @@ virt_viewer_dispose (GObject *object)
         virDomainFree(priv->dom);
         priv->dom = NULL;
     }
+    if (priv->rpc_pool) {
+        /* pending probes hold a reference, so the pool is idle here */
+        g_thread_pool_free(priv->rpc_pool, TRUE, TRUE);
+        priv->rpc_pool = NULL;
+    }
+    if (priv->prefetched_fd >= 0) {
+        close(priv->prefetched_fd);
+        priv->prefetched_fd = -1;
+    }
+    if (priv->fd_pool) {
+        /* requests hold a reference, so the pool is idle here */
+        g_thread_pool_free(priv->fd_pool, TRUE, TRUE);
+        priv->fd_pool = NULL;
+    }
+    if (priv->pooled_fds) {
+        virt_viewer_fd_pool_clear(self);
+        g_queue_free(priv->pooled_fds);
+        priv->pooled_fds = NULL;
+        g_queue_free(priv->fd_waiters);
+        priv->fd_waiters = NULL;
+    }
+    if (priv->graphics) {
+        g_ptr_array_free(priv->graphics, TRUE);
+        priv->graphics = NULL;
+    }
+    g_free(priv->graphics_digest);
+    priv->graphics_digest = NULL;
     g_free(priv->uri);
     priv->uri = NULL;
     g_free(priv->domkey);
@@ -646,35 +1222,65 @@ virt_viewer_dispose (GObject *object)
     G_OBJECT_CLASS(virt_viewer_parent_class)->dispose (object);
 }
 
-static virDomainPtr
-choose_vm(GtkWindow *main_window,
-          char **vm_name,
-          virConnectPtr conn,
-          GError **error)
+static GPtrArray *
+list_running_vms(virConnectPtr conn)
 {
-    GtkListStore *model;
-    GtkTreeIter iter;
-    virDomainPtr *domains, dom = NULL;
+    GPtrArray *names = g_ptr_array_new_with_free_func(g_free);
+    virDomainPtr *domains;
     int i, vms_running;
     unsigned int flags = VIR_CONNECT_LIST_DOMAINS_RUNNING;
 
-    g_return_val_if_fail(vm_name != NULL, NULL);
-    free(*vm_name);
-
-    model = gtk_list_store_new(1, G_TYPE_STRING);
-
     vms_running = virConnectListAllDomains(conn, &domains, flags);
     for (i = 0; i < vms_running; i++) {
-        gtk_list_store_append(model, &iter);
-        gtk_list_store_set(model, &iter, 0, virDomainGetName(domains[i]), -1);
+        g_ptr_array_add(names, g_strdup(virDomainGetName(domains[i])));
         virDomainFree(domains[i]);
     }
-    free(domains);
+    if (vms_running >= 0)
+        free(domains);
+
+    return names;
+}
+
+static gchar *
+choose_vm_name(GtkWindow *main_window,
+               GPtrArray *names,
+               GError **error)
+{
+    GtkListStore *model;
+    GtkTreeIter iter;
+    gchar *vm_name;
+    guint i;
+
+    model = gtk_list_store_new(1, G_TYPE_STRING);
+    for (i = 0; i < names->len; i++) {
+        gtk_list_store_append(model, &iter);
+        gtk_list_store_set(model, &iter, 0, g_ptr_array_index(names, i), -1);
+    }
 
-    *vm_name = virt_viewer_vm_connection_choose_name_dialog(main_window,
-                                                            GTK_TREE_MODEL(model),
-                                                            error);
+    vm_name = virt_viewer_vm_connection_choose_name_dialog(main_window,
+                                                           GTK_TREE_MODEL(model),
+                                                           error);
     g_object_unref(G_OBJECT(model));
+
+    return vm_name;
+}
+
+static virDomainPtr
+choose_vm(GtkWindow *main_window,
+          char **vm_name,
+          virConnectPtr conn,
+          GError **error)
+{
+    GPtrArray *names;
+    virDomainPtr dom = NULL;
+    int i;
+
+    g_return_val_if_fail(vm_name != NULL, NULL);
+    free(*vm_name);
+
+    names = list_running_vms(conn);
+    *vm_name = choose_vm_name(main_window, names, error);
+    g_ptr_array_free(names, TRUE);
     if (*vm_name == NULL)
         return NULL;
 
@@ -710,6 +1316,10 @@ virt_viewer_initial_connect(VirtViewerApp *app, GError **error)
 
     g_debug("initial connect");
 
+    if (priv->rpc_pool)
+        return virt_viewer_queue_probe(self);
+
+    priv->domain_down = FALSE;
     if (!priv->conn &&
         virt_viewer_connect(app) < 0) {
         virt_viewer_app_show_status(app, _("Waiting for libvirt to start"));
@@ -717,10 +1327,12 @@ virt_viewer_initial_connect(VirtViewerApp *app, GError **error)
     }
 
     virt_viewer_app_show_status(app, _("Finding guest domain"));
-    dom = virt_viewer_lookup_domain(self);
+    dom = virt_viewer_lookup_domain(priv->conn, priv->domkey);
+    virt_viewer_app_timeline_mark(app, "domain-lookup");
     if (!dom) {
         if (priv->waitvm) {
             virt_viewer_app_show_status(app, _("Waiting for guest domain to be created"));
+            priv->domain_down = TRUE;
             goto wait;
         } else {
             VirtViewerWindow *main_window = virt_viewer_app_get_main_window(app);
@@ -748,10 +1360,11 @@ virt_viewer_initial_connect(VirtViewerApp *app, GError **error)
 
     if (info.state == VIR_DOMAIN_SHUTOFF) {
         virt_viewer_app_show_status(app, _("Waiting for guest domain to start"));
+        priv->domain_down = TRUE;
         goto wait;
     }
 
-    if (!virt_viewer_update_display(self, dom))
+    if (!virt_viewer_update_display(self, dom, NULL, NULL))
         goto wait;
 
     ret = VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->initial_connect(app, &err);
@@ -761,6 +1374,8 @@ virt_viewer_initial_connect(VirtViewerApp *app, GError **error)
 wait:
     virt_viewer_app_trace(app, "Guest %s has not activated its display yet, waiting "
                           "for it to start", priv->domkey);
+    if (!priv->domain_down)
+        virt_viewer_start_reconnect_poll(self);
     ret = TRUE;
 
 cleanup:
@@ -780,6 +1395,26 @@ virt_viewer_error_func (void *data G_GNUC_UNUSED,
 
 
 
+typedef struct {
+    VirtViewer *self;
+    char **username;
+    char **password;
+    gboolean cancelled;
+} VirtViewerAuthRequest;
+
+static gboolean
+virt_viewer_auth_collect_main(gpointer opaque)
+{
+    VirtViewerAuthRequest *req = opaque;
+
+    req->cancelled = !virt_viewer_app_collect_credentials(VIRT_VIEWER_APP(req->self),
+                                                          "libvirt",
+                                                          req->self->priv->uri,
+                                                          req->username,
+                                                          req->password);
+    return FALSE;
+}
+
 static int
 virt_viewer_auth_libvirt_credentials(virConnectCredentialPtr cred,
                                      unsigned int ncred,
@@ -809,16 +1444,15 @@ virt_viewer_auth_libvirt_credentials(virConnectCredentialPtr cred,
     }
 
     if (username || password) {
-        VirtViewerWindow *vwin = virt_viewer_app_get_main_window(VIRT_VIEWER_APP(app));
-        GtkWindow *win = virt_viewer_window_get_window(vwin);
+        VirtViewerAuthRequest req = { app, username, password, FALSE };
 
         if (*username == NULL || **username == '\0')
             *username = g_strdup(g_get_user_name());
 
-        priv->auth_cancelled = !virt_viewer_auth_collect_credentials(win,
-                                                                     "libvirt",
-                                                                     app->priv->uri,
-                                                                     username, password);
+        /* with --libvirt-thread we are called from the RPC thread,
+         * the dialog has to run on the main loop */
+        virt_viewer_events_call_main_sync(virt_viewer_auth_collect_main, &req);
+        priv->auth_cancelled = req.cancelled;
         if (priv->auth_cancelled) {
             ret = -1;
             goto cleanup;
@@ -874,10 +1508,25 @@ virt_viewer_get_error_message_from_vir_error(VirtViewer *self,
     return error_message;
 }
 
-static int
-virt_viewer_connect(VirtViewerApp *app)
+static void
+virt_viewer_report_connect_error(VirtViewerApp *app, const GError *error)
 {
-    VirtViewer *self = VIRT_VIEWER(app);
+    VirtViewerWindow *main_window = virt_viewer_app_get_main_window(app);
+
+    GtkWidget *dialog = gtk_message_dialog_new(virt_viewer_window_get_window(main_window),
+                                               GTK_DIALOG_DESTROY_WITH_PARENT,
+                                               GTK_MESSAGE_ERROR,
+                                               GTK_BUTTONS_CLOSE,
+                                               "Failed to connect: %s",
+                                               error->message);
+    gtk_dialog_run(GTK_DIALOG(dialog));
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+}
+
+static virConnectPtr
+virt_viewer_open_libvirt(VirtViewer *self)
+{
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
     VirtViewerPrivate *priv = self->priv;
     int cred_types[] =
         { VIR_CRED_AUTHNAME, VIR_CRED_PASSPHRASE };
@@ -888,7 +1537,7 @@ virt_viewer_connect(VirtViewerApp *app)
         .cbdata = app,
     };
     int oflags = 0;
-    GError *error = NULL;
+    virConnectPtr conn;
 
     if (!virt_viewer_app_get_attach(app))
         oflags |= VIR_CONNECT_RO;
@@ -897,10 +1546,24 @@ virt_viewer_connect(VirtViewerApp *app)
 
     virt_viewer_app_trace(app, "Opening connection to libvirt with URI %s",
                           priv->uri ? priv->uri : "<null>");
-    priv->conn = virConnectOpenAuth(priv->uri,
-                                    //virConnectAuthPtrDefault,
-                                    &auth_libvirt,
-                                    oflags);
+    conn = virConnectOpenAuth(priv->uri,
+                              //virConnectAuthPtrDefault,
+                              &auth_libvirt,
+                              oflags);
+    if (conn)
+        virt_viewer_app_timeline_mark(app, "libvirt-open");
+
+    return conn;
+}
+
+static int
+virt_viewer_connect(VirtViewerApp *app)
+{
+    VirtViewer *self = VIRT_VIEWER(app);
+    VirtViewerPrivate *priv = self->priv;
+    GError *error = NULL;
+
+    priv->conn = virt_viewer_open_libvirt(self);
     if (!priv->conn) {
         if (!priv->auth_cancelled) {
             gchar *error_message = virt_viewer_get_error_message_from_vir_error(self, virGetLastError());
@@ -915,16 +1578,7 @@ virt_viewer_connect(VirtViewerApp *app)
 
     if (!virt_viewer_app_initial_connect(app, &error)) {
         if (error != NULL) {
-            VirtViewerWindow *main_window = virt_viewer_app_get_main_window(app);
-
-            GtkWidget *dialog = gtk_message_dialog_new(virt_viewer_window_get_window(main_window),
-                                                       GTK_DIALOG_DESTROY_WITH_PARENT,
-                                                       GTK_MESSAGE_ERROR,
-                                                       GTK_BUTTONS_CLOSE,
-                                                       "Failed to connect: %s",
-                                                       error->message);
-            gtk_dialog_run(GTK_DIALOG(dialog));
-            gtk_widget_destroy(GTK_WIDGET(dialog));
+            virt_viewer_report_connect_error(app, error);
             g_clear_error(&error);
         }
         return -1;
@@ -952,15 +1606,374 @@ virt_viewer_connect(VirtViewerApp *app)
     return 0;
 }
 
+/*
+ * --libvirt-thread support
+ *
+ * A probe collects everything initial_connect needs from libvirt on the
+ * RPC thread: it opens the connection if required, looks up the domain,
+ * its state and XML, and opens a graphics fd. The result is applied on
+ * the main loop by virt_viewer_probe_done(). Domain and connection events
+ * arrive on the libvirt event thread and are forwarded the same way.
+ */
+typedef struct {
+    VirtViewer *self;
+    gchar *domkey;
+    gboolean list_domains;
+
+    virConnectPtr conn;
+    gboolean opened;
+    gint domain_event;
+    gboolean failed;
+    gchar *error_message;
+    virDomainPtr dom;
+    gchar *uuid;
+    int state;
+    char *xmldesc;
+    char *conn_uri;
+    GPtrArray *running;
+    int fd;
+} VirtViewerProbe;
+
+static void
+virt_viewer_probe_free(VirtViewerProbe *probe)
+{
+    if (probe->dom)
+        virDomainFree(probe->dom);
+    if (probe->conn)
+        virConnectClose(probe->conn);
+    if (probe->fd >= 0)
+        close(probe->fd);
+    if (probe->running)
+        g_ptr_array_free(probe->running, TRUE);
+    free(probe->xmldesc);
+    free(probe->conn_uri);
+    g_free(probe->domkey);
+    g_free(probe->error_message);
+    g_free(probe->uuid);
+    g_object_unref(probe->self);
+    g_free(probe);
+}
+
+typedef struct {
+    VirtViewer *self;
+    virDomainPtr dom;
+    int event;
+    int detail;
+} VirtViewerDomainEvent;
+
+static gboolean
+virt_viewer_domain_event_main(gpointer opaque)
+{
+    VirtViewerDomainEvent *ev = opaque;
+    VirtViewer *self = ev->self;
+
+    g_debug("Got domain event %d %d", ev->event, ev->detail);
+
+    if (ev->event == VIR_DOMAIN_EVENT_STARTED &&
+        virt_viewer_matches_domain(self, ev->dom) &&
+        !virt_viewer_app_is_active(VIRT_VIEWER_APP(self))) {
+        virt_viewer_reconnect_now(self);
+        virt_viewer_queue_probe(self);
+    }
+
+    virDomainFree(ev->dom);
+    g_object_unref(ev->self);
+    g_free(ev);
+    return FALSE;
+}
+
+static int
+virt_viewer_domain_event_threaded(virConnectPtr conn G_GNUC_UNUSED,
+                                  virDomainPtr dom,
+                                  int event,
+                                  int detail,
+                                  void *opaque)
+{
+    VirtViewerDomainEvent *ev = g_new0(VirtViewerDomainEvent, 1);
+
+    ev->self = g_object_ref(opaque);
+    ev->dom = dom;
+    virDomainRef(dom);
+    ev->event = event;
+    ev->detail = detail;
+    virt_viewer_events_call_main(virt_viewer_domain_event_main, ev);
+
+    return 0;
+}
+
+static gboolean
+virt_viewer_conn_event_main(gpointer opaque)
+{
+    VirtViewer *self = opaque;
+    VirtViewerPrivate *priv = self->priv;
+
+    if (priv->conn) {
+        virConnectClose(priv->conn);
+        priv->conn = NULL;
+        priv->domain_event = -1;
+    }
+
+    virt_viewer_start_reconnect_poll(self);
+
+    g_object_unref(self);
+    return FALSE;
+}
+
+static void
+virt_viewer_conn_event_threaded(virConnectPtr conn G_GNUC_UNUSED,
+                                int reason,
+                                void *opaque)
+{
+    g_debug("Got connection event %d", reason);
+
+    virt_viewer_events_call_main(virt_viewer_conn_event_main,
+                                 g_object_ref(opaque));
+}
+
+static gboolean
+virt_viewer_probe_done(gpointer opaque)
+{
+    VirtViewerProbe *probe = opaque;
+    VirtViewer *self = probe->self;
+    VirtViewerApp *app = VIRT_VIEWER_APP(self);
+    VirtViewerPrivate *priv = self->priv;
+    gboolean starting = priv->starting;
+    GError *err = NULL;
+
+    priv->probe_pending = FALSE;
+    priv->starting = FALSE;
+    priv->domain_down = FALSE;
+
+    if (probe->failed) {
+        if (probe->error_message)
+            virt_viewer_app_simple_message_dialog(app, probe->error_message);
+        if (starting)
+            goto fatal;
+        virt_viewer_app_show_status(app, _("Waiting for libvirt to start"));
+        goto wait;
+    }
+
+    if (probe->opened) {
+        if (priv->conn)
+            virConnectClose(priv->conn);
+        priv->conn = probe->conn;
+        probe->conn = NULL;
+        priv->domain_event = probe->domain_event;
+        if (priv->domain_event < 0) {
+            g_debug("No domain events, falling back to polling");
+            virt_viewer_start_reconnect_poll(self);
+        }
+    }
+
+    if (!probe->dom) {
+        VirtViewerWindow *main_window;
+        gchar *name;
+
+        if (!probe->running) {
+            virt_viewer_app_show_status(app, _("Waiting for guest domain to be created"));
+            priv->domain_down = TRUE;
+            goto wait;
+        }
+
+        main_window = virt_viewer_app_get_main_window(app);
+        name = choose_vm_name(virt_viewer_window_get_window(main_window),
+                              probe->running, &err);
+        if (name == NULL)
+            goto fatal;
+
+        g_free(priv->domkey);
+        priv->domkey = name;
+        virt_viewer_queue_probe(self);
+        goto cleanup;
+    }
+
+    if (probe->uuid == NULL) {
+        g_debug("Couldn't get uuid from libvirt");
+    } else {
+        g_object_set(app, "uuid", probe->uuid, NULL);
+    }
+
+    virt_viewer_app_show_status(app, _("Checking guest domain status"));
+    if (probe->state < 0) {
+        g_debug("Cannot get guest state");
+        goto fatal;
+    }
+
+    if (probe->state == VIR_DOMAIN_SHUTOFF) {
+        virt_viewer_app_show_status(app, _("Waiting for guest domain to start"));
+        priv->domain_down = TRUE;
+        goto wait;
+    }
+
+    if (priv->prefetched_fd >= 0)
+        close(priv->prefetched_fd);
+    priv->prefetched_fd = probe->fd;
+    probe->fd = -1;
+
+    if (!virt_viewer_update_display(self, probe->dom, probe->xmldesc, probe->conn_uri))
+        goto wait;
+
+    if (VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->initial_connect(app, &err))
+        goto cleanup;
+    if (err)
+        goto fatal;
+
+wait:
+    virt_viewer_app_trace(app, "Guest %s has not activated its display yet, waiting "
+                          "for it to start", priv->domkey);
+    if (!priv->domain_down)
+        virt_viewer_start_reconnect_poll(self);
+    goto cleanup;
+
+fatal:
+    if (err) {
+        virt_viewer_report_connect_error(app, err);
+        g_clear_error(&err);
+    }
+    gtk_main_quit();
+
+cleanup:
+    virt_viewer_probe_free(probe);
+    return FALSE;
+}
+
+static void
+virt_viewer_probe_run(gpointer data, gpointer user_data G_GNUC_UNUSED)
+{
+    VirtViewerProbe *probe = data;
+    VirtViewer *self = probe->self;
+    virDomainInfo info;
+    char uuid_string[VIR_UUID_STRING_BUFLEN];
+
+    if (!probe->conn) {
+        probe->conn = virt_viewer_open_libvirt(self);
+        if (!probe->conn) {
+            probe->failed = TRUE;
+            if (!self->priv->auth_cancelled)
+                probe->error_message =
+                    virt_viewer_get_error_message_from_vir_error(self, virGetLastError());
+            goto done;
+        }
+        probe->opened = TRUE;
+
+        /* not restricted to one domain: with --wait it may not exist yet,
+         * virt_viewer_domain_event_main() does the filtering */
+        probe->domain_event =
+            virConnectDomainEventRegisterAny(probe->conn,
+                                             NULL,
+                                             VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                             VIR_DOMAIN_EVENT_CALLBACK(virt_viewer_domain_event_threaded),
+                                             self,
+                                             NULL);
+        if (virConnectRegisterCloseCallback(probe->conn,
+                                            virt_viewer_conn_event_threaded,
+                                            self,
+                                            NULL) < 0) {
+            g_debug("Unable to register close callback on libvirt connection");
+        }
+    }
+
+    probe->dom = virt_viewer_lookup_domain(probe->conn, probe->domkey);
+    virt_viewer_app_timeline_mark(VIRT_VIEWER_APP(self), "domain-lookup");
+    if (!probe->dom) {
+        if (probe->list_domains)
+            probe->running = list_running_vms(probe->conn);
+        goto done;
+    }
+
+    if (virDomainGetUUIDString(probe->dom, uuid_string) == 0)
+        probe->uuid = g_strdup(uuid_string);
+
+    if (virDomainGetInfo(probe->dom, &info) < 0)
+        goto done;
+    probe->state = info.state;
+    if (info.state == VIR_DOMAIN_SHUTOFF)
+        goto done;
+
+    probe->xmldesc = virDomainGetXMLDesc(probe->dom, 0);
+    probe->conn_uri = virConnectGetURI(probe->conn);
+    virt_viewer_app_timeline_mark(VIRT_VIEWER_APP(self), "domain-xml");
+    virt_viewer_domain_open_graphics(probe->dom, &probe->fd);
+    if (probe->fd >= 0)
+        virt_viewer_app_timeline_mark(VIRT_VIEWER_APP(self), "graphics-fd");
+
+done:
+    virt_viewer_events_call_main(virt_viewer_probe_done, probe);
+}
+
+static gboolean
+virt_viewer_queue_probe(VirtViewer *self)
+{
+    VirtViewerPrivate *priv = self->priv;
+    VirtViewerProbe *probe;
+
+    if (priv->probe_pending)
+        return TRUE;
+
+    virt_viewer_app_show_status(VIRT_VIEWER_APP(self), _("Finding guest domain"));
+
+    probe = g_new0(VirtViewerProbe, 1);
+    probe->self = g_object_ref(self);
+    probe->domkey = g_strdup(priv->domkey);
+    probe->list_domains = !priv->waitvm;
+    probe->domain_event = -1;
+    probe->state = -1;
+    probe->fd = -1;
+    if (priv->conn) {
+        virConnectRef(priv->conn);
+        probe->conn = priv->conn;
+    }
+
+    priv->probe_pending = TRUE;
+    g_thread_pool_push(priv->rpc_pool, probe, NULL);
+
+    return TRUE;
+}
+
+static gboolean
+virt_viewer_start_libvirt_thread(VirtViewer *self, GError **error)
+{
+    VirtViewerPrivate *priv = self->priv;
+
+    priv->rpc_pool = g_thread_pool_new(virt_viewer_probe_run, NULL,
+                                       1, FALSE, error);
+    if (!priv->rpc_pool)
+        return FALSE;
+
+    if (!virt_viewer_events_register_thread(error)) {
+        g_thread_pool_free(priv->rpc_pool, TRUE, FALSE);
+        priv->rpc_pool = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
 static gboolean
 virt_viewer_start(VirtViewerApp *app)
 {
-    virt_viewer_events_register();
+    VirtViewer *self = VIRT_VIEWER(app);
+    VirtViewerPrivate *priv = self->priv;
+    GError *error = NULL;
+
+    if (priv->libvirt_thread &&
+        !virt_viewer_start_libvirt_thread(self, &error)) {
+        g_warning("Unable to run libvirt in a separate thread: %s",
+                  error ? error->message : "unknown error");
+        g_clear_error(&error);
+    }
+
+    if (!priv->rpc_pool)
+        virt_viewer_events_register();
 
     virSetErrorFunc(NULL, virt_viewer_error_func);
 
-    if (virt_viewer_connect(app) < 0)
+    if (priv->rpc_pool) {
+        priv->starting = TRUE;
+        virt_viewer_queue_probe(self);
+    } else if (virt_viewer_connect(app) < 0) {
         return FALSE;
+    }
 
     return VIRT_VIEWER_APP_CLASS(virt_viewer_parent_class)->start(app);
 }